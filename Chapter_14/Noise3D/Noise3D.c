@@ -39,25 +39,40 @@
 #include <math.h>
 #include "esUtil.h"
 
+// Uniforms of the program
+enum
+{
+   UNIFORM_MVP_MATRIX,
+   UNIFORM_MV_MATRIX,
+   UNIFORM_FOG_MIN_DIST,
+   UNIFORM_FOG_MAX_DIST,
+   UNIFORM_FOG_COLOR,
+   UNIFORM_NOISE_TEX,
+   UNIFORM_TIME,
+   NUM_UNIFORMS
+};
+
+static const char *uniformNames[NUM_UNIFORMS] =
+{
+   "u_mvpMatrix",
+   "u_mvMatrix",
+   "u_fogMinDist",
+   "u_fogMaxDist",
+   "u_fogColor",
+   "s_noiseTex",
+   "u_time"
+};
+
 typedef struct
 {
-   // Handle to a program object
-   GLuint programObject;
-
-   // Uniform locations
-   GLint  mvpLoc;
-   GLint  mvLoc;
-   GLint  fogMinDistLoc;
-   GLint  fogMaxDistLoc;
-   GLint  fogColorLoc;
-   GLint  noiseTexLoc;
-   GLint  timeLoc;
-
-   // Vertex daata
-   GLfloat  *vertices;
-   GLfloat  *texCoords;
-   GLuint   *indices;
-   int       numIndices;
+   // Program object with its reflected uniforms
+   ESProgram *program;
+
+   // Hashed uniform names
+   ESHash uniforms[NUM_UNIFORMS];
+
+   // Cube with positions and texture coordinates, uploaded once
+   ESMesh    cube;
 
    // Rotation angle
    GLfloat   angle;
@@ -84,10 +99,6 @@ typedef struct
 #define FLOOR(x)           ((int)(x) - ((x) < 0 && (x) != (int)(x)))
 #define smoothstep(t)      ( t * t * t * (t * (t * 6.0f - 15.0f) + 10.0f ) )
 #define lerp(t, a, b)      ( a + t * (b - a) )
-#ifdef _WIN32
-   #define srandom srand
-   #define random rand
-#endif
 
 // lattice gradients 3D noise
 static float   gradientTable[256 * 3];
@@ -113,7 +124,7 @@ static unsigned char permTable[256] =
    0x89, 0xD6, 0x91, 0x5D, 0x5C, 0x64, 0xF5, 0x00, 0xD8, 0xBA, 0x3C, 0x53, 0x69, 0x61, 0xCC, 0x34,
 };
 
-void initNoiseTable()
+void initNoiseTable ( ESContext *esContext )
 {
    int            i;
    float          a;
@@ -121,7 +132,7 @@ void initNoiseTable()
    float          gradients[256 * 3];
    unsigned int   *p, *psrc;
 
-   srandom ( 0 );
+   esSeedRandom ( esContext, 0 );
 
    // build gradient table for 3D noise
    for ( i = 0; i < 256; i++ )
@@ -129,12 +140,12 @@ void initNoiseTable()
       /*
       * calculate 1 - 2 * random number
       */
-      a = ( random() % 32768 ) / 32768.0f;
+      a = ( esRandom ( esContext ) % 32768 ) / 32768.0f;
       z = ( 1.0f - 2.0f * a );
 
       r = sqrtf ( 1.0f - z * z ); // r is radius of circle
 
-      a = ( random() % 32768 ) / 32768.0f;
+      a = ( esRandom ( esContext ) % 32768 ) / 32768.0f;
       theta = ( 2.0f * ( float ) M_PI * a );
       x = ( r * cosf ( a ) );
       y = ( r * sinf ( a ) );
@@ -235,7 +246,7 @@ void Create3DNoiseTexture ( ESContext *esContext )
    float max = -1000;
    float range;
 
-   initNoiseTable();
+   initNoiseTable ( esContext );
 
    for ( z = 0; z < textureSize; z++ )
    {
@@ -305,6 +316,7 @@ void Create3DNoiseTexture ( ESContext *esContext )
 int Init ( ESContext *esContext )
 {
    UserData *userData = ( UserData * ) esContext->userData;
+   int i;
    const char vShaderStr[] =
       "#version 300 es                             \n"
       "uniform mat4 u_mvpMatrix;                   \n"
@@ -367,20 +379,25 @@ int Init ( ESContext *esContext )
    Create3DNoiseTexture ( esContext );
 
    // Load the shaders and get a linked program object
-   userData->programObject = esLoadProgram ( vShaderStr, fShaderStr );
+   userData->program = esProgramCreate ( esLoadProgram ( vShaderStr, fShaderStr ) );
 
-   // Get the uniform locations
-   userData->mvpLoc = glGetUniformLocation ( userData->programObject, "u_mvpMatrix" );
-   userData->mvLoc = glGetUniformLocation ( userData->programObject, "u_mvMatrix" );
-   userData->noiseTexLoc = glGetUniformLocation ( userData->programObject, "s_noiseTex" );
-   userData->fogMinDistLoc = glGetUniformLocation ( userData->programObject, "u_fogMinDist" );
-   userData->fogMaxDistLoc = glGetUniformLocation ( userData->programObject, "u_fogMaxDist" );
-   userData->fogColorLoc = glGetUniformLocation ( userData->programObject, "u_fogColor" );
-   userData->timeLoc = glGetUniformLocation ( userData->programObject, "u_time" );
+   if ( userData->program == NULL ||
+         !esProgramCheckUniforms ( userData->program, uniformNames, NUM_UNIFORMS ) )
+   {
+      return FALSE;
+   }
+
+   // Hash the uniform names once
+   for ( i = 0; i < NUM_UNIFORMS; i++ )
+   {
+      userData->uniforms[i] = esHashName ( uniformNames[i] );
+   }
 
    // Generate the vertex data
-   userData->numIndices = esGenCube ( 3.0, &userData->vertices,
-                                      NULL, &userData->texCoords, &userData->indices );
+   if ( !esGenCubeToMesh ( esContext, 3.0, ATTRIB_LOCATION_POS, -1, ATTRIB_LOCATION_TEXCOORD, &userData->cube ) )
+   {
+      return FALSE;
+   }
 
    // Starting rotation angle for the cube
    userData->angle = 0.0f;
@@ -422,6 +439,9 @@ void Update ( ESContext *esContext, float deltaTime )
    // Compute the final MVP by multiplying the
    // modevleiw and perspective matrices together
    esMatrixMultiply ( &userData->mvpMatrix, &userData->mvMatrix, &perspective );
+
+   // The cube keeps rotating
+   esRequestRedraw ( esContext );
 }
 
 ///
@@ -438,45 +458,35 @@ void Draw ( ESContext *esContext )
    glClear ( GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT );
 
    // Use the program object
-   glUseProgram ( userData->programObject );
-
-   // Load the vertex position
-   glVertexAttribPointer ( ATTRIB_LOCATION_POS, 3, GL_FLOAT,
-                           GL_FALSE, 3 * sizeof ( GLfloat ), userData->vertices );
-
-   glEnableVertexAttribArray ( ATTRIB_LOCATION_POS );
+   glUseProgram ( userData->program->programObject );
 
    // Set the vertex color to red
    glVertexAttrib4f ( ATTRIB_LOCATION_COLOR, 1.0f, 0.0f, 0.0f, 1.0f );
 
-   // Bind the texture coordinates
-   glVertexAttribPointer ( ATTRIB_LOCATION_TEXCOORD, 2, GL_FLOAT,
-                           GL_FALSE, 2 * sizeof ( GLfloat ), userData->texCoords );
-
-   glEnableVertexAttribArray ( ATTRIB_LOCATION_TEXCOORD );
-
    // Load the matrices
-   glUniformMatrix4fv ( userData->mvpLoc, 1, GL_FALSE, ( GLfloat * ) &userData->mvpMatrix.m[0][0] );
-   glUniformMatrix4fv ( userData->mvLoc, 1, GL_FALSE, ( GLfloat * ) &userData->mvMatrix.m[0][0] );
+   esProgramUniformMatrix4fv ( userData->program, userData->uniforms[UNIFORM_MVP_MATRIX],
+                               1, ( GLfloat * ) &userData->mvpMatrix.m[0][0] );
+   esProgramUniformMatrix4fv ( userData->program, userData->uniforms[UNIFORM_MV_MATRIX],
+                               1, ( GLfloat * ) &userData->mvMatrix.m[0][0] );
 
    // Load other uniforms
    {
       float fogColor[4] = { 1.0f, 1.0f, 1.0f, 1.0f };
       float fogMinDist = 2.75f;
       float fogMaxDist = 4.0f;
-      glUniform1f ( userData->fogMinDistLoc, fogMinDist );
-      glUniform1f ( userData->fogMaxDistLoc, fogMaxDist );
+      esProgramUniform1f ( userData->program, userData->uniforms[UNIFORM_FOG_MIN_DIST], fogMinDist );
+      esProgramUniform1f ( userData->program, userData->uniforms[UNIFORM_FOG_MAX_DIST], fogMaxDist );
 
-      glUniform4fv ( userData->fogColorLoc, 1, fogColor );
-      glUniform1f ( userData->timeLoc, userData->curTime * 0.1f );
+      esProgramUniform4fv ( userData->program, userData->uniforms[UNIFORM_FOG_COLOR], 1, fogColor );
+      esProgramUniform1f ( userData->program, userData->uniforms[UNIFORM_TIME], userData->curTime * 0.1f );
    }
 
    // Bind the 3D texture
-   glUniform1i ( userData->noiseTexLoc, 0 );
+   esProgramUniform1i ( userData->program, userData->uniforms[UNIFORM_NOISE_TEX], 0 );
    glBindTexture ( GL_TEXTURE_3D, userData->textureId );
 
    // Draw the cube
-   glDrawElements ( GL_TRIANGLES, userData->numIndices, GL_UNSIGNED_INT, userData->indices );
+   esMeshDraw ( esContext, &userData->cube );
 }
 
 ///
@@ -486,27 +496,13 @@ void Shutdown ( ESContext *esContext )
 {
    UserData *userData = esContext->userData;
 
-   if ( userData->vertices != NULL )
-   {
-      free ( userData->vertices );
-   }
-
-   if ( userData->indices != NULL )
-   {
-      free ( userData->indices );
-   }
-
-   if ( userData->texCoords != NULL );
-
-   {
-      free ( userData->texCoords );
-   }
+   esMeshDestroy ( esContext, &userData->cube );
 
    // Delete texture object
    glDeleteTextures ( 1, &userData->textureId );
 
    // Delete program object
-   glDeleteProgram ( userData->programObject );
+   esProgramDestroy ( esContext, userData->program );
 }
 
 
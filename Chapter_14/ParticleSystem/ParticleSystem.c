@@ -45,16 +45,31 @@
 #define ATTRIBUTE_STARTPOSITION_LOCATION  1
 #define ATTRIBUTE_ENDPOSITION_LOCATION    2
 
+// Uniforms of the program
+enum
+{
+   UNIFORM_TIME,
+   UNIFORM_COLOR,
+   UNIFORM_CENTER_POSITION,
+   UNIFORM_SAMPLER,
+   NUM_UNIFORMS
+};
+
+static const char *uniformNames[NUM_UNIFORMS] =
+{
+   "u_time",
+   "u_color",
+   "u_centerPosition",
+   "s_texture"
+};
+
 typedef struct
 {
-   // Handle to a program object
-   GLuint programObject;
+   // Program object with its reflected uniforms
+   ESProgram *program;
 
-   // Uniform location
-   GLint timeLoc;
-   GLint colorLoc;
-   GLint centerPositionLoc;
-   GLint samplerLoc;
+   // Hashed uniform names
+   ESHash uniforms[NUM_UNIFORMS];
 
    // Texture handle
    GLuint textureId;
@@ -148,35 +163,41 @@ int Init ( ESContext *esContext )
       "}                                                    \n";
 
    // Load the shaders and get a linked program object
-   userData->programObject = esLoadProgram ( vShaderStr, fShaderStr );
+   userData->program = esProgramCreate ( esLoadProgram ( vShaderStr, fShaderStr ) );
+
+   if ( userData->program == NULL ||
+         !esProgramCheckUniforms ( userData->program, uniformNames, NUM_UNIFORMS ) )
+   {
+      return FALSE;
+   }
 
-   // Get the uniform locations
-   userData->timeLoc = glGetUniformLocation ( userData->programObject, "u_time" );
-   userData->centerPositionLoc = glGetUniformLocation ( userData->programObject, "u_centerPosition" );
-   userData->colorLoc = glGetUniformLocation ( userData->programObject, "u_color" );
-   userData->samplerLoc = glGetUniformLocation ( userData->programObject, "s_texture" );
+   // Hash the uniform names once
+   for ( i = 0; i < NUM_UNIFORMS; i++ )
+   {
+      userData->uniforms[i] = esHashName ( uniformNames[i] );
+   }
 
    glClearColor ( 0.0f, 0.0f, 0.0f, 0.0f );
 
    // Fill in particle data array
-   srand ( 0 );
+   esSeedRandom ( esContext, 0 );
 
    for ( i = 0; i < NUM_PARTICLES; i++ )
    {
       float *particleData = &userData->particleData[i * PARTICLE_SIZE];
 
       // Lifetime of particle
-      ( *particleData++ ) = ( ( float ) ( rand() % 10000 ) / 10000.0f );
+      ( *particleData++ ) = ( ( float ) ( esRandom ( esContext ) % 10000 ) / 10000.0f );
 
       // End position of particle
-      ( *particleData++ ) = ( ( float ) ( rand() % 10000 ) / 5000.0f ) - 1.0f;
-      ( *particleData++ ) = ( ( float ) ( rand() % 10000 ) / 5000.0f ) - 1.0f;
-      ( *particleData++ ) = ( ( float ) ( rand() % 10000 ) / 5000.0f ) - 1.0f;
+      ( *particleData++ ) = ( ( float ) ( esRandom ( esContext ) % 10000 ) / 5000.0f ) - 1.0f;
+      ( *particleData++ ) = ( ( float ) ( esRandom ( esContext ) % 10000 ) / 5000.0f ) - 1.0f;
+      ( *particleData++ ) = ( ( float ) ( esRandom ( esContext ) % 10000 ) / 5000.0f ) - 1.0f;
 
       // Start position of particle
-      ( *particleData++ ) = ( ( float ) ( rand() % 10000 ) / 40000.0f ) - 0.125f;
-      ( *particleData++ ) = ( ( float ) ( rand() % 10000 ) / 40000.0f ) - 0.125f;
-      ( *particleData++ ) = ( ( float ) ( rand() % 10000 ) / 40000.0f ) - 0.125f;
+      ( *particleData++ ) = ( ( float ) ( esRandom ( esContext ) % 10000 ) / 40000.0f ) - 0.125f;
+      ( *particleData++ ) = ( ( float ) ( esRandom ( esContext ) % 10000 ) / 40000.0f ) - 0.125f;
+      ( *particleData++ ) = ( ( float ) ( esRandom ( esContext ) % 10000 ) / 40000.0f ) - 0.125f;
 
    }
 
@@ -202,7 +223,7 @@ void Update ( ESContext *esContext, float deltaTime )
 
    userData->time += deltaTime;
 
-   glUseProgram ( userData->programObject );
+   esUseProgram ( esContext, userData->program->programObject );
 
    if ( userData->time >= 1.0f )
    {
@@ -212,23 +233,26 @@ void Update ( ESContext *esContext, float deltaTime )
       userData->time = 0.0f;
 
       // Pick a new start location and color
-      centerPos[0] = ( ( float ) ( rand() % 10000 ) / 10000.0f ) - 0.5f;
-      centerPos[1] = ( ( float ) ( rand() % 10000 ) / 10000.0f ) - 0.5f;
-      centerPos[2] = ( ( float ) ( rand() % 10000 ) / 10000.0f ) - 0.5f;
+      centerPos[0] = ( ( float ) ( esRandom ( esContext ) % 10000 ) / 10000.0f ) - 0.5f;
+      centerPos[1] = ( ( float ) ( esRandom ( esContext ) % 10000 ) / 10000.0f ) - 0.5f;
+      centerPos[2] = ( ( float ) ( esRandom ( esContext ) % 10000 ) / 10000.0f ) - 0.5f;
 
-      glUniform3fv ( userData->centerPositionLoc, 1, &centerPos[0] );
+      esProgramUniform3fv ( userData->program, userData->uniforms[UNIFORM_CENTER_POSITION], 1, &centerPos[0] );
 
       // Random color
-      color[0] = ( ( float ) ( rand() % 10000 ) / 20000.0f ) + 0.5f;
-      color[1] = ( ( float ) ( rand() % 10000 ) / 20000.0f ) + 0.5f;
-      color[2] = ( ( float ) ( rand() % 10000 ) / 20000.0f ) + 0.5f;
+      color[0] = ( ( float ) ( esRandom ( esContext ) % 10000 ) / 20000.0f ) + 0.5f;
+      color[1] = ( ( float ) ( esRandom ( esContext ) % 10000 ) / 20000.0f ) + 0.5f;
+      color[2] = ( ( float ) ( esRandom ( esContext ) % 10000 ) / 20000.0f ) + 0.5f;
       color[3] = 0.5;
 
-      glUniform4fv ( userData->colorLoc, 1, &color[0] );
+      esProgramUniform4fv ( userData->program, userData->uniforms[UNIFORM_COLOR], 1, &color[0] );
    }
 
    // Load uniform time variable
-   glUniform1f ( userData->timeLoc, userData->time );
+   esProgramUniform1f ( userData->program, userData->uniforms[UNIFORM_TIME], userData->time );
+
+   // The particles move every update
+   esRequestRedraw ( esContext );
 }
 
 ///
@@ -239,13 +263,13 @@ void Draw ( ESContext *esContext )
    UserData *userData = esContext->userData;
 
    // Set the viewport
-   glViewport ( 0, 0, esContext->width, esContext->height );
+   esViewport ( esContext, 0, 0, esContext->width, esContext->height );
 
    // Clear the color buffer
    glClear ( GL_COLOR_BUFFER_BIT );
 
-   // Use the program object
-   glUseProgram ( userData->programObject );
+   // Use the program object, already current since Update
+   esUseProgram ( esContext, userData->program->programObject );
 
    // Load the vertex attributes
    glVertexAttribPointer ( ATTRIBUTE_LIFETIME_LOCATION, 1, GL_FLOAT,
@@ -261,20 +285,19 @@ void Draw ( ESContext *esContext )
                            &userData->particleData[4] );
 
 
-   glEnableVertexAttribArray ( ATTRIBUTE_LIFETIME_LOCATION );
-   glEnableVertexAttribArray ( ATTRIBUTE_ENDPOSITION_LOCATION );
-   glEnableVertexAttribArray ( ATTRIBUTE_STARTPOSITION_LOCATION );
+   esEnableVertexAttribArray ( esContext, ATTRIBUTE_LIFETIME_LOCATION );
+   esEnableVertexAttribArray ( esContext, ATTRIBUTE_ENDPOSITION_LOCATION );
+   esEnableVertexAttribArray ( esContext, ATTRIBUTE_STARTPOSITION_LOCATION );
 
    // Blend particles
-   glEnable ( GL_BLEND );
-   glBlendFunc ( GL_SRC_ALPHA, GL_ONE );
+   esEnable ( esContext, GL_BLEND );
+   esBlendFunc ( esContext, GL_SRC_ALPHA, GL_ONE );
 
    // Bind the texture
-   glActiveTexture ( GL_TEXTURE0 );
-   glBindTexture ( GL_TEXTURE_2D, userData->textureId );
+   esBindTexture ( esContext, 0, GL_TEXTURE_2D, userData->textureId );
 
-   // Set the sampler texture unit to 0
-   glUniform1i ( userData->samplerLoc, 0 );
+   // Set the sampler texture unit to 0, only uploaded in the first frame
+   esProgramUniform1i ( userData->program, userData->uniforms[UNIFORM_SAMPLER], 0 );
 
    glDrawArrays ( GL_POINTS, 0, NUM_PARTICLES );
 }
@@ -290,7 +313,7 @@ void ShutDown ( ESContext *esContext )
    glDeleteTextures ( 1, &userData->textureId );
 
    // Delete program object
-   glDeleteProgram ( userData->programObject );
+   esProgramDestroy ( esContext, userData->program );
 }
 
 
@@ -0,0 +1,7 @@
+#version 300 es
+precision mediump float;
+layout(location = 0) out vec4 fragColor;
+void main()
+{
+  fragColor = vec4(1.0);
+}
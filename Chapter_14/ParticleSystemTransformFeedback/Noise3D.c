@@ -45,10 +45,6 @@
 #define FLOOR(x)           ((int)(x) - ((x) < 0 && (x) != (int)(x)))
 #define smoothstep(t)      ( t * t * t * (t * (t * 6.0f - 15.0f) + 10.0f ) )
 #define lerp(t, a, b)      ( a + t * (b - a) )
-#ifdef _WIN32
-#define srandom srand
-#define random rand
-#endif
 
 // lattice gradients 3D noise
 static float   gradientTable[256 * 3];
@@ -74,7 +70,7 @@ static unsigned char permTable[256] =
    0x89, 0xD6, 0x91, 0x5D, 0x5C, 0x64, 0xF5, 0x00, 0xD8, 0xBA, 0x3C, 0x53, 0x69, 0x61, 0xCC, 0x34,
 };
 
-void initNoiseTable()
+void initNoiseTable ( ESContext *esContext )
 {
    int            i;
    float          a;
@@ -82,7 +78,7 @@ void initNoiseTable()
    float          gradients[256 * 3];
    unsigned int   *p, *psrc;
 
-   srandom ( 0 );
+   esSeedRandom ( esContext, 0 );
 
    // build gradient table for 3D noise
    for ( i = 0; i < 256; i++ )
@@ -90,12 +86,12 @@ void initNoiseTable()
       /*
       * calculate 1 - 2 * random number
       */
-      a = ( random() % 32768 ) / 32768.0f;
+      a = ( esRandom ( esContext ) % 32768 ) / 32768.0f;
       z = ( 1.0f - 2.0f * a );
 
       r = sqrtf ( 1.0f - z * z ); // r is radius of circle
 
-      a = ( random() % 32768 ) / 32768.0f;
+      a = ( esRandom ( esContext ) % 32768 ) / 32768.0f;
       theta = ( 2.0f * ( float ) M_PI * a );
       x = ( r * cosf ( a ) );
       y = ( r * sinf ( a ) );
@@ -183,7 +179,7 @@ float noise3D ( float *f )
    return lerp ( wz, vz0, vz1 );;
 }
 
-unsigned int Create3DNoiseTexture ( int textureSize, float frequency )
+unsigned int Create3DNoiseTexture ( ESContext *esContext, int textureSize, float frequency )
 {
    GLuint textureId;
    GLfloat *texBuf = ( GLfloat * ) malloc ( sizeof ( GLfloat ) * textureSize * textureSize * textureSize ) ;
@@ -194,7 +190,7 @@ unsigned int Create3DNoiseTexture ( int textureSize, float frequency )
    float max = -1000;
    float range;
 
-   initNoiseTable();
+   initNoiseTable ( esContext );
 
    for ( z = 0; z < textureSize; z++ )
    {
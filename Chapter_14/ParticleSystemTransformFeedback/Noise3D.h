@@ -33,4 +33,6 @@
 //
 // Generates a 3D noise
 //
-unsigned int Create3DNoiseTexture ( int textureSize, float frequency );
+#include "esUtil.h"
+
+unsigned int Create3DNoiseTexture ( ESContext *esContext, int textureSize, float frequency );
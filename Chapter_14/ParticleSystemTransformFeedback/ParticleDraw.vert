@@ -0,0 +1,22 @@
+#version 300 es
+#include "ParticleAttributes.glsl"
+
+uniform float u_time;
+uniform vec2 u_acceleration;
+
+void main()
+{
+  float deltaTime = u_time - a_curtime;
+  if ( deltaTime <= a_lifetime )
+  {
+     vec2 velocity = a_velocity + deltaTime * u_acceleration;
+     vec2 position = a_position + deltaTime * velocity;
+     gl_Position = vec4( position, 0.0, 1.0 );
+     gl_PointSize = a_size * ( 1.0 - deltaTime / a_lifetime );
+  }
+  else
+  {
+     gl_Position = vec4( -1000, -1000, 0, 0 );
+     gl_PointSize = 0.0;
+  }
+}
@@ -34,6 +34,7 @@
 //    This is an example that demonstrates a particle system
 //    using transform feedback.
 //
+#include <stdio.h>
 #include <stdlib.h>
 #include <math.h>
 #include <stddef.h>
@@ -59,9 +60,25 @@ typedef struct
    float lifetime;
 } Particle;
 
+// Both programs read every field of a particle from buffer slot 0
+static const ESVertexLayout particleLayout =
+{
+   5,
+   {
+      { ATTRIBUTE_POSITION, 2, GL_FLOAT, GL_FALSE, 0, sizeof ( Particle ), offsetof ( Particle, position ), 0 },
+      { ATTRIBUTE_VELOCITY, 2, GL_FLOAT, GL_FALSE, 0, sizeof ( Particle ), offsetof ( Particle, velocity ), 0 },
+      { ATTRIBUTE_SIZE, 1, GL_FLOAT, GL_FALSE, 0, sizeof ( Particle ), offsetof ( Particle, size ), 0 },
+      { ATTRIBUTE_CURTIME, 1, GL_FLOAT, GL_FALSE, 0, sizeof ( Particle ), offsetof ( Particle, curtime ), 0 },
+      { ATTRIBUTE_LIFETIME, 1, GL_FLOAT, GL_FALSE, 0, sizeof ( Particle ), offsetof ( Particle, lifetime ), 0 }
+   }
+};
+
 typedef struct
 {
-   // Handle to a program object
+   // Shader files the programs are built from
+   ESShaderLibrary *shaders;
+
+   // Handle to a program object, owned by the shader library
    GLuint emitProgramObject;
    GLuint drawProgramObject;
 
@@ -86,6 +103,9 @@ typedef struct
    // Particle VBOs
    GLuint particleVBOs[2];
 
+   // Vertex arrays of the particle VBOs
+   ESVertexArrayCache *vertexArrays;
+
    // Index into particleVBOs (0 or 1) as to which is the source.
    // Ping-pong between the two VBOs
    GLuint curSrcIndex;
@@ -128,75 +148,11 @@ GLuint LoadTexture ( void *ioContext, char *fileName )
    return texId;
 }
 
-void InitEmitParticles ( ESContext *esContext )
+int InitEmitParticles ( ESContext *esContext )
 {
    UserData *userData = esContext->userData;
 
-   char vShaderStr[] =
-      "#version 300 es                                                     \n"
-      "#define NUM_PARTICLES           200                                 \n"
-      "#define ATTRIBUTE_POSITION      0                                   \n"
-      "#define ATTRIBUTE_VELOCITY      1                                   \n"
-      "#define ATTRIBUTE_SIZE          2                                   \n"
-      "#define ATTRIBUTE_CURTIME       3                                   \n"
-      "#define ATTRIBUTE_LIFETIME      4                                   \n"
-      "uniform float u_time;                                               \n"
-      "uniform float u_emissionRate;                                       \n"
-      "uniform mediump sampler3D s_noiseTex;                               \n"
-      "                                                                    \n"
-      "layout(location = ATTRIBUTE_POSITION) in vec2 a_position;           \n"
-      "layout(location = ATTRIBUTE_VELOCITY) in vec2 a_velocity;           \n"
-      "layout(location = ATTRIBUTE_SIZE) in float a_size;                  \n"
-      "layout(location = ATTRIBUTE_CURTIME) in float a_curtime;            \n"
-      "layout(location = ATTRIBUTE_LIFETIME) in float a_lifetime;          \n"
-      "                                                                    \n"
-      "out vec2 v_position;                                                \n"
-      "out vec2 v_velocity;                                                \n"
-      "out float v_size;                                                   \n"
-      "out float v_curtime;                                                \n"
-      "out float v_lifetime;                                               \n"
-      "                                                                    \n"
-      "float randomValue( inout float seed )                               \n"
-      "{                                                                   \n"
-      "   float vertexId = float( gl_VertexID ) / float( NUM_PARTICLES );  \n"
-      "   vec3 texCoord = vec3( u_time, vertexId, seed );                  \n"
-      "   seed += 0.1;                                                     \n"
-      "   return texture( s_noiseTex, texCoord ).r;                        \n"
-      "}                                                                   \n"
-      "void main()                                                         \n"
-      "{                                                                   \n"
-      "  float seed = u_time;                                              \n"
-      "  float lifetime = a_curtime - u_time;                              \n"
-      "  if( lifetime <= 0.0 && randomValue(seed) < u_emissionRate )       \n"
-      "  {                                                                 \n"
-      "     v_position = vec2( 0.0, -1.0 );                                \n"
-      "     v_velocity = vec2( randomValue(seed) * 2.0 - 1.00,             \n"
-      "                        randomValue(seed) * 1.4 + 1.0 );            \n"
-      "     v_size = randomValue(seed) * 20.0 + 60.0;                      \n"
-      "     v_curtime = u_time;                                            \n"
-      "     v_lifetime = 2.0;                                              \n"
-      "  }                                                                 \n"
-      "  else                                                              \n"
-      "  {                                                                 \n"
-      "     v_position = a_position;                                       \n"
-      "     v_velocity = a_velocity;                                       \n"
-      "     v_size = a_size;                                               \n"
-      "     v_curtime = a_curtime;                                         \n"
-      "     v_lifetime = a_lifetime;                                       \n"
-      "  }                                                                 \n"
-      "  gl_Position = vec4( v_position, 0.0, 1.0 );                       \n"
-      "}                                                                   \n";
-
-   char fShaderStr[] =
-      "#version 300 es                                      \n"
-      "precision mediump float;                             \n"
-      "layout(location = 0) out vec4 fragColor;             \n"
-      "void main()                                          \n"
-      "{                                                    \n"
-      "  fragColor = vec4(1.0);                             \n"
-      "}                                                    \n";
-
-   userData->emitProgramObject = esLoadProgram ( vShaderStr, fShaderStr );
+   char defines[32];
 
    {
       const char *feedbackVaryings[5] =
@@ -208,18 +164,27 @@ void InitEmitParticles ( ESContext *esContext )
          "v_lifetime"
       };
 
-      // Set the vertex shader outputs as transform feedback varyings
-      glTransformFeedbackVaryings ( userData->emitProgramObject, 5, feedbackVaryings, GL_INTERLEAVED_ATTRIBS );
+      // The shader spreads its random values over the particle count
+      sprintf ( defines, "NUM_PARTICLES=%d", NUM_PARTICLES );
+
+      // Set the vertex shader outputs as transform feedback varyings, they are
+      // bound before the program is linked
+      userData->emitProgramObject =
+         esShaderLibraryLoadProgramWithVaryings ( userData->shaders, "ParticleEmit.vert", "ParticleEmit.frag",
+                                                  defines, 5, feedbackVaryings, GL_INTERLEAVED_ATTRIBS );
 
-      // Link program must occur after calling glTransformFeedbackVaryings
-      glLinkProgram ( userData->emitProgramObject );
+      if ( userData->emitProgramObject == 0 )
+      {
+         return FALSE;
+      }
 
-      // Get the uniform locations - this also needs to happen after glLinkProgram is called again so
-      // that the uniforms that output to varyings are active
+      // Get the uniform locations
       userData->emitTimeLoc = glGetUniformLocation ( userData->emitProgramObject, "u_time" );
       userData->emitEmissionRateLoc = glGetUniformLocation ( userData->emitProgramObject, "u_emissionRate" );
       userData->emitNoiseSamplerLoc = glGetUniformLocation ( userData->emitProgramObject, "s_noiseTex" );
    }
+
+   return TRUE;
 }
 
 ///
@@ -231,57 +196,27 @@ int Init ( ESContext *esContext )
    UserData *userData = ( UserData * ) esContext->userData;
    int i;
 
-   char vShaderStr[] =
-      "#version 300 es                                                     \n"
-      "#define ATTRIBUTE_POSITION      0                                   \n"
-      "#define ATTRIBUTE_VELOCITY      1                                   \n"
-      "#define ATTRIBUTE_SIZE          2                                   \n"
-      "#define ATTRIBUTE_CURTIME       3                                   \n"
-      "#define ATTRIBUTE_LIFETIME      4                                   \n"
-      "                                                                    \n"
-      "layout(location = ATTRIBUTE_POSITION) in vec2 a_position;           \n"
-      "layout(location = ATTRIBUTE_VELOCITY) in vec2 a_velocity;           \n"
-      "layout(location = ATTRIBUTE_SIZE) in float a_size;                  \n"
-      "layout(location = ATTRIBUTE_CURTIME) in float a_curtime;            \n"
-      "layout(location = ATTRIBUTE_LIFETIME) in float a_lifetime;          \n"
-      "                                                                    \n"
-      "uniform float u_time;                                               \n"
-      "uniform vec2 u_acceleration;                                        \n"
-      "                                                                    \n"
-      "void main()                                                         \n"
-      "{                                                                   \n"
-      "  float deltaTime = u_time - a_curtime;                             \n"
-      "  if ( deltaTime <= a_lifetime )                                    \n"
-      "  {                                                                 \n"
-      "     vec2 velocity = a_velocity + deltaTime * u_acceleration;       \n"
-      "     vec2 position = a_position + deltaTime * velocity;             \n"
-      "     gl_Position = vec4( position, 0.0, 1.0 );                      \n"
-      "     gl_PointSize = a_size * ( 1.0 - deltaTime / a_lifetime );      \n"
-      "  }                                                                 \n"
-      "  else                                                              \n"
-      "  {                                                                 \n"
-      "     gl_Position = vec4( -1000, -1000, 0, 0 );                      \n"
-      "     gl_PointSize = 0.0;                                            \n"
-      "  }                                                                 \n"
-      "}";
-
-   char fShaderStr[] =
-      "#version 300 es                                      \n"
-      "precision mediump float;                             \n"
-      "layout(location = 0) out vec4 fragColor;             \n"
-      "uniform vec4 u_color;                                \n"
-      "uniform sampler2D s_texture;                         \n"
-      "void main()                                          \n"
-      "{                                                    \n"
-      "  vec4 texColor;                                     \n"
-      "  texColor = texture( s_texture, gl_PointCoord );    \n"
-      "  fragColor = texColor * u_color;                    \n"
-      "}                                                    \n";
-
-   InitEmitParticles ( esContext );
+   // Shader files and their variants
+   userData->shaders = esShaderLibraryCreate ( esContext );
+
+   if ( userData->shaders == NULL )
+   {
+      return FALSE;
+   }
+
+   if ( !InitEmitParticles ( esContext ) )
+   {
+      return FALSE;
+   }
 
    // Load the shaders and get a linked program object
-   userData->drawProgramObject = esLoadProgram ( vShaderStr, fShaderStr );
+   userData->drawProgramObject = esShaderLibraryLoadProgram ( userData->shaders, "ParticleDraw.vert",
+                                                              "ParticleDraw.frag", NULL );
+
+   if ( userData->drawProgramObject == 0 )
+   {
+      return FALSE;
+   }
 
    // Get the uniform locations
    userData->drawTimeLoc = glGetUniformLocation ( userData->drawProgramObject, "u_time" );
@@ -302,7 +237,7 @@ int Init ( ESContext *esContext )
    }
 
    // Create a 3D noise texture for random values
-   userData->noiseTextureId = Create3DNoiseTexture ( 128, 50.0 );
+   userData->noiseTextureId = Create3DNoiseTexture ( esContext, 128, 50.0 );
 
    // Initialize particle data
    for ( i = 0; i < NUM_PARTICLES; i++ )
@@ -323,41 +258,24 @@ int Init ( ESContext *esContext )
 
    for ( i = 0; i < 2; i++ )
    {
-      glBindBuffer ( GL_ARRAY_BUFFER, userData->particleVBOs[i] );
+      esBindBuffer ( esContext, GL_ARRAY_BUFFER, userData->particleVBOs[i] );
       glBufferData ( GL_ARRAY_BUFFER, sizeof ( Particle ) * NUM_PARTICLES, particleData, GL_DYNAMIC_COPY );
    }
 
+   userData->vertexArrays = esVertexArrayCacheCreate ( );
+
    return TRUE;
 }
 
+///
+// Bind the vertex array of a particle VBO, built the first time it is used
+//
 void SetupVertexAttributes ( ESContext *esContext, GLuint vboID )
 {
-   glBindBuffer ( GL_ARRAY_BUFFER, vboID );
-   glVertexAttribPointer ( ATTRIBUTE_POSITION, 2, GL_FLOAT,
-                           GL_FALSE, sizeof ( Particle ),
-                           ( const void * ) NULL );
-
-   glVertexAttribPointer ( ATTRIBUTE_VELOCITY, 2, GL_FLOAT,
-                           GL_FALSE, sizeof ( Particle ),
-                           ( const void * ) offsetof ( Particle, velocity[0] ) );
-
-   glVertexAttribPointer ( ATTRIBUTE_SIZE, 1, GL_FLOAT,
-                           GL_FALSE, sizeof ( Particle ),
-                           ( const void * ) offsetof ( Particle, size ) );
-
-   glVertexAttribPointer ( ATTRIBUTE_CURTIME, 1, GL_FLOAT,
-                           GL_FALSE, sizeof ( Particle ),
-                           ( const void * ) offsetof ( Particle, curtime ) );
-
-   glVertexAttribPointer ( ATTRIBUTE_LIFETIME, 1, GL_FLOAT,
-                           GL_FALSE, sizeof ( Particle ),
-                           ( const void * ) offsetof ( Particle, lifetime ) );
-
-   glEnableVertexAttribArray ( ATTRIBUTE_POSITION );
-   glEnableVertexAttribArray ( ATTRIBUTE_VELOCITY );
-   glEnableVertexAttribArray ( ATTRIBUTE_SIZE );
-   glEnableVertexAttribArray ( ATTRIBUTE_CURTIME );
-   glEnableVertexAttribArray ( ATTRIBUTE_LIFETIME );
+   UserData *userData = esContext->userData;
+
+   esBindVertexArray ( esContext, esVertexArrayCacheGet ( esContext, userData->vertexArrays,
+                                                          &particleLayout, &vboID, 0 ) );
 }
 
 void EmitParticles ( ESContext *esContext, float deltaTime )
@@ -371,8 +289,7 @@ void EmitParticles ( ESContext *esContext, float deltaTime )
    SetupVertexAttributes ( esContext, srcVBO );
 
    // Set transform feedback buffer
-   glBindBuffer ( GL_TRANSFORM_FEEDBACK_BUFFER, dstVBO );
-   glBindBufferBase ( GL_TRANSFORM_FEEDBACK_BUFFER, 0, dstVBO );
+   esBindBufferBase ( esContext, GL_TRANSFORM_FEEDBACK_BUFFER, 0, dstVBO );
 
    // Turn off rasterization - we are not drawing
    glEnable ( GL_RASTERIZER_DISCARD );
@@ -397,8 +314,8 @@ void EmitParticles ( ESContext *esContext, float deltaTime )
    // Restore state
    glDisable ( GL_RASTERIZER_DISCARD );
    glUseProgram ( 0 );
-   glBindBufferBase ( GL_TRANSFORM_FEEDBACK_BUFFER, 0, 0 );
-   glBindBuffer ( GL_ARRAY_BUFFER, 0 );
+   esBindBufferBase ( esContext, GL_TRANSFORM_FEEDBACK_BUFFER, 0, 0 );
+   esBindBuffer ( esContext, GL_ARRAY_BUFFER, 0 );
    glBindTexture ( GL_TEXTURE_3D, 0 );
 
    // Ping pong the buffers
@@ -416,6 +333,8 @@ void Update ( ESContext *esContext, float deltaTime )
    userData->time += deltaTime;
 
    EmitParticles ( esContext, deltaTime );
+
+   esRequestRedraw ( esContext );
 }
 
 ///
@@ -470,10 +389,10 @@ void ShutDown ( ESContext *esContext )
    // Delete texture object
    glDeleteTextures ( 1, &userData->textureId );
 
-   // Delete program object
-   glDeleteProgram ( userData->drawProgramObject );
-   glDeleteProgram ( userData->emitProgramObject );
+   // Delete the program objects
+   esShaderLibraryDestroy ( userData->shaders );
 
+   esVertexArrayCacheDestroy ( esContext, userData->vertexArrays );
    glDeleteBuffers ( 2, &userData->particleVBOs[0] );
 }
 
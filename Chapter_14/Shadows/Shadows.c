@@ -40,20 +40,64 @@
 #define POSITION_LOC    0
 #define COLOR_LOC       1
 
+// Uniform block binding point of the transforms
+#define TRANSFORMS_BINDING 0
+
+// Layout of the std140 Transforms uniform block
+typedef struct
+{
+   ESMatrix mvpMatrix;
+   ESMatrix mvpLightMatrix;
+} Transforms;
+
+// Uniforms of the programs, the shadow map program only has the light matrix
+enum
+{
+   UNIFORM_MVP_MATRIX,
+   UNIFORM_MVP_LIGHT_MATRIX,
+   UNIFORM_SHADOW_MAP,
+   NUM_UNIFORMS
+};
+
+static const char *uniformNames[NUM_UNIFORMS] =
+{
+   "u_mvpMatrix",
+   "u_mvpLightMatrix",
+   "s_shadowMap"
+};
+
+// Both models have tightly packed positions in buffer slot 0
+static const ESVertexLayout modelLayout =
+{
+   1,
+   {
+      { POSITION_LOC, 3, GL_FLOAT, GL_FALSE, 0, 3 * sizeof ( GLfloat ), 0, 0 }
+   }
+};
+
+// Render queue passes
+enum
+{
+   PASS_SHADOW_MAP,
+   PASS_SCENE
+};
+
+// Geometry of a model in the arena and its transforms this frame
 typedef struct
 {
-   // Handle to a program object
-   GLuint sceneProgramObject;
-   GLuint shadowMapProgramObject;
+   ESArenaMesh mesh;
+   GLfloat  color[4];
+   GLintptr transforms;
+} Model;
 
-   // Uniform locations
-   GLint  sceneMvpLoc;
-   GLint  shadowMapMvpLoc;
-   GLint  sceneMvpLightLoc;
-   GLint  shadowMapMvpLightLoc;
+typedef struct
+{
+   // Program objects with their reflected uniforms
+   ESProgram *sceneProgram;
+   ESProgram *shadowMapProgram;
 
-   // Sampler location
-   GLint shadowMapSamplerLoc;
+   // Hashed uniform names
+   ESHash uniforms[NUM_UNIFORMS];
 
    // shadow map Texture handle
    GLuint shadowMapTextureId;
@@ -61,15 +105,10 @@ typedef struct
    GLuint shadowMapTextureWidth;
    GLuint shadowMapTextureHeight;
 
-   // VBOs of the model
-   GLuint groundPositionVBO;
-   GLuint groundIndicesIBO;
-   GLuint cubePositionVBO;
-   GLuint cubeIndicesIBO;
-   
-   // Number of indices
-   int    groundNumIndices;
-   int    cubeNumIndices;
+   // Models, both packed into the buffers of one arena
+   ESGeometryArena *geometry;
+   Model  ground;
+   Model  cube;
 
    // dimension of grid
    int    groundGridSize;
@@ -80,6 +119,14 @@ typedef struct
    ESMatrix  cubeMvpMatrix;
    ESMatrix  cubeMvpLightMatrix;
 
+   // Ring the transforms are streamed through
+   ESUniformRing *transformRing;
+
+   // Draws of both passes, sorted by pass and program
+   ESRenderQueue *renderQueue;
+   ESVertexArrayCache *vertexArrays;
+   GLint  defaultFramebuffer;
+
    float eyePosition[3];
    float lightPosition[3];
 } UserData;
@@ -224,6 +271,71 @@ int InitShadowMap ( ESContext *esContext )
    return TRUE;
 }
 
+///
+// FIRST PASS: Render the scene from light position to generate the shadow map texture
+//
+void BeginShadowMapPass ( ESContext *esContext, void *data )
+{
+   UserData *userData = esContext->userData;
+
+   ( void ) data;
+
+   glBindFramebuffer ( GL_FRAMEBUFFER, userData->shadowMapBufferId );
+
+   // Set the viewport
+   esViewport ( esContext, 0, 0, userData->shadowMapTextureWidth, userData->shadowMapTextureHeight );
+
+   // clear depth buffer
+   glClear( GL_DEPTH_BUFFER_BIT );
+
+   // disable color rendering, only write to depth buffer
+   esColorMask ( esContext, GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE );
+
+   // reduce shadow rendering artifact
+   esEnable ( esContext, GL_POLYGON_OFFSET_FILL );
+   glPolygonOffset( 5.0f, 100.0f );
+}
+
+///
+// SECOND PASS: Render the scene from eye location using the shadow map texture created in the first pass
+//
+void BeginScenePass ( ESContext *esContext, void *data )
+{
+   UserData *userData = esContext->userData;
+
+   ( void ) data;
+
+   esDisable ( esContext, GL_POLYGON_OFFSET_FILL );
+
+   glBindFramebuffer ( GL_FRAMEBUFFER, userData->defaultFramebuffer );
+   esColorMask ( esContext, GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE );
+
+   // Set the viewport
+   esViewport ( esContext, 0, 0, esContext->width, esContext->height );
+   
+   // Clear the color and depth buffers
+   glClear ( GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT );
+   glClearColor ( 1.0f, 1.0f, 1.0f, 0.0f );
+
+   // Set the sampler texture unit to 0, only uploaded in the first frame
+   esUseProgram ( esContext, userData->sceneProgram->programObject );
+   esProgramUniform1i ( userData->sceneProgram, userData->uniforms[UNIFORM_SHADOW_MAP], 0 );
+}
+
+///
+// Bind the transforms and color of a model, called by the render queue
+//
+void SetupModel ( ESContext *esContext, void *data )
+{
+   UserData *userData = esContext->userData;
+   Model *model = data;
+
+   // Bind the MVP matrices of the model
+   esUniformRingBind ( userData->transformRing, TRANSFORMS_BINDING, model->transforms, sizeof ( Transforms ) );
+
+   glVertexAttrib4fv ( COLOR_LOC, model->color );
+}
+
 ///
 // Initialize the shader and program object
 //
@@ -231,11 +343,22 @@ int Init ( ESContext *esContext )
 {
    GLfloat *positions;
    GLuint *indices;
+   int numIndices;
+   ESProgramBatch *batch;
+   int shadowMapProgram;
+   int sceneProgram;
+   const ESProgramVariable *shadowMapTransforms;
+   const ESProgramVariable *sceneTransforms;
+   int i;
 
    UserData *userData = esContext->userData;
    const char vShadowMapShaderStr[] =  
       "#version 300 es                                  \n"
-      "uniform mat4 u_mvpLightMatrix;                   \n"
+      "layout(std140) uniform Transforms                \n"
+      "{                                                \n"
+      "   mat4 u_mvpMatrix;                             \n"
+      "   mat4 u_mvpLightMatrix;                        \n"
+      "};                                               \n"
       "layout(location = 0) in vec4 a_position;         \n"
       "out vec4 v_color;                                \n"
       "void main()                                      \n"
@@ -252,8 +375,11 @@ int Init ( ESContext *esContext )
 
     const char vSceneShaderStr[] =  
       "#version 300 es                                   \n"
-      "uniform mat4 u_mvpMatrix;                         \n"
-      "uniform mat4 u_mvpLightMatrix;                    \n"
+      "layout(std140) uniform Transforms                 \n"
+      "{                                                 \n"
+      "   mat4 u_mvpMatrix;                              \n"
+      "   mat4 u_mvpLightMatrix;                         \n"
+      "};                                                \n"
       "layout(location = 0) in vec4 a_position;          \n"
       "layout(location = 1) in vec4 a_color;             \n"
       "out vec4 v_color;                                 \n"
@@ -299,54 +425,102 @@ int Init ( ESContext *esContext )
       "   outColor = v_color * sum;                                   \n"
       "}                                                              \n";
 
-   // Load the shaders and get a linked program object
-   userData->shadowMapProgramObject = esLoadProgram ( vShadowMapShaderStr, fShadowMapShaderStr );
-   userData->sceneProgramObject = esLoadProgram ( vSceneShaderStr, fSceneShaderStr );
+   // Compile both programs together and get the linked program objects
+   batch = esProgramBatchCreate ( );
 
-   // Get the uniform locations
-   userData->sceneMvpLoc = glGetUniformLocation ( userData->sceneProgramObject, "u_mvpMatrix" );
-   userData->shadowMapMvpLoc = glGetUniformLocation ( userData->shadowMapProgramObject, "u_mvpMatrix" );
-   userData->sceneMvpLightLoc = glGetUniformLocation ( userData->sceneProgramObject, "u_mvpLightMatrix" );
-   userData->shadowMapMvpLightLoc = glGetUniformLocation ( userData->shadowMapProgramObject, "u_mvpLightMatrix" );
+   if ( batch == NULL )
+   {
+      return FALSE;
+   }
 
-   // Get the sampler location
-   userData->shadowMapSamplerLoc = glGetUniformLocation ( userData->sceneProgramObject, "s_shadowMap" );
+   shadowMapProgram = esProgramBatchAdd ( batch, vShadowMapShaderStr, fShadowMapShaderStr );
+   sceneProgram = esProgramBatchAdd ( batch, vSceneShaderStr, fSceneShaderStr );
+   userData->shadowMapProgram = esProgramCreate ( esProgramBatchGetProgram ( batch, shadowMapProgram ) );
+   userData->sceneProgram = esProgramCreate ( esProgramBatchGetProgram ( batch, sceneProgram ) );
+   esProgramBatchDestroy ( batch );
+
+   if ( userData->shadowMapProgram == NULL || userData->sceneProgram == NULL ||
+         !esProgramCheckUniforms ( userData->shadowMapProgram, &uniformNames[UNIFORM_MVP_LIGHT_MATRIX], 1 ) ||
+         !esProgramCheckUniforms ( userData->sceneProgram, uniformNames, NUM_UNIFORMS ) )
+   {
+      return FALSE;
+   }
+
+   // Hash the uniform names once
+   for ( i = 0; i < NUM_UNIFORMS; i++ )
+   {
+      userData->uniforms[i] = esHashName ( uniformNames[i] );
+   }
+
+   // Both programs read the transforms from the same binding point
+   shadowMapTransforms = esProgramFindBlock ( userData->shadowMapProgram, esHashName ( "Transforms" ) );
+   sceneTransforms = esProgramFindBlock ( userData->sceneProgram, esHashName ( "Transforms" ) );
+
+   if ( shadowMapTransforms == NULL || sceneTransforms == NULL )
+   {
+      esLogMessage ( "Shadows: programs are missing the Transforms uniform block\n" );
+      return FALSE;
+   }
+
+   glUniformBlockBinding ( userData->shadowMapProgram->programObject, shadowMapTransforms->location,
+                           TRANSFORMS_BINDING );
+   glUniformBlockBinding ( userData->sceneProgram->programObject, sceneTransforms->location,
+                           TRANSFORMS_BINDING );
+
+   // Room for the transforms of both models at the largest allowed offset
+   // alignment of 256 bytes, three frames in flight
+   userData->transformRing = esUniformRingCreate ( esContext, 2 * ( sizeof ( Transforms ) + 256 ), 3 );
+
+   if ( userData->transformRing == NULL )
+   {
+      return FALSE;
+   }
+
+   userData->renderQueue = esRenderQueueCreate ( );
+   userData->vertexArrays = esVertexArrayCacheCreate ( );
+   esRenderQueueSetPass ( userData->renderQueue, PASS_SHADOW_MAP, BeginShadowMapPass, NULL );
+   esRenderQueueSetPass ( userData->renderQueue, PASS_SCENE, BeginScenePass, NULL );
+
+   // Positions of both models go into one vertex buffer and their indices into one index buffer
+   userData->geometry = esGeometryArenaCreate ( esContext, 3 * sizeof ( GLfloat ), 4096, 4096 );
 
    // Generate the vertex and index data for the ground
    userData->groundGridSize = 3;
-   userData->groundNumIndices = esGenSquareGrid( userData->groundGridSize, &positions, &indices );
+   numIndices = esGenSquareGrid( userData->groundGridSize, &positions, &indices );
 
-   // Index buffer object for the ground model
-   glGenBuffers ( 1, &userData->groundIndicesIBO );
-   glBindBuffer ( GL_ELEMENT_ARRAY_BUFFER, userData->groundIndicesIBO );
-   glBufferData ( GL_ELEMENT_ARRAY_BUFFER, userData->groundNumIndices * sizeof( GLuint ), indices, GL_STATIC_DRAW );
-   glBindBuffer ( GL_ELEMENT_ARRAY_BUFFER, 0 );
-   free( indices );
+   if ( !esGeometryArenaAdd ( userData->geometry, positions, userData->groundGridSize * userData->groundGridSize,
+                              indices, numIndices, &userData->ground.mesh ) )
+   {
+      return FALSE;
+   }
 
-   // Position VBO for ground model
-   glGenBuffers ( 1, &userData->groundPositionVBO );
-   glBindBuffer ( GL_ARRAY_BUFFER, userData->groundPositionVBO );
-   glBufferData ( GL_ARRAY_BUFFER, userData->groundGridSize * userData->groundGridSize * sizeof( GLfloat ) * 3, 
-                  positions, GL_STATIC_DRAW );
+   free( indices );
    free( positions );
 
+   // Light gray
+   userData->ground.color[0] = 0.9f;
+   userData->ground.color[1] = 0.9f;
+   userData->ground.color[2] = 0.9f;
+   userData->ground.color[3] = 1.0f;
+
    // Generate the vertex and index date for the cube model
-   userData->cubeNumIndices = esGenCube ( 1.0f, &positions,
-                                          NULL, NULL, &indices );
-
-   // Index buffer object for cube model
-   glGenBuffers ( 1, &userData->cubeIndicesIBO );
-   glBindBuffer ( GL_ELEMENT_ARRAY_BUFFER, userData->cubeIndicesIBO );
-   glBufferData ( GL_ELEMENT_ARRAY_BUFFER, sizeof( GLuint ) * userData->cubeNumIndices, indices, GL_STATIC_DRAW );
-   glBindBuffer ( GL_ELEMENT_ARRAY_BUFFER, 0 );
-   free( indices );
+   numIndices = esGenCube ( 1.0f, &positions,
+                            NULL, NULL, &indices );
 
-   // Position VBO for cube model
-   glGenBuffers ( 1, &userData->cubePositionVBO );
-   glBindBuffer ( GL_ARRAY_BUFFER, userData->cubePositionVBO );
-   glBufferData ( GL_ARRAY_BUFFER, 24 * sizeof( GLfloat ) * 3, positions, GL_STATIC_DRAW );
+   if ( !esGeometryArenaAdd ( userData->geometry, positions, 24, indices, numIndices, &userData->cube.mesh ) )
+   {
+      return FALSE;
+   }
+
+   free( indices );
    free( positions );
 
+   // Red
+   userData->cube.color[0] = 1.0f;
+   userData->cube.color[1] = 0.0f;
+   userData->cube.color[2] = 0.0f;
+   userData->cube.color[3] = 1.0f;
+
    // setup transformation matrices
    userData->eyePosition[0] = -5.0f;
    userData->eyePosition[1] = 3.0f;
@@ -373,106 +547,77 @@ int Init ( ESContext *esContext )
 }
 
 ///
-// Draw the model
+// Add the draws of a model to both passes
 //
-void DrawScene ( ESContext *esContext, 
-                 GLint mvpLoc, 
-                 GLint mvpLightLoc )
+void AddModel ( ESContext *esContext, Model *model )
 {
    UserData *userData = esContext->userData;
- 
-   // Draw the ground
-   // Load the vertex position
-   glBindBuffer ( GL_ARRAY_BUFFER, userData->groundPositionVBO );
-   glVertexAttribPointer ( POSITION_LOC, 3, GL_FLOAT, 
-                           GL_FALSE, 3 * sizeof(GLfloat), (const void*)NULL );
-   glEnableVertexAttribArray ( POSITION_LOC );   
-
-   // Bind the index buffer
-   glBindBuffer( GL_ELEMENT_ARRAY_BUFFER, userData->groundIndicesIBO );
-
-   // Load the MVP matrix for the ground model
-   glUniformMatrix4fv ( mvpLoc, 1, GL_FALSE, (GLfloat*) &userData->groundMvpMatrix.m[0][0] );
-   glUniformMatrix4fv ( mvpLightLoc, 1, GL_FALSE, (GLfloat*) &userData->groundMvpLightMatrix.m[0][0] );
+   ESDrawPacket *packet;
+   GLuint vertexArray;
+   int pass;
 
-   // Set the ground color to light gray
-   glVertexAttrib4f ( COLOR_LOC, 0.9f, 0.9f, 0.9f, 1.0f );
+   // Vertex positions and index buffer, the same for every model in the arena
+   vertexArray = esVertexArrayCacheGet ( esContext, userData->vertexArrays, &modelLayout,
+                                         &model->mesh.vertexBuffer, model->mesh.indexBuffer );
 
-   glDrawElements ( GL_TRIANGLES, userData->groundNumIndices, GL_UNSIGNED_INT, (const void*)NULL );
-
-   // Draw the cube
-   // Load the vertex position
-   glBindBuffer( GL_ARRAY_BUFFER, userData->cubePositionVBO );
-   glVertexAttribPointer ( POSITION_LOC, 3, GL_FLOAT, 
-                           GL_FALSE, 3 * sizeof(GLfloat), (const void*)NULL );
-   glEnableVertexAttribArray ( POSITION_LOC );   
-
-   // Bind the index buffer
-   glBindBuffer( GL_ELEMENT_ARRAY_BUFFER, userData->cubeIndicesIBO );
-
-   // Load the MVP matrix for the cube model
-   glUniformMatrix4fv ( mvpLoc, 1, GL_FALSE, (GLfloat*) &userData->cubeMvpMatrix.m[0][0] );
-   glUniformMatrix4fv ( mvpLightLoc, 1, GL_FALSE, (GLfloat*) &userData->cubeMvpLightMatrix.m[0][0] );
-
-   // Set the cube color to red
-   glVertexAttrib4f ( COLOR_LOC, 1.0f, 0.0f, 0.0f, 1.0f );
-
-   glDrawElements ( GL_TRIANGLES, userData->cubeNumIndices, GL_UNSIGNED_INT, (const void*)NULL );
+   for ( pass = PASS_SHADOW_MAP; pass <= PASS_SCENE; pass++ )
+   {
+      // Only the scene pass samples the shadow map, the first pass renders to it
+      ESProgram *program = pass == PASS_SCENE ? userData->sceneProgram : userData->shadowMapProgram;
+      GLuint texture = pass == PASS_SCENE ? userData->shadowMapTextureId : 0;
+
+      packet = esRenderQueueAdd ( userData->renderQueue,
+                                  esSortKey ( pass, program->programObject, texture, vertexArray, 0.0f ) );
+
+      if ( packet == NULL )
+      {
+         return;
+      }
+
+      packet->program = program->programObject;
+      packet->vertexArray = vertexArray;
+      packet->textureTarget = texture != 0 ? GL_TEXTURE_2D : 0;
+      packet->texture = texture;
+      packet->mode = GL_TRIANGLES;
+      packet->count = model->mesh.numIndices;
+      packet->indexType = model->mesh.indexType;
+      packet->indices = ( const void * ) model->mesh.indexOffset;
+      packet->setupFunc = SetupModel;
+      packet->data = model;
+   }
 }
 
 void Draw ( ESContext *esContext )
 {
    UserData *userData = esContext->userData;
-   GLint defaultFramebuffer = 0;
+   Transforms *transforms;
 
    // Initialize matrices
    InitMVP ( esContext );
 
-   glGetIntegerv ( GL_FRAMEBUFFER_BINDING, &defaultFramebuffer );
-
-   // FIRST PASS: Render the scene from light position to generate the shadow map texture
-   glBindFramebuffer ( GL_FRAMEBUFFER, userData->shadowMapBufferId );
-
-   // Set the viewport
-   glViewport ( 0, 0, userData->shadowMapTextureWidth, userData->shadowMapTextureHeight );
-
-   // clear depth buffer
-   glClear( GL_DEPTH_BUFFER_BIT );
-
-   // disable color rendering, only write to depth buffer
-   glColorMask ( GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE );
+   // Upload the transforms of both models at once, both passes draw with them
+   if ( !esUniformRingBeginFrame ( userData->transformRing ) )
+   {
+      return;
+   }
 
-   // reduce shadow rendering artifact
-   glEnable ( GL_POLYGON_OFFSET_FILL );
-   glPolygonOffset( 5.0f, 100.0f );
+   transforms = esUniformRingAlloc ( userData->transformRing, sizeof ( Transforms ), &userData->ground.transforms );
+   transforms->mvpMatrix = userData->groundMvpMatrix;
+   transforms->mvpLightMatrix = userData->groundMvpLightMatrix;
 
-   glUseProgram ( userData->shadowMapProgramObject );
-   DrawScene ( esContext, userData->shadowMapMvpLoc, userData->shadowMapMvpLightLoc );
+   transforms = esUniformRingAlloc ( userData->transformRing, sizeof ( Transforms ), &userData->cube.transforms );
+   transforms->mvpMatrix = userData->cubeMvpMatrix;
+   transforms->mvpLightMatrix = userData->cubeMvpLightMatrix;
 
-   glDisable( GL_POLYGON_OFFSET_FILL );
+   esUniformRingUpload ( userData->transformRing );
 
-   // SECOND PASS: Render the scene from eye location using the shadow map texture created in the first pass
-   glBindFramebuffer ( GL_FRAMEBUFFER, defaultFramebuffer );
-   glColorMask ( GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE );
+   glGetIntegerv ( GL_FRAMEBUFFER_BINDING, &userData->defaultFramebuffer );
 
-   // Set the viewport
-   glViewport ( 0, 0, esContext->width, esContext->height );
-   
-   // Clear the color and depth buffers
-   glClear ( GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT );
-   glClearColor ( 1.0f, 1.0f, 1.0f, 0.0f );
-
-   // Use the scene program object
-   glUseProgram ( userData->sceneProgramObject );
-
-   // Bind the shadow map texture
-   glActiveTexture ( GL_TEXTURE0 );
-   glBindTexture ( GL_TEXTURE_2D, userData->shadowMapTextureId );
+   // Record the models in any order, the queue submits them pass by pass
+   AddModel ( esContext, &userData->ground );
+   AddModel ( esContext, &userData->cube );
 
-   // Set the sampler texture unit to 0
-   glUniform1i ( userData->shadowMapSamplerLoc, 0 );
-
-   DrawScene ( esContext, userData->sceneMvpLoc, userData->sceneMvpLightLoc );
+   esRenderQueueSubmit ( esContext, userData->renderQueue );
 }
 
 ///
@@ -482,11 +627,7 @@ void Shutdown ( ESContext *esContext )
 {
    UserData *userData = esContext->userData;
 
-   glDeleteBuffers( 1, &userData->groundPositionVBO );
-   glDeleteBuffers( 1, &userData->groundIndicesIBO );
-
-   glDeleteBuffers( 1, &userData->cubePositionVBO );
-   glDeleteBuffers( 1, &userData->cubeIndicesIBO );
+   esGeometryArenaDestroy ( userData->geometry );
    
    // Delete shadow map
    glBindFramebuffer ( GL_FRAMEBUFFER, userData->shadowMapBufferId );
@@ -496,8 +637,11 @@ void Shutdown ( ESContext *esContext )
    glDeleteTextures ( 1, &userData->shadowMapTextureId );
 
    // Delete program object
-   glDeleteProgram ( userData->sceneProgramObject );
-   glDeleteProgram ( userData->shadowMapProgramObject );
+   esRenderQueueDestroy ( userData->renderQueue );
+   esVertexArrayCacheDestroy ( esContext, userData->vertexArrays );
+   esUniformRingDestroy ( userData->transformRing );
+   esProgramDestroy ( esContext, userData->sceneProgram );
+   esProgramDestroy ( esContext, userData->shadowMapProgram );
 }
 
 int esMain ( ESContext *esContext )
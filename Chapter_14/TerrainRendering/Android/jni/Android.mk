@@ -10,7 +10,8 @@ LOCAL_MODULE    := TerrainRendering
 LOCAL_CFLAGS    += -DANDROID
 
 
-LOCAL_SRC_FILES := $(COMMON_SRC_PATH)/esShader.c \
+LOCAL_SRC_FILES := $(COMMON_SRC_PATH)/esLoader.c \
+				   $(COMMON_SRC_PATH)/esShader.c \
 				   $(COMMON_SRC_PATH)/esShapes.c \
 				   $(COMMON_SRC_PATH)/esTransform.c \
 				   $(COMMON_SRC_PATH)/esUtil.c \
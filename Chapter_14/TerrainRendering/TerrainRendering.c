@@ -39,27 +39,52 @@
 
 #define POSITION_LOC    0
 
-typedef struct
+// Uniforms of the program
+enum
+{
+   UNIFORM_MVP_MATRIX,
+   UNIFORM_LIGHT_DIRECTION,
+   UNIFORM_SAMPLER,
+   NUM_UNIFORMS
+};
+
+static const char *uniformNames[NUM_UNIFORMS] =
 {
-   // Handle to a program object
-   GLuint programObject;
+   "u_mvpMatrix",
+   "u_lightDirection",
+   "s_texture"
+};
+
+// Grid positions are tightly packed in buffer slot 0
+static const ESVertexLayout gridLayout =
+{
+   1,
+   {
+      { POSITION_LOC, 3, GL_FLOAT, GL_FALSE, 0, 3 * sizeof ( GLfloat ), 0, 0 }
+   }
+};
 
-   // Uniform locations
-   GLint  mvpLoc;
-   GLint  lightDirectionLoc;
+typedef struct
+{
+   // Program object with its reflected uniforms
+   ESProgram *program;
 
-   // Sampler location
-   GLint samplerLoc;
+   // Hashed uniform names
+   ESHash uniforms[NUM_UNIFORMS];
 
-   // Texture handle
+   // Texture handle, 0 until the background load finishes
    GLuint textureId;
 
-   // VBOs
-   GLuint positionVBO;
-   GLuint indicesIBO;
+   // Loader streaming in the height map
+   ESAsyncLoader *loader;
+   int            heightMapRequest;
 
-   // Number of indices
-   int    numIndices;
+   // Grid positions and indices in the buffers of an arena
+   ESGeometryArena *geometry;
+   ESArenaMesh grid;
+
+   // Vertex array of the grid
+   ESVertexArrayCache *vertexArrays;
 
    // dimension of grid
    int    gridSize;
@@ -68,37 +93,6 @@ typedef struct
    ESMatrix  mvpMatrix;
 } UserData;
 
-///
-// Load texture from disk
-//
-GLuint LoadTexture (  void *ioContext, char *fileName )
-{
-   int width,
-       height;
-
-   char *buffer = esLoadTGA ( ioContext, fileName, &width, &height );
-   GLuint texId;
-
-   if ( buffer == NULL )
-   {
-      esLogMessage ( "Error loading (%s) image.\n", fileName );
-      return 0;
-   }
-
-   glGenTextures ( 1, &texId );
-   glBindTexture ( GL_TEXTURE_2D, texId );
-
-   glTexImage2D ( GL_TEXTURE_2D, 0, GL_ALPHA, width, height, 0, GL_ALPHA, GL_UNSIGNED_BYTE, buffer );
-   glTexParameteri ( GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR );
-   glTexParameteri ( GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR );
-   glTexParameteri ( GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE );
-   glTexParameteri ( GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE );
-
-   free ( buffer );
-
-   return texId;
-}
-
 ///
 // Initialize the MVP matrix
 //
@@ -139,6 +133,8 @@ int Init ( ESContext *esContext )
 {
    GLfloat *positions;
    GLuint *indices;
+   int numIndices;
+   int i;
 
    UserData *userData = esContext->userData;
    const char vShaderStr[] =
@@ -186,44 +182,50 @@ int Init ( ESContext *esContext )
       "}                                                    \n";
 
    // Load the shaders and get a linked program object
-   userData->programObject = esLoadProgram ( vShaderStr, fShaderStr );
+   userData->program = esProgramCreate ( esLoadProgram ( vShaderStr, fShaderStr ) );
 
-   // Get the uniform locations
-   userData->mvpLoc = glGetUniformLocation ( userData->programObject, "u_mvpMatrix" );
-   userData->lightDirectionLoc = glGetUniformLocation ( userData->programObject,
-                                                        "u_lightDirection" );
+   if ( userData->program == NULL ||
+         !esProgramCheckUniforms ( userData->program, uniformNames, NUM_UNIFORMS ) )
+   {
+      return FALSE;
+   }
 
-   // Get the sampler location
-   userData->samplerLoc = glGetUniformLocation ( userData->programObject, "s_texture" );
+   // Hash the uniform names once
+   for ( i = 0; i < NUM_UNIFORMS; i++ )
+   {
+      userData->uniforms[i] = esHashName ( uniformNames[i] );
+   }
 
-   // Load the heightmap
-   userData->textureId = LoadTexture ( esContext->platformData, "heightmap.tga" );
+   // Start loading the heightmap in the background, Draw() picks it up when ready
+   userData->textureId = 0;
+   userData->loader = esCreateAsyncLoader ( esContext, 1 );
 
-   if ( userData->textureId == 0 )
+   if ( userData->loader == NULL )
    {
       return FALSE;
    }
 
+   userData->heightMapRequest = esAsyncLoadTexture ( userData->loader, esContext->platformData,
+                                                     "heightmap.tga", GL_ALPHA, GL_ALPHA );
+
    // Generate the position and indices of a square grid for the base terrain
    userData->gridSize = 200;
-   userData->numIndices = esGenSquareGrid ( userData->gridSize, &positions, &indices );
-
-   // Index buffer for base terrain
-   glGenBuffers ( 1, &userData->indicesIBO );
-   glBindBuffer ( GL_ELEMENT_ARRAY_BUFFER, userData->indicesIBO );
-   glBufferData ( GL_ELEMENT_ARRAY_BUFFER, userData->numIndices * sizeof ( GLuint ),
-                  indices, GL_STATIC_DRAW );
-   glBindBuffer ( GL_ELEMENT_ARRAY_BUFFER, 0 );
-   free ( indices );
+   numIndices = esGenSquareGrid ( userData->gridSize, &positions, &indices );
+
+   // Blocks are sized to fit the grid
+   userData->geometry = esGeometryArenaCreate ( esContext, 3 * sizeof ( GLfloat ), 0, 0 );
+
+   if ( !esGeometryArenaAdd ( userData->geometry, positions, userData->gridSize * userData->gridSize,
+                              indices, numIndices, &userData->grid ) )
+   {
+      return FALSE;
+   }
 
-   // Position VBO for base terrain
-   glGenBuffers ( 1, &userData->positionVBO );
-   glBindBuffer ( GL_ARRAY_BUFFER, userData->positionVBO );
-   glBufferData ( GL_ARRAY_BUFFER,
-                  userData->gridSize * userData->gridSize * sizeof ( GLfloat ) * 3,
-                  positions, GL_STATIC_DRAW );
+   free ( indices );
    free ( positions );
 
+   userData->vertexArrays = esVertexArrayCacheCreate ( );
+
    glClearColor ( 1.0f, 1.0f, 1.0f, 0.0f );
 
    return TRUE;
@@ -244,33 +246,51 @@ void Draw ( ESContext *esContext )
    // Clear the color buffer
    glClear ( GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT );
 
-   // Use the program object
-   glUseProgram ( userData->programObject );
+   // Nothing to draw until the height map has streamed in
+   if ( userData->textureId == 0 )
+   {
+      int status = esAsyncGetTexture ( userData->loader, userData->heightMapRequest, &userData->textureId );
+
+      if ( status == ES_ASYNC_FAILED )
+      {
+         // The loader already logged why, there is nothing to draw without it
+         esLogMessage ( "No height map, exiting.\n" );
+         esRequestExit ( esContext );
+      }
+
+      if ( status != ES_ASYNC_READY )
+      {
+         return;
+      }
+   }
 
-   // Load the vertex position
-   glBindBuffer ( GL_ARRAY_BUFFER, userData->positionVBO );
-   glVertexAttribPointer ( POSITION_LOC, 3, GL_FLOAT,
-                           GL_FALSE, 3 * sizeof ( GLfloat ), ( const void * ) NULL );
-   glEnableVertexAttribArray ( POSITION_LOC );
+   // Use the program object
+   glUseProgram ( userData->program->programObject );
 
-   // Bind the index buffer
-   glBindBuffer ( GL_ELEMENT_ARRAY_BUFFER, userData->indicesIBO );
+   // Bind the vertex positions and the index buffer
+   esBindVertexArray ( esContext, esVertexArrayCacheGet ( esContext, userData->vertexArrays, &gridLayout,
+                                                          &userData->grid.vertexBuffer, userData->grid.indexBuffer ) );
 
    // Bind the height map
    glActiveTexture ( GL_TEXTURE0 );
    glBindTexture ( GL_TEXTURE_2D, userData->textureId );
 
    // Load the MVP matrix
-   glUniformMatrix4fv ( userData->mvpLoc, 1, GL_FALSE, ( GLfloat * ) &userData->mvpMatrix.m[0][0] );
+   esProgramUniformMatrix4fv ( userData->program, userData->uniforms[UNIFORM_MVP_MATRIX],
+                               1, ( GLfloat * ) &userData->mvpMatrix.m[0][0] );
 
-   // Load the light direction
-   glUniform3f ( userData->lightDirectionLoc, 0.86f, 0.14f, 0.49f );
+   // Load the light direction, the program keeps it after the first frame
+   {
+      GLfloat lightDirection[3] = { 0.86f, 0.14f, 0.49f };
+
+      esProgramUniform3fv ( userData->program, userData->uniforms[UNIFORM_LIGHT_DIRECTION], 1, lightDirection );
+   }
 
    // Set the height map sampler to texture unit to 0
-   glUniform1i ( userData->samplerLoc, 0 );
+   esProgramUniform1i ( userData->program, userData->uniforms[UNIFORM_SAMPLER], 0 );
 
    // Draw the grid
-   glDrawElements ( GL_TRIANGLES, userData->numIndices, GL_UNSIGNED_INT, ( const void * ) NULL );
+   glDrawElements ( GL_TRIANGLES, userData->grid.numIndices, userData->grid.indexType, ( const void * ) userData->grid.indexOffset );
 }
 
 ///
@@ -280,11 +300,14 @@ void Shutdown ( ESContext *esContext )
 {
    UserData *userData = esContext->userData;
 
-   glDeleteBuffers ( 1, &userData->positionVBO );
-   glDeleteBuffers ( 1, &userData->indicesIBO );
+   esDestroyAsyncLoader ( userData->loader );
+   glDeleteTextures ( 1, &userData->textureId );
+
+   esVertexArrayCacheDestroy ( esContext, userData->vertexArrays );
+   esGeometryArenaDestroy ( userData->geometry );
 
    // Delete program object
-   glDeleteProgram ( userData->programObject );
+   esProgramDestroy ( esContext, userData->program );
 }
 
 
@@ -35,39 +35,67 @@
 //    geometry instancing
 //
 #include <stdlib.h>
+#include <string.h>
 #include <math.h>
 #include "esUtil.h"
 
-#ifdef _WIN32
-#define srandom srand
-#define random rand
-#endif
-
 
 #define NUM_INSTANCES   100
 #define POSITION_LOC    0
 #define COLOR_LOC       1
 #define MVP_LOC         2
 
+// Buffer slots of the vertex layout
+#define POSITION_SLOT   0
+#define COLOR_SLOT      1
+#define MVP_SLOT        2
+
+// Positions per vertex, then a color and an MVP matrix (one row per location) per instance
+static const ESVertexLayout cubeLayout =
+{
+   6,
+   {
+      { POSITION_LOC, 3, GL_FLOAT, GL_FALSE, POSITION_SLOT, 3 * sizeof ( GLfloat ), 0, 0 },
+      { COLOR_LOC, 4, GL_UNSIGNED_BYTE, GL_TRUE, COLOR_SLOT, 4 * sizeof ( GLubyte ), 0, 1 },
+      { MVP_LOC + 0, 4, GL_FLOAT, GL_FALSE, MVP_SLOT, sizeof ( ESMatrix ), sizeof ( GLfloat ) * 0, 1 },
+      { MVP_LOC + 1, 4, GL_FLOAT, GL_FALSE, MVP_SLOT, sizeof ( ESMatrix ), sizeof ( GLfloat ) * 4, 1 },
+      { MVP_LOC + 2, 4, GL_FLOAT, GL_FALSE, MVP_SLOT, sizeof ( ESMatrix ), sizeof ( GLfloat ) * 8, 1 },
+      { MVP_LOC + 3, 4, GL_FLOAT, GL_FALSE, MVP_SLOT, sizeof ( ESMatrix ), sizeof ( GLfloat ) * 12, 1 }
+   }
+};
+
 typedef struct
 {
    // Handle to a program object
    GLuint programObject;
 
+   // Cube positions and indices in the buffers of an arena
+   ESGeometryArena *geometry;
+   ESArenaMesh cube;
+
    // VBOs
-   GLuint positionVBO;
    GLuint colorVBO;
-   GLuint mvpVBO;
-   GLuint indicesIBO;
 
-   // Number of indices
-   int       numIndices;
+   // Per-instance MVPs, written each frame
+   ESStreamBuffer *mvpStream;
+
+   // Vertex array of the cubes
+   ESVertexArrayCache *vertexArrays;
 
-   // Rotation angle
+   // Rotation angle, only touched by Update()
    GLfloat   angle[NUM_INSTANCES];
 
 } UserData;
 
+///
+// Per-frame state computed by Update() and consumed by Draw()
+//
+typedef struct
+{
+   ESMatrix  mvp[NUM_INSTANCES];
+
+} FrameState;
+
 ///
 // Initialize the shader and program object
 //
@@ -75,6 +103,7 @@ int Init ( ESContext *esContext )
 {
    GLfloat *positions;
    GLuint *indices;
+   int numIndices;
 
    UserData *userData = esContext->userData;
    const char vShaderStr[] =
@@ -103,20 +132,18 @@ int Init ( ESContext *esContext )
    userData->programObject = esLoadProgram ( vShaderStr, fShaderStr );
 
    // Generate the vertex data
-   userData->numIndices = esGenCube ( 0.1f, &positions,
-                                      NULL, NULL, &indices );
-
-   // Index buffer object
-   glGenBuffers ( 1, &userData->indicesIBO );
-   glBindBuffer ( GL_ELEMENT_ARRAY_BUFFER, userData->indicesIBO );
-   glBufferData ( GL_ELEMENT_ARRAY_BUFFER, sizeof ( GLuint ) * userData->numIndices, indices, GL_STATIC_DRAW );
-   glBindBuffer ( GL_ELEMENT_ARRAY_BUFFER, 0 );
-   free ( indices );
+   numIndices = esGenCube ( 0.1f, &positions,
+                            NULL, NULL, &indices );
+
+   // Cube model，24个顶点, positions and indices packed into an arena
+   userData->geometry = esGeometryArenaCreate ( esContext, 3 * sizeof ( GLfloat ), 0, 0 );
+
+   if ( !esGeometryArenaAdd ( userData->geometry, positions, 24, indices, numIndices, &userData->cube ) )
+   {
+      return GL_FALSE;
+   }
 
-   // Position VBO for cube model，24个顶点
-   glGenBuffers ( 1, &userData->positionVBO );
-   glBindBuffer ( GL_ARRAY_BUFFER, userData->positionVBO );
-   glBufferData ( GL_ARRAY_BUFFER, 24 * sizeof ( GLfloat ) * 3, positions, GL_STATIC_DRAW );
+   free ( indices );
    free ( positions );
 
    // Random color for each instance
@@ -124,18 +151,18 @@ int Init ( ESContext *esContext )
       GLubyte colors[NUM_INSTANCES][4];
       int instance;
 
-      srandom ( 0 );
+      esSeedRandom ( esContext, 0 );
 
       for ( instance = 0; instance < NUM_INSTANCES; instance++ )
       {
-         colors[instance][0] = random() % 255;
-         colors[instance][1] = random() % 255;
-         colors[instance][2] = random() % 255;
+         colors[instance][0] = esRandom ( esContext ) % 255;
+         colors[instance][1] = esRandom ( esContext ) % 255;
+         colors[instance][2] = esRandom ( esContext ) % 255;
          colors[instance][3] = 0;
       }
 
       glGenBuffers ( 1, &userData->colorVBO );
-      glBindBuffer ( GL_ARRAY_BUFFER, userData->colorVBO );
+      esBindBuffer ( esContext, GL_ARRAY_BUFFER, userData->colorVBO );
       glBufferData ( GL_ARRAY_BUFFER, NUM_INSTANCES * 4, colors, GL_STATIC_DRAW );
    }
 
@@ -146,14 +173,23 @@ int Init ( ESContext *esContext )
       // Random angle for each instance, compute the MVP later
       for ( instance = 0; instance < NUM_INSTANCES; instance++ )
       {
-         userData->angle[instance] = ( float ) ( random() % 32768 ) / 32767.0f * 360.0f;
+         userData->angle[instance] = ( float ) ( esRandom ( esContext ) % 32768 ) / 32767.0f * 360.0f;
       }
 
-      glGenBuffers ( 1, &userData->mvpVBO );
-      glBindBuffer ( GL_ARRAY_BUFFER, userData->mvpVBO );
-      glBufferData ( GL_ARRAY_BUFFER, NUM_INSTANCES * sizeof ( ESMatrix ), NULL, GL_DYNAMIC_DRAW );
+      // One region per frame in flight, so writing the MVPs never waits for the
+      // draw of an earlier frame
+      userData->mvpStream = esStreamBufferCreate ( esContext, GL_COPY_WRITE_BUFFER, NUM_INSTANCES * sizeof ( ESMatrix ),
+                                                   3, sizeof ( GLfloat ) * 4, ES_STREAM_ORPHAN );
+   }
+   esBindBuffer ( esContext, GL_ARRAY_BUFFER, 0 );
+
+   userData->vertexArrays = esVertexArrayCacheCreate ( );
+
+   // Update() only does math, let it run alongside Draw()
+   if ( !esEnablePipeline ( esContext, sizeof ( FrameState ) ) )
+   {
+      return GL_FALSE;
    }
-   glBindBuffer ( GL_ARRAY_BUFFER, 0 );
 
    glClearColor ( 1.0f, 1.0f, 1.0f, 0.0f );
    return GL_TRUE;
@@ -161,12 +197,12 @@ int Init ( ESContext *esContext )
 
 
 ///
-// Update MVP matrix based on time
+// Update MVP matrix based on time.  Runs on the update thread, so no GL calls.
 //
 void Update ( ESContext *esContext, float deltaTime )
 {
    UserData *userData = ( UserData * ) esContext->userData;
-   ESMatrix *matrixBuf;
+   FrameState *frame = ( FrameState * ) esGetUpdateSnapshot ( esContext );
    ESMatrix perspective;
    float    aspect;
    int      instance = 0;
@@ -181,9 +217,6 @@ void Update ( ESContext *esContext, float deltaTime )
    esMatrixLoadIdentity ( &perspective );
    esPerspective ( &perspective, 60.0f, aspect, 1.0f, 20.0f );
 
-   glBindBuffer ( GL_ARRAY_BUFFER, userData->mvpVBO );
-   matrixBuf = ( ESMatrix * ) glMapBufferRange ( GL_ARRAY_BUFFER, 0, sizeof ( ESMatrix ) * NUM_INSTANCES, GL_MAP_WRITE_BIT );
-
    // Compute a per-instance MVP that translates and rotates each instance differnetly
    numRows = ( int ) sqrtf ( NUM_INSTANCES );
    numColumns = numRows;
@@ -213,10 +246,10 @@ void Update ( ESContext *esContext, float deltaTime )
 
       // Compute the final MVP by multiplying the
       // modevleiw and perspective matrices together
-      esMatrixMultiply ( &matrixBuf[instance], &modelview, &perspective );
+      esMatrixMultiply ( &frame->mvp[instance], &modelview, &perspective );
    }
 
-   glUnmapBuffer ( GL_ARRAY_BUFFER );
+   esRequestRedraw ( esContext );
 }
 
 ///
@@ -225,6 +258,9 @@ void Update ( ESContext *esContext, float deltaTime )
 void Draw ( ESContext *esContext )
 {
    UserData *userData = esContext->userData;
+   const FrameState *frame = ( const FrameState * ) esGetDrawSnapshot ( esContext );
+   ESMatrix *matrixBuf;
+   GLintptr mvpOffset;
 
    // Set the viewport
    glViewport ( 0, 0, esContext->width, esContext->height );
@@ -235,45 +271,52 @@ void Draw ( ESContext *esContext )
    // Use the program object
    glUseProgram ( userData->programObject );
 
-   // Load the vertex position
-   glBindBuffer ( GL_ARRAY_BUFFER, userData->positionVBO );
-   glVertexAttribPointer ( POSITION_LOC, 3, GL_FLOAT,
-                           GL_FALSE, 3 * sizeof ( GLfloat ), ( const void * ) NULL );
-   glEnableVertexAttribArray ( POSITION_LOC );
-
-   // Load the instance color buffer
-   glBindBuffer ( GL_ARRAY_BUFFER, userData->colorVBO );
-   glVertexAttribPointer ( COLOR_LOC, 4, GL_UNSIGNED_BYTE,
-                           GL_TRUE, 4 * sizeof ( GLubyte ), ( const void * ) NULL );
-   glEnableVertexAttribArray ( COLOR_LOC );
-    // 每个图元实例读取一次颜色数据
-   glVertexAttribDivisor ( COLOR_LOC, 1 );
-
-
-   // Load the instance MVP buffer
-   glBindBuffer ( GL_ARRAY_BUFFER, userData->mvpVBO );
-
-   // Load each matrix row of the MVP.  Each row gets an increasing attribute location.
-   glVertexAttribPointer ( MVP_LOC + 0, 4, GL_FLOAT, GL_FALSE, sizeof ( ESMatrix ), ( const void * ) NULL );
-   glVertexAttribPointer ( MVP_LOC + 1, 4, GL_FLOAT, GL_FALSE, sizeof ( ESMatrix ), ( const void * ) ( sizeof ( GLfloat ) * 4 ) );
-   glVertexAttribPointer ( MVP_LOC + 2, 4, GL_FLOAT, GL_FALSE, sizeof ( ESMatrix ), ( const void * ) ( sizeof ( GLfloat ) * 8 ) );
-   glVertexAttribPointer ( MVP_LOC + 3, 4, GL_FLOAT, GL_FALSE, sizeof ( ESMatrix ), ( const void * ) ( sizeof ( GLfloat ) * 12 ) );
-   glEnableVertexAttribArray ( MVP_LOC + 0 );
-   glEnableVertexAttribArray ( MVP_LOC + 1 );
-   glEnableVertexAttribArray ( MVP_LOC + 2 );
-   glEnableVertexAttribArray ( MVP_LOC + 3 );
-
-   // One MVP per instance
-   glVertexAttribDivisor ( MVP_LOC + 0, 1 );
-   glVertexAttribDivisor ( MVP_LOC + 1, 1 );
-   glVertexAttribDivisor ( MVP_LOC + 2, 1 );
-   glVertexAttribDivisor ( MVP_LOC + 3, 1 );
-
-   // Bind the index buffer
-   glBindBuffer ( GL_ELEMENT_ARRAY_BUFFER, userData->indicesIBO );
+   // Load the instance MVPs into this frame's region of the stream buffer
+   if ( !esStreamBufferBeginFrame ( userData->mvpStream ) )
+   {
+      return;
+   }
+
+   matrixBuf = ( ESMatrix * ) esStreamBufferAlloc ( userData->mvpStream, sizeof ( ESMatrix ) * NUM_INSTANCES, &mvpOffset );
+
+   if ( matrixBuf != NULL )
+   {
+      memcpy ( matrixBuf, frame->mvp, sizeof ( ESMatrix ) * NUM_INSTANCES );
+   }
+
+   esStreamBufferUpload ( userData->mvpStream );
+
+   if ( matrixBuf == NULL )
+   {
+      return;
+   }
+
+   // Bind the positions, the per-instance colors and MVPs and the index buffer.
+   // The MVPs move between the regions, which gives a vertex array per region.
+   {
+      ESVertexLayout layout = cubeLayout;
+      GLuint buffers[3];
+      int i;
+
+      for ( i = 0; i < layout.numAttribs; i++ )
+      {
+         if ( layout.attribs[i].buffer == MVP_SLOT )
+         {
+            layout.attribs[i].offset += ( GLuint ) mvpOffset;
+         }
+      }
+
+      buffers[POSITION_SLOT] = userData->cube.vertexBuffer;
+      buffers[COLOR_SLOT] = userData->colorVBO;
+      buffers[MVP_SLOT] = esStreamBufferGetBuffer ( userData->mvpStream );
+
+      esBindVertexArray ( esContext, esVertexArrayCacheGet ( esContext, userData->vertexArrays, &layout,
+                                                             buffers, userData->cube.indexBuffer ) );
+   }
 
    // mode指定要渲染的图元，count指定绘制的索引数量，type指定保存在indices中的元素索引类型，indices指定元素索引存储位置的一个指针，instanceCount指定绘制的图元实例数量
-   glDrawElementsInstanced ( GL_TRIANGLES, userData->numIndices, GL_UNSIGNED_INT, ( const void * ) NULL, NUM_INSTANCES );
+   glDrawElementsInstanced ( GL_TRIANGLES, userData->cube.numIndices, userData->cube.indexType,
+                             ( const void * ) userData->cube.indexOffset, NUM_INSTANCES );
 }
 
 ///
@@ -283,10 +326,10 @@ void Shutdown ( ESContext *esContext )
 {
    UserData *userData = esContext->userData;
 
-   glDeleteBuffers ( 1, &userData->positionVBO );
+   esVertexArrayCacheDestroy ( esContext, userData->vertexArrays );
+   esGeometryArenaDestroy ( userData->geometry );
    glDeleteBuffers ( 1, &userData->colorVBO );
-   glDeleteBuffers ( 1, &userData->mvpVBO );
-   glDeleteBuffers ( 1, &userData->indicesIBO );
+   esStreamBufferDestroy ( userData->mvpStream );
 
    // Delete program object
    glDeleteProgram ( userData->programObject );
@@ -35,6 +35,7 @@
 //    using a vertex shader to transform the object
 //
 #include <stdlib.h>
+#include <string.h>
 #include "esUtil.h"
 
 typedef struct
@@ -45,18 +46,58 @@ typedef struct
    // Uniform locations
    GLint  mvpLoc;
 
-   // Vertex data
-   GLfloat  *vertices;
-   GLuint   *indices;
-   int       numIndices;
+   // Cube positions, uploaded once
+   ESMesh    cube;
 
    // Rotation angle
    GLfloat   angle;
 
    // MVP matrix
    ESMatrix  mvpMatrix;
+
+   // Window rectangle the cube covered in the previous frame
+   GLint     lastRect[4];
 } UserData;
 
+///
+// Window rectangle covered by the unit cube after the MVP transform
+//
+static void CubeWindowRect ( ESContext *esContext, const ESMatrix *mvp, GLint rect[4] )
+{
+   float minX = 1.0f, minY = 1.0f;
+   float maxX = -1.0f, maxY = -1.0f;
+   int   i;
+
+   for ( i = 0; i < 8; i++ )
+   {
+      float x = ( i & 1 ) ? 0.5f : -0.5f;
+      float y = ( i & 2 ) ? 0.5f : -0.5f;
+      float z = ( i & 4 ) ? 0.5f : -0.5f;
+      float clipX = x * mvp->m[0][0] + y * mvp->m[1][0] + z * mvp->m[2][0] + mvp->m[3][0];
+      float clipY = x * mvp->m[0][1] + y * mvp->m[1][1] + z * mvp->m[2][1] + mvp->m[3][1];
+      float clipW = x * mvp->m[0][3] + y * mvp->m[1][3] + z * mvp->m[2][3] + mvp->m[3][3];
+
+      // A corner behind the eye, give up and cover the window
+      if ( clipW <= 0.0f )
+      {
+         minX = minY = -1.0f;
+         maxX = maxY = 1.0f;
+         break;
+      }
+
+      minX = clipX / clipW < minX ? clipX / clipW : minX;
+      minY = clipY / clipW < minY ? clipY / clipW : minY;
+      maxX = clipX / clipW > maxX ? clipX / clipW : maxX;
+      maxY = clipY / clipW > maxY ? clipY / clipW : maxY;
+   }
+
+   // Pad by a pixel for rasterization rounding
+   rect[0] = ( GLint ) ( ( minX + 1.0f ) * 0.5f * esContext->width ) - 1;
+   rect[1] = ( GLint ) ( ( minY + 1.0f ) * 0.5f * esContext->height ) - 1;
+   rect[2] = ( GLint ) ( ( maxX + 1.0f ) * 0.5f * esContext->width ) + 2 - rect[0];
+   rect[3] = ( GLint ) ( ( maxY + 1.0f ) * 0.5f * esContext->height ) + 2 - rect[1];
+}
+
 ///
 // Initialize the shader and program object
 //
@@ -92,12 +133,20 @@ int Init ( ESContext *esContext )
    userData->mvpLoc = glGetUniformLocation ( userData->programObject, "u_mvpMatrix" );
 
    // 生成顶点数据
-   userData->numIndices = esGenCube ( 1.0, &userData->vertices,
-                                      NULL, NULL, &userData->indices );
+   if ( !esGenCubeToMesh ( esContext, 1.0, 0, -1, -1, &userData->cube ) )
+   {
+      return FALSE;
+   }
 
    // Starting rotation angle for the cube
    userData->angle = 45.0f;
 
+   // Nothing has been drawn yet, the first frame covers the window
+   userData->lastRect[0] = 0;
+   userData->lastRect[1] = 0;
+   userData->lastRect[2] = esContext->width;
+   userData->lastRect[3] = esContext->height;
+
    glClearColor ( 1.0f, 1.0f, 1.0f, 0.0f );
    return GL_TRUE;
 }
@@ -140,6 +189,9 @@ void Update ( ESContext *esContext, float deltaTime )
    // Compute the final MVP by multiplying the
    // modevleiw and perspective matrices together
    esMatrixMultiply ( &userData->mvpMatrix, &modelview, &perspective );
+
+   // The cube keeps rotating
+   esRequestRedraw ( esContext );
 }
 
 ///
@@ -148,22 +200,30 @@ void Update ( ESContext *esContext, float deltaTime )
 void Draw ( ESContext *esContext )
 {
    UserData *userData = esContext->userData;
+   GLint cubeRect[4];
+   GLint repaintRect[4];
+
+   // Only the area the cube moved out of and into changes
+   CubeWindowRect ( esContext, &userData->mvpMatrix, cubeRect );
+   esAddDamageRect ( esContext, userData->lastRect[0], userData->lastRect[1],
+                     userData->lastRect[2], userData->lastRect[3] );
+   esAddDamageRect ( esContext, cubeRect[0], cubeRect[1], cubeRect[2], cubeRect[3] );
+   memcpy ( userData->lastRect, cubeRect, sizeof ( cubeRect ) );
 
    // Set the viewport
    glViewport ( 0, 0, esContext->width, esContext->height );
 
+   // Redraw only what the back buffer is missing
+   esGetRepaintRect ( esContext, repaintRect );
+   glScissor ( repaintRect[0], repaintRect[1], repaintRect[2], repaintRect[3] );
+   glEnable ( GL_SCISSOR_TEST );
+
    // Clear the color buffer
    glClear ( GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT );
 
    // Use the program object
    glUseProgram ( userData->programObject );
 
-   // Load the vertex position
-   glVertexAttribPointer ( 0, 3, GL_FLOAT,
-                           GL_FALSE, 3 * sizeof ( GLfloat ), userData->vertices );
-
-   glEnableVertexAttribArray ( 0 );
-
    // Set the vertex color to red
    glVertexAttrib4f ( 1, 1.0f, 0.0f, 0.0f, 1.0f );
 
@@ -171,7 +231,9 @@ void Draw ( ESContext *esContext )
    glUniformMatrix4fv ( userData->mvpLoc, 1, GL_FALSE, ( GLfloat * ) &userData->mvpMatrix.m[0][0] );
 
    // Draw the cube
-   glDrawElements ( GL_TRIANGLES, userData->numIndices, GL_UNSIGNED_INT, userData->indices );
+   esMeshDraw ( esContext, &userData->cube );
+
+   glDisable ( GL_SCISSOR_TEST );
 }
 
 ///
@@ -181,15 +243,7 @@ void Shutdown ( ESContext *esContext )
 {
    UserData *userData = esContext->userData;
 
-   if ( userData->vertices != NULL )
-   {
-      free ( userData->vertices );
-   }
-
-   if ( userData->indices != NULL )
-   {
-      free ( userData->indices );
-   }
+   esMeshDestroy ( esContext, &userData->cube );
 
    // Delete program object
    glDeleteProgram ( userData->programObject );
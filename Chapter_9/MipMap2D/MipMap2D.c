@@ -51,6 +51,15 @@ typedef struct
    // Texture handle
    GLuint textureId;
 
+   // Sampler objects for nearest and trilinear filtering
+   GLuint samplers[2];
+
+   // Offset of each quad
+   GLfloat offsets[2];
+
+   // Draws of both quads
+   ESRenderQueue *renderQueue;
+
 } UserData;
 
 
@@ -280,10 +289,33 @@ int Init ( ESContext *esContext )
    // Load the texture
    userData->textureId = CreateMipMappedTexture2D ();
 
+   // The filter changes between the quads are sampler objects, so
+   // the draws only differ in the state they bind
+   glGenSamplers ( 2, userData->samplers );
+   glSamplerParameteri ( userData->samplers[0], GL_TEXTURE_MIN_FILTER, GL_NEAREST );
+   glSamplerParameteri ( userData->samplers[0], GL_TEXTURE_MAG_FILTER, GL_LINEAR );
+   glSamplerParameteri ( userData->samplers[1], GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR );
+   glSamplerParameteri ( userData->samplers[1], GL_TEXTURE_MAG_FILTER, GL_LINEAR );
+
+   userData->offsets[0] = -0.6f;
+   userData->offsets[1] = 0.6f;
+
+   userData->renderQueue = esRenderQueueCreate ( );
+
    glClearColor ( 1.0f, 1.0f, 1.0f, 0.0f );
    return TRUE;
 }
 
+///
+// Set the offset of a quad, called by the render queue
+//
+void SetupQuad ( ESContext *esContext, void *data )
+{
+   UserData *userData = esContext->userData;
+
+   glUniform1f ( userData->offsetLoc, *( GLfloat * ) data );
+}
+
 ///
 // Draw a triangle using the shader pair created in Init()
 //
@@ -300,15 +332,16 @@ void Draw ( ESContext *esContext )
                             1.0f,  0.0f               // TexCoord 3
                          };
    GLushort indices[] = { 0, 1, 2, 0, 2, 3 };
+   int i;
 
    // Set the viewport
-   glViewport ( 0, 0, esContext->width, esContext->height );
+   esViewport ( esContext, 0, 0, esContext->width, esContext->height );
 
    // Clear the color buffer
    glClear ( GL_COLOR_BUFFER_BIT );
 
    // Use the program object
-   glUseProgram ( userData->programObject );
+   esUseProgram ( esContext, userData->programObject );
 
    // Load the vertex position
    glVertexAttribPointer ( 0, 4, GL_FLOAT,
@@ -317,25 +350,36 @@ void Draw ( ESContext *esContext )
    glVertexAttribPointer ( 1, 2, GL_FLOAT,
                            GL_FALSE, 6 * sizeof ( GLfloat ), &vVertices[4] );
 
-   glEnableVertexAttribArray ( 0 );
-   glEnableVertexAttribArray ( 1 );
-
-   // Bind the texture
-   glActiveTexture ( GL_TEXTURE0 );
-   glBindTexture ( GL_TEXTURE_2D, userData->textureId );
+   esEnableVertexAttribArray ( esContext, 0 );
+   esEnableVertexAttribArray ( esContext, 1 );
 
    // Set the sampler texture unit to 0
    glUniform1i ( userData->samplerLoc, 0 );
 
-   // Draw quad with nearest sampling
-   glTexParameteri ( GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST );
-   glUniform1f ( userData->offsetLoc, -0.6f );
-   glDrawElements ( GL_TRIANGLES, 6, GL_UNSIGNED_SHORT, indices );
+   // Draw quad with nearest sampling, then with trilinear filtering
+   for ( i = 0; i < 2; i++ )
+   {
+      ESDrawPacket *packet = esRenderQueueAdd ( userData->renderQueue,
+                                                esSortKey ( 0, userData->programObject, userData->textureId, 0, 0.0f ) );
+
+      if ( packet == NULL )
+      {
+         break;
+      }
 
-   // Draw quad with trilinear filtering
-   glTexParameteri ( GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR );
-   glUniform1f ( userData->offsetLoc, 0.6f );
-   glDrawElements ( GL_TRIANGLES, 6, GL_UNSIGNED_SHORT, indices );
+      packet->program = userData->programObject;
+      packet->textureTarget = GL_TEXTURE_2D;
+      packet->texture = userData->textureId;
+      packet->sampler = userData->samplers[i];
+      packet->mode = GL_TRIANGLES;
+      packet->count = 6;
+      packet->indexType = GL_UNSIGNED_SHORT;
+      packet->indices = indices;
+      packet->setupFunc = SetupQuad;
+      packet->data = &userData->offsets[i];
+   }
+
+   esRenderQueueSubmit ( esContext, userData->renderQueue );
 }
 
 ///
@@ -345,8 +389,11 @@ void ShutDown ( ESContext *esContext )
 {
    UserData *userData = esContext->userData;
 
-   // Delete texture object
+   // Delete texture and sampler objects
    glDeleteTextures ( 1, &userData->textureId );
+   glDeleteSamplers ( 2, userData->samplers );
+
+   esRenderQueueDestroy ( userData->renderQueue );
 
    // Delete program object
    glDeleteProgram ( userData->programObject );
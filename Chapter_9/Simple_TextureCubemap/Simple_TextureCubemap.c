@@ -47,11 +47,8 @@ typedef struct
    // Texture handle
    GLuint textureId;
 
-   // Vertex data
-   int      numIndices;
-   GLfloat *vertices;
-   GLfloat *normals;
-   GLuint  *indices;
+   // Sphere with positions and normals, uploaded once
+   ESMesh   sphere;
 
 } UserData;
 
@@ -155,8 +152,10 @@ int Init ( ESContext *esContext )
    userData->textureId = CreateSimpleTextureCubemap ();
 
    // Generate the vertex data
-   userData->numIndices = esGenSphere ( 20, 0.75f, &userData->vertices, &userData->normals,
-                                        NULL, &userData->indices );
+   if ( !esGenSphereToMesh ( esContext, 20, 0.75f, 0, 1, -1, &userData->sphere ) )
+   {
+      return FALSE;
+   }
 
 
    glClearColor ( 1.0f, 1.0f, 1.0f, 0.0f );
@@ -183,16 +182,6 @@ void Draw ( ESContext *esContext )
    // Use the program object
    glUseProgram ( userData->programObject );
 
-   // Load the vertex position
-   glVertexAttribPointer ( 0, 3, GL_FLOAT,
-                           GL_FALSE, 0, userData->vertices );
-   // Load the normal
-   glVertexAttribPointer ( 1, 3, GL_FLOAT,
-                           GL_FALSE, 0, userData->normals );
-
-   glEnableVertexAttribArray ( 0 );
-   glEnableVertexAttribArray ( 1 );
-
    // Bind the texture
    glActiveTexture ( GL_TEXTURE0 );
    glBindTexture ( GL_TEXTURE_CUBE_MAP, userData->textureId );
@@ -200,8 +189,7 @@ void Draw ( ESContext *esContext )
    // Set the sampler texture unit to 0
    glUniform1i ( userData->samplerLoc, 0 );
 
-   glDrawElements ( GL_TRIANGLES, userData->numIndices,
-                    GL_UNSIGNED_INT, userData->indices );
+   esMeshDraw ( esContext, &userData->sphere );
 }
 
 ///
@@ -217,8 +205,7 @@ void ShutDown ( ESContext *esContext )
    // Delete program object
    glDeleteProgram ( userData->programObject );
 
-   free ( userData->vertices );
-   free ( userData->normals );
+   esMeshDestroy ( esContext, &userData->sphere );
 }
 
 
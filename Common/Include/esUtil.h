@@ -78,6 +78,40 @@ extern "C" {
 #define ES_WINDOW_STENCIL       4
 /// esCreateWindow flat - multi-sample buffer
 #define ES_WINDOW_MULTISAMPLE   8
+/// esCreateWindow flag - render to an offscreen pbuffer instead of a window
+#define ES_WINDOW_OFFSCREEN     16
+
+/// esLog level - verbose diagnostics, discarded unless enabled with esSetLogLevel
+#define ES_LOG_DEBUG            0
+/// esLog level - informational messages, the level of esLogMessage
+#define ES_LOG_INFO             1
+/// esLog level - something went wrong but the program carries on
+#define ES_LOG_WARNING          2
+/// esLog level - an operation failed
+#define ES_LOG_ERROR            3
+
+/// Largest value returned by esRandom
+#define ES_RANDOM_MAX           0x7fffffff
+
+/// esAsyncGetTexture status - still loading
+#define ES_ASYNC_PENDING        0
+/// esAsyncGetTexture status - texture is ready to use
+#define ES_ASYNC_READY          1
+/// esAsyncGetTexture status - the file could not be loaded
+#define ES_ASYNC_FAILED         2
+
+/// esSetIndexPolicy - GLushort indices whenever the vertices of a mesh allow it
+#define ES_INDEX_AUTO           0
+/// esSetIndexPolicy - always GLuint indices
+#define ES_INDEX_32BIT          1
+
+/// esStreamBufferCreate - orphan the buffer when the GPU still uses the next region
+#define ES_STREAM_ORPHAN        0
+/// esStreamBufferCreate - wait for the GPU to finish with the next region
+#define ES_STREAM_WAIT          1
+
+/// Vertices a GLushort index can address
+#define ES_MAX_SHORT_VERTICES   65536
 
 
 ///
@@ -95,13 +129,258 @@ typedef struct
    GLfloat   m[4][4];
 } ESMatrix;
 
+///
+//  Run options.  The platform main() fills these in from the command line
+//  before esMain() is called.
+//
+typedef struct
+{
+   /// Flags OR'd into the flags passed to esCreateWindow (e.g. ES_WINDOW_OFFSCREEN)
+   GLuint   windowFlags;
+
+   /// Number of frames to render before the main loop exits, 0 to run until interrupted.
+   /// Counted after the warm-up frames.
+   int      numFrames;
+
+   /// Number of frames rendered before numFrames starts counting
+   int      numWarmupFrames;
+
+   /// Measure the frames after warm-up and report frame-time statistics as JSON
+   GLboolean benchmark;
+
+   /// File the benchmark report is written to, NULL for stdout
+   const char *benchmarkFile;
+
+   /// Program name used in reports
+   const char *name;
+
+   /// Fixed delta time in seconds passed to the update callback, 0 to use the wall clock
+   float    fixedDeltaTime;
+
+   /// Trace file of per-frame delta times to replay instead of the wall clock
+   const char *replayFile;
+
+   /// Trace file the per-frame delta times are recorded to
+   const char *recordFile;
+
+   /// Added to every seed passed to esSeedRandom
+   unsigned int randomSeed;
+
+   /// Run the update callback on the GL thread even if the application enabled the pipeline
+   GLboolean noPipeline;
+
+   /// Number of contexts main() runs the application on concurrently, one thread each
+   int      numContexts;
+
+   /// Index of this context among the contexts started by esRunContexts
+   int      contextIndex;
+
+   /// Only draw a frame after esRequestRedraw or a window expose, and block in
+   /// between instead of drawing continuously.  Ignored for offscreen windows.
+   GLboolean onDemand;
+
+   /// Longest time in seconds the on-demand loop blocks before calling the update
+   /// callback again, 0 to block until the next window event
+   float    idleTimeout;
+
+   /// Most frames the driver may queue ahead of the GPU before the loop waits,
+   /// 0 for no limit.  Lower values cut input latency at the cost of throughput.
+   int      maxFramesInFlight;
+
+   /// Pass swapInterval to eglSwapInterval after the context is created
+   GLboolean overrideSwapInterval;
+
+   /// Swap interval used when overrideSwapInterval is set, 0 disables vsync
+   int      swapInterval;
+
+   /// File every drawn frame is captured to (.ppm, .y4m or raw RGBA)
+   const char *captureFile;
+
+   /// Directory linked program binaries are cached in, NULL to always compile
+   const char *programCacheDir;
+} ESOptions;
+
 typedef struct ESContext ESContext;
 
+typedef struct ESAsyncLoader ESAsyncLoader;
+
+typedef struct ESProgramBatch ESProgramBatch;
+
+typedef struct ESUniformRing ESUniformRing;
+
+typedef struct ESShaderLibrary ESShaderLibrary;
+
+/// Hash of a variable name, see esHashName
+typedef unsigned int ESHash;
+
+typedef struct
+{
+   /// Name without the "[0]" of arrays
+   char     *name;
+   ESHash   hash;
+
+   /// Uniform or attribute location, -1 for uniforms in a block; block index for blocks
+   GLint    location;
+
+   /// GL type of uniforms and attributes, 0 for blocks
+   GLenum   type;
+
+   /// Array size of uniforms and attributes, data size in bytes for blocks
+   GLint    size;
+
+   /// Block a uniform belongs to, -1 for the default block
+   GLint    blockIndex;
+
+   /// Byte offset of a uniform within its block, -1 for the default block
+   GLint    offset;
+} ESProgramVariable;
+
+typedef struct
+{
+   /// Handle to the program object, deleted with the ESProgram
+   GLuint   programObject;
+
+   /// Active variables
+   int      numUniforms;
+   ESProgramVariable *uniforms;
+   int      numAttributes;
+   ESProgramVariable *attributes;
+   int      numBlocks;
+   ESProgramVariable *blocks;
+
+   /// Uniform setter calls that reached GL and calls skipped as redundant
+   unsigned int uniformsIssued;
+   unsigned int uniformsSkipped;
+
+   /// Hash tables and uniform values, private to esShader.c
+   struct ESProgramLookup *lookup;
+} ESProgram;
+
+typedef struct ESDamage ESDamage;
+
+typedef struct ESStateCache ESStateCache;
+
+typedef struct ESRenderQueue ESRenderQueue;
+
+/// Render queue sort key, see esSortKey
+typedef unsigned long long ESSortKey;
+
+typedef struct
+{
+   /// State bound before the draw, the texture and sampler go to unit 0 unless
+   /// textureTarget is 0
+   GLuint      program;
+   GLuint      vertexArray;
+   GLenum      textureTarget;
+   GLuint      texture;
+   GLuint      sampler;
+
+   /// glDrawElements when indexType is not 0, glDrawArrays from first otherwise,
+   /// instanced when instanceCount is not 0
+   GLenum      mode;
+   GLint       first;
+   GLsizei     count;
+   GLenum      indexType;
+   const void *indices;
+   GLsizei     instanceCount;
+
+   /// Optional, called with data after the state is bound, e.g. to set uniforms
+   void ( ESCALLBACK *setupFunc ) ( ESContext *, void * );
+   void       *data;
+} ESDrawPacket;
+
+/// Largest number of attributes and buffer slots of a vertex layout
+#define ES_MAX_VERTEX_ATTRIBS 16
+#define ES_MAX_VERTEX_BUFFERS 4
+
+typedef struct
+{
+   /// Arguments of glVertexAttribPointer, the offset is in bytes
+   GLuint      location;
+   GLint       size;
+   GLenum      type;
+   GLboolean   normalized;
+
+   /// Slot in the buffers passed to esVertexArrayCacheGet
+   GLuint      buffer;
+   GLsizei     stride;
+   GLuint      offset;
+
+   /// Argument of glVertexAttribDivisor, 0 for per-vertex data
+   GLuint      divisor;
+} ESVertexAttrib;
+
+typedef struct
+{
+   int            numAttribs;
+   ESVertexAttrib attribs[ES_MAX_VERTEX_ATTRIBS];
+} ESVertexLayout;
+
+typedef struct ESVertexArrayCache ESVertexArrayCache;
+
+typedef struct ESStreamBuffer ESStreamBuffer;
+
+typedef struct ESGeometryArena ESGeometryArena;
+
+typedef struct
+{
+   /// Vertex array recording the interleaved attributes from firstVertex on and
+   /// the index buffer, so the indices of the sub-mesh start at 0
+   GLuint      vertexArray;
+   GLint       firstVertex;
+
+   /// Byte offset of the first index in the index buffer, the number of indices
+   GLintptr    indexOffset;
+   GLsizei     numIndices;
+} ESSubMesh;
+
+typedef struct
+{
+   GLuint      vertexBuffer;
+   GLuint      indexBuffer;
+
+   /// Arguments of glDrawElements shared by every sub-mesh
+   GLenum      mode;
+   GLenum      indexType;
+
+   /// Meshes with more vertices than indexType can address are split into
+   /// sub-meshes, otherwise there is exactly one
+   int         numSubMeshes;
+   ESSubMesh  *subMeshes;
+
+   GLsizei     numIndices;
+   GLsizei     numVertices;
+   GLsizei     vertexStride;
+
+   /// Axis aligned bounding box of the positions
+   GLfloat     boundsMin[3];
+   GLfloat     boundsMax[3];
+} ESMesh;
+
+typedef struct
+{
+   /// Buffers of the arena block the mesh is in
+   GLuint      vertexBuffer;
+   GLuint      indexBuffer;
+
+   /// Vertices of the mesh in the vertex buffer, the indices already include firstVertex
+   GLint       firstVertex;
+   GLsizei     numVertices;
+
+   /// Byte offset of the first index, the indices argument of glDrawElements
+   GLintptr    indexOffset;
+   GLsizei     numIndices;
+   GLenum      indexType;
+} ESArenaMesh;
+
 struct ESContext
 {
    /// Put platform specific data here
    void       *platformData;
 
+   /// Native window state owned by the platform layer
+   void       *windowData;
+
    /// Put your user data here...
    void       *userData;
 
@@ -111,6 +390,39 @@ struct ESContext
    /// Window height
    GLint       height;
 
+   /// Flags the window was created with
+   GLuint      flags;
+
+   /// Run options from the command line
+   ESOptions   options;
+
+   /// State of the random number generator, see esRandom
+   unsigned int randomState;
+
+   /// Double-buffered per-frame state handed from update to draw, see esEnablePipeline
+   void       *snapshots[2];
+
+   /// Index of the snapshot written by the update callback
+   int         updateSnapshot;
+
+   /// Index of the snapshot read by the draw callback
+   int         drawSnapshot;
+
+   /// Set by esRequestRedraw, cleared once the frame has been drawn
+   GLboolean   redraw;
+
+   /// Set by esRequestExit, the main loop ends after the current frame
+   GLboolean   exitRequested;
+
+   /// Index width of uploaded meshes, see esSetIndexPolicy
+   int         indexPolicy;
+
+   /// Dirty rectangles of the current and previous frames, see esAddDamageRect
+   ESDamage   *damage;
+
+   /// GL state set through esUseProgram and friends, created on first use
+   ESStateCache *stateCache;
+
 #ifndef __APPLE__
    /// Display handle
    EGLNativeDisplayType eglNativeDisplay;
@@ -126,6 +438,9 @@ struct ESContext
 
    /// EGL surface
    EGLSurface  eglSurface;
+
+   /// EGL config the context and surface were created with
+   EGLConfig   eglConfig;
 #endif
 
    /// Callbacks
@@ -152,9 +467,38 @@ struct ESContext
 ///         ES_WINDOW_DEPTH   - specifies that a depth buffer should be created
 ///         ES_WINDOW_STENCIL - specifies that a stencil buffer should be created
 ///         ES_WINDOW_MULTISAMPLE - specifies that a multi-sample buffer should be created
+///         ES_WINDOW_OFFSCREEN - specifies that rendering goes to a pbuffer, no native window is created
 /// \return GL_TRUE if window creation is succesful, GL_FALSE otherwise
 GLboolean ESUTIL_API esCreateWindow ( ESContext *esContext, const char *title, GLint width, GLint height, GLuint flags );
 
+//
+/// \brief Run the main loop of a context created with esCreateWindow until the
+///        window is closed or the frame count given on the command line is reached
+/// \param esContext Application context
+//
+void ESUTIL_API esMainLoop ( ESContext *esContext );
+
+//
+/// \brief Call the shutdown callback, free the user data and destroy the EGL
+///        context, surface and window of a context.  Must be called on the thread
+///        that ran the context.
+/// \param esContext Application context
+//
+void ESUTIL_API esDestroyContext ( ESContext *esContext );
+
+//
+/// \brief Run several independent contexts concurrently, each on its own thread.
+///        Every thread calls initFunc on a zeroed context that holds a copy of
+///        options, runs esMainLoop and destroys the context with esDestroyContext.
+///        Only available on the desktop platforms, where the utility library owns main().
+/// \param numContexts Number of contexts to run
+/// \param options Run options copied into every context
+/// \param initFunc Creates the window and registers the callbacks of one context
+/// \return GL_TRUE if every context initialized, GL_FALSE otherwise
+//
+int ESUTIL_API esRunContexts ( int numContexts, const ESOptions *options,
+                               int ( ESCALLBACK *initFunc ) ( ESContext *esContext, int index ) );
+
 //
 /// \brief Register a draw callback function to be used to render each frame
 /// \param esContext Application context
@@ -183,12 +527,389 @@ void ESUTIL_API esRegisterUpdateFunc ( ESContext *esContext, void ( ESCALLBACK *
 //
 void ESUTIL_API esRegisterKeyFunc ( ESContext *esContext,
                                     void ( ESCALLBACK *drawFunc ) ( ESContext *, unsigned char, int, int ) );
+//
+/// \brief Enable the pipelined main loop.  The update callback of frame N+1 runs on a
+///        worker thread while the draw callback of frame N runs on the GL thread.  The
+///        update callback must not call GL or touch data the draw callback reads; it writes
+///        everything the draw needs into esGetUpdateSnapshot and the draw callback reads it
+///        back through esGetDrawSnapshot.  Platforms without a pipelined loop run both
+///        callbacks serially on one snapshot.
+/// \param esContext Application context
+/// \param snapshotSize Size in bytes of the per-frame state
+/// \return GL_TRUE if the snapshots could be allocated, GL_FALSE otherwise
+//
+GLboolean ESUTIL_API esEnablePipeline ( ESContext *esContext, size_t snapshotSize );
+
+//
+/// \brief Return the snapshot the update callback writes this frame
+/// \param esContext Application context
+//
+void *ESUTIL_API esGetUpdateSnapshot ( ESContext *esContext );
+
+//
+/// \brief Return the snapshot the draw callback reads this frame
+/// \param esContext Application context
+//
+const void *ESUTIL_API esGetDrawSnapshot ( ESContext *esContext );
+
+//
+/// \brief Mark the context as changed so the next loop iteration draws a frame.  Only
+///        needed in render-on-demand mode (-ondemand), where the update and key callbacks
+///        call it whenever the scene changes; otherwise every iteration draws.
+/// \param esContext Application context
+//
+void ESUTIL_API esRequestRedraw ( ESContext *esContext );
+
+//
+/// \brief Stop the main loop after the current frame, for applications that cannot
+///        continue, for example because a resource failed to load.  The shutdown
+///        callback still runs.
+/// \param esContext Application context
+//
+void ESUTIL_API esRequestExit ( ESContext *esContext );
+
+//
+/// \brief Report a rectangle of the window that changes this frame.  The swap then only
+///        presents the reported rectangles (EGL_KHR_swap_buffers_with_damage).  A frame
+///        without reported damage is presented whole.
+/// \param esContext Application context
+/// \param x, y Lower left corner in window coordinates, as for glScissor
+/// \param width, height Size of the rectangle
+//
+void ESUTIL_API esAddDamageRect ( ESContext *esContext, GLint x, GLint y, GLint width, GLint height );
+
+//
+/// \brief Return the age of the back buffer (EGL_EXT_buffer_age): 1 if it holds the
+///        previous frame, N if it holds the frame N swaps ago, 0 if its contents are undefined
+/// \param esContext Application context
+//
+int ESUTIL_API esGetBufferAge ( ESContext *esContext );
+
+//
+/// \brief Return the rectangle that has to be redrawn this frame: the damage reported so
+///        far plus the damage of the frames the back buffer has missed.  This is the whole
+///        window when the buffer age is unknown or no damage was reported.  Call it after
+///        esAddDamageRect and limit drawing to it with glScissor.
+/// \param esContext Application context
+/// \param rect Receives x, y, width and height
+//
+void ESUTIL_API esGetRepaintRect ( ESContext *esContext, GLint rect[4] );
+
+//
+/// \brief State cache: these replace the GL calls of the same name and skip the call
+///        when the context already has the value.  esBindTexture also selects the
+///        texture unit.  Vertex attribute arrays and the element array buffer are only
+///        tracked for vertex array 0.  Call esInvalidateState after changing any of this
+///        state with plain GL calls.
+/// \param esContext Application context
+//
+void ESUTIL_API esUseProgram ( ESContext *esContext, GLuint program );
+void ESUTIL_API esBindVertexArray ( ESContext *esContext, GLuint vertexArray );
+void ESUTIL_API esBindBuffer ( ESContext *esContext, GLenum target, GLuint buffer );
+void ESUTIL_API esBindTexture ( ESContext *esContext, GLuint unit, GLenum target, GLuint texture );
+void ESUTIL_API esEnable ( ESContext *esContext, GLenum capability );
+void ESUTIL_API esDisable ( ESContext *esContext, GLenum capability );
+void ESUTIL_API esEnableVertexAttribArray ( ESContext *esContext, GLuint index );
+void ESUTIL_API esDisableVertexAttribArray ( ESContext *esContext, GLuint index );
+void ESUTIL_API esBlendFunc ( ESContext *esContext, GLenum sfactor, GLenum dfactor );
+void ESUTIL_API esColorMask ( ESContext *esContext, GLboolean red, GLboolean green, GLboolean blue, GLboolean alpha );
+void ESUTIL_API esDepthMask ( ESContext *esContext, GLboolean flag );
+void ESUTIL_API esViewport ( ESContext *esContext, GLint x, GLint y, GLsizei width, GLsizei height );
+
+//
+/// \brief Forget all cached state, the next call of each kind goes to GL
+/// \param esContext Application context
+//
+void ESUTIL_API esInvalidateState ( ESContext *esContext );
+
+//
+/// \brief Return how many calls the state cache passed to GL and how many it skipped
+///        during the previous frame
+/// \param esContext Application context
+/// \param issued Receives the calls made
+/// \param elided Receives the calls skipped
+//
+void ESUTIL_API esGetStateCounts ( ESContext *esContext, unsigned int *issued, unsigned int *elided );
+
+//
+/// \brief Bind a sampler object to a texture unit through the state cache
+/// \param esContext Application context
+/// \param unit Texture unit, 0 for GL_TEXTURE0
+/// \param sampler Sampler object, 0 for the parameters of the texture
+//
+void ESUTIL_API esBindSampler ( ESContext *esContext, GLuint unit, GLuint sampler );
+
+//
+/// \brief glBindBufferRange and glBindBufferBase through the state cache.  The indexed
+///        binding always goes to GL; the generic binding of target, which these calls
+///        also change, is recorded so a later esBindBuffer is not skipped wrongly.
+/// \param esContext Application context
+//
+void ESUTIL_API esBindBufferRange ( ESContext *esContext, GLenum target, GLuint index, GLuint buffer,
+                                    GLintptr offset, GLsizeiptr size );
+void ESUTIL_API esBindBufferBase ( ESContext *esContext, GLenum target, GLuint index, GLuint buffer );
+
+//
+/// \brief glDeleteBuffers through the state cache.  GL unbinds deleted buffers, the
+///        cache forgets them too so a recycled name is bound again.
+/// \param esContext Application context
+/// \param n Number of buffers
+/// \param buffers Buffer names, 0 is ignored
+//
+void ESUTIL_API esDeleteBuffers ( ESContext *esContext, GLsizei n, const GLuint *buffers );
+
+//
+/// \brief glDeleteVertexArrays, glDeleteTextures and glDeleteProgram through the
+///        state cache, which forgets the deleted names like esDeleteBuffers does.
+/// \param esContext Application context
+//
+void ESUTIL_API esDeleteVertexArrays ( ESContext *esContext, GLsizei n, const GLuint *vertexArrays );
+void ESUTIL_API esDeleteTextures ( ESContext *esContext, GLsizei n, const GLuint *textures );
+void ESUTIL_API esDeleteProgram ( ESContext *esContext, GLuint program );
+
+//
+/// \brief Build a render queue sort key.  Draws are submitted by pass, then grouped
+///        by program, texture and vertex array, then by depth.  Only the low 12 bits
+///        of each object name are used.
+/// \param pass Pass 0 to 15, see esRenderQueueSetPass
+/// \param program Program object
+/// \param texture Texture object on unit 0
+/// \param vertexArray Vertex array object
+/// \param depth 0 to 1, use 1 - depth to draw back to front
+//
+ESSortKey ESUTIL_API esSortKey ( unsigned int pass, GLuint program, GLuint texture, GLuint vertexArray, float depth );
+
+//
+/// \brief Create a render queue.  Draws are recorded with esRenderQueueAdd and
+///        issued sorted by esRenderQueueSubmit, so the state cache can skip the
+///        binds draws share.
+/// \return The queue, NULL if out of memory
+//
+ESRenderQueue *ESUTIL_API esRenderQueueCreate ( void );
+
+//
+/// \brief Set the function called when submission reaches a pass, e.g. to bind a
+///        framebuffer and clear it.  It runs even if the pass has no draws.
+/// \param queue Render queue
+/// \param pass Pass 0 to 15
+/// \param beginFunc Function called with data, NULL for none
+//
+void ESUTIL_API esRenderQueueSetPass ( ESRenderQueue *queue, unsigned int pass,
+                                       void ( ESCALLBACK *beginFunc ) ( ESContext *, void * ), void *data );
+
+//
+/// \brief Record a draw.  Packets with equal keys are submitted in the order added.
+/// \param queue Render queue
+/// \param key Sort key from esSortKey
+/// \return A zeroed packet to fill in before esRenderQueueSubmit, NULL if out of memory
+//
+ESDrawPacket *ESUTIL_API esRenderQueueAdd ( ESRenderQueue *queue, ESSortKey key );
+
+//
+/// \brief Sort the recorded draws, issue them through the state cache and empty
+///        the queue.  Any data the packets point to must stay valid until then.
+/// \param esContext Application context
+/// \param queue Render queue
+//
+void ESUTIL_API esRenderQueueSubmit ( ESContext *esContext, ESRenderQueue *queue );
+
+//
+/// \brief Destroy a render queue
+/// \param queue Render queue, may be NULL
+//
+void ESUTIL_API esRenderQueueDestroy ( ESRenderQueue *queue );
+
+//
+/// \brief Create a cache of vertex array objects, one per vertex layout and
+///        combination of buffers it is used with
+/// \return The cache, NULL if out of memory
+//
+ESVertexArrayCache *ESUTIL_API esVertexArrayCacheCreate ( void );
+
+//
+/// \brief Get the vertex array of a layout and its buffers, building it the first
+///        time.  A new vertex array is left bound through the state cache.
+/// \param esContext Application context
+/// \param cache Vertex array cache
+/// \param layout Vertex attributes, compared by value
+/// \param buffers Buffer of each slot the layout uses
+/// \param indexBuffer Element array buffer, 0 for none
+/// \return The vertex array, 0 on error
+//
+GLuint ESUTIL_API esVertexArrayCacheGet ( ESContext *esContext, ESVertexArrayCache *cache,
+                                          const ESVertexLayout *layout, const GLuint *buffers, GLuint indexBuffer );
+
+//
+/// \brief Delete the vertex arrays that use a buffer, call before deleting the buffer
+/// \param esContext Application context
+/// \param cache Vertex array cache
+/// \param buffer Vertex or index buffer
+//
+void ESUTIL_API esVertexArrayCacheEvict ( ESContext *esContext, ESVertexArrayCache *cache, GLuint buffer );
+
+//
+/// \brief Delete the vertex arrays and free the cache
+/// \param esContext Application context
+/// \param cache Vertex array cache, may be NULL
+//
+void ESUTIL_API esVertexArrayCacheDestroy ( ESContext *esContext, ESVertexArrayCache *cache );
+
+//
+/// \brief Create a buffer for data written every frame, such as vertices, instance
+///        attributes or constants.  The buffer is split into one region per frame in
+///        flight and a region is only reused once a fence shows the GPU is done with it.
+/// \param esContext Application context, binds go through its state cache
+/// \param target Target the buffer is bound to for mapping; GL_COPY_WRITE_BUFFER
+///        leaves the vertex array and index bindings alone
+/// \param frameSize Most bytes written in a frame
+/// \param numFrames Frames in flight, at most 8
+/// \param alignment Alignment of the allocations in bytes
+/// \param policy ES_STREAM_ORPHAN gives the buffer new storage when the next region is
+///        still in use, ES_STREAM_WAIT waits for it
+/// \return The buffer, NULL if out of memory
+//
+ESStreamBuffer *ESUTIL_API esStreamBufferCreate ( ESContext *esContext, GLenum target, GLsizeiptr frameSize,
+                                                  int numFrames, GLint alignment, int policy );
+
+//
+/// \brief Start writing the region of a new frame, uploading the previous one
+/// \param stream Stream buffer
+/// \return GL_FALSE if the region could not be mapped
+//
+GLboolean ESUTIL_API esStreamBufferBeginFrame ( ESStreamBuffer *stream );
+
+//
+/// \brief Allocate data in the region of the current frame
+/// \param stream Stream buffer
+/// \param size Bytes to allocate
+/// \param offset Returns the buffer offset of the data, for attribute pointers or draws
+/// \return Memory to write the data to until esStreamBufferUpload, NULL if the
+///         region is full or not mapped
+//
+void *ESUTIL_API esStreamBufferAlloc ( ESStreamBuffer *stream, GLsizeiptr size, GLintptr *offset );
+
+//
+/// \brief Make the data written this frame visible to GL, call before drawing with it
+/// \param stream Stream buffer
+//
+void ESUTIL_API esStreamBufferUpload ( ESStreamBuffer *stream );
+
+//
+/// \brief Return the buffer object, to bind as a vertex, index or other buffer
+/// \param stream Stream buffer
+//
+GLuint ESUTIL_API esStreamBufferGetBuffer ( ESStreamBuffer *stream );
+
+//
+/// \brief Return how many frames orphaned the buffer because the GPU still used
+///        their region, a hint to add frames in flight.  Always 0 for ES_STREAM_WAIT.
+/// \param stream Stream buffer
+//
+unsigned int ESUTIL_API esStreamBufferGetOrphans ( ESStreamBuffer *stream );
+
+//
+/// \brief Delete the buffer and its fences
+/// \param stream Stream buffer, may be NULL
+//
+void ESUTIL_API esStreamBufferDestroy ( ESStreamBuffer *stream );
+
+//
+/// \brief Create an arena that packs the vertices and indices of static meshes into
+///        a few large buffers.  Meshes that share a block share its buffers, so they
+///        draw with one vertex array and differ only in the index offset.
+/// \param esContext Application context, binds go through its state cache
+/// \param vertexStride Size of a vertex in bytes, the same for every mesh
+/// \param vertexBlockSize Smallest vertex buffer of a block in bytes
+/// \param indexBlockSize Smallest index buffer of a block in bytes
+/// \return The arena, NULL if out of memory
+//
+ESGeometryArena *ESUTIL_API esGeometryArenaCreate ( ESContext *esContext, GLsizei vertexStride,
+                                                    GLsizeiptr vertexBlockSize, GLsizeiptr indexBlockSize );
+
+//
+/// \brief Copy a mesh into the arena, starting a new block if the current one is full.
+///        Indices are stored as GLushort when the index policy and the block allow it.
+/// \param arena Geometry arena
+/// \param vertices Vertex data, numVertices times the stride of the arena
+/// \param numVertices Number of vertices
+/// \param indices Indices of the mesh, NULL to draw it with glDrawArrays from firstVertex
+/// \param numIndices Number of indices
+/// \param mesh Returns where the mesh is
+/// \return GL_FALSE if out of memory
+//
+GLboolean ESUTIL_API esGeometryArenaAdd ( ESGeometryArena *arena, const void *vertices, int numVertices,
+                                          const GLuint *indices, int numIndices, ESArenaMesh *mesh );
+
+//
+/// \brief Delete the buffers of the arena
+/// \param arena Geometry arena, may be NULL
+//
+void ESUTIL_API esGeometryArenaDestroy ( ESGeometryArena *arena );
+
+//
+/// \brief Choose the index width of meshes a context uploads with esGen*ToMesh and
+///        esGeometryArenaAdd
+/// \param esContext Application context
+/// \param policy ES_INDEX_AUTO (the default) stores GLushort indices and splits meshes
+///        with more than ES_MAX_SHORT_VERTICES vertices into sub-meshes, ES_INDEX_32BIT
+///        keeps GLuint indices
+//
+void ESUTIL_API esSetIndexPolicy ( ESContext *esContext, int policy );
+
+//
+/// \brief Return the index policy set with esSetIndexPolicy
+/// \param esContext Application context
+//
+int ESUTIL_API esGetIndexPolicy ( ESContext *esContext );
+
+//
+/// \brief Seed the random number generator of a context.  The seed given on the
+///        command line with -seed is added, so runs are reproducible per seed.
+/// \param esContext Application context
+/// \param seed Seed value
+//
+void ESUTIL_API esSeedRandom ( ESContext *esContext, unsigned int seed );
+
+//
+/// \brief Return the next pseudo-random number of a context, replaces rand()
+/// \param esContext Application context
+/// \return A value between 0 and ES_RANDOM_MAX
+//
+unsigned int ESUTIL_API esRandom ( ESContext *esContext );
+
 //
 /// \brief Log a message to the debug output for the platform
 /// \param formatStr Format string for error log.
 //
 void ESUTIL_API esLogMessage ( const char *formatStr, ... );
 
+//
+/// \brief Log a message with a level.  The message is formatted on the calling thread
+///        into a lock-free ring and written by a background thread, so logging never
+///        waits on the terminal.  Messages longer than 1023 bytes are cut off, and
+///        messages logged while the ring is full are dropped and counted.
+/// \param level ES_LOG_DEBUG, ES_LOG_INFO, ES_LOG_WARNING or ES_LOG_ERROR
+/// \param formatStr Format string for the message
+//
+void ESUTIL_API esLog ( int level, const char *formatStr, ... );
+
+//
+/// \brief Set the lowest level that is logged, ES_LOG_INFO by default
+/// \param level One of the ES_LOG_* levels
+//
+void ESUTIL_API esSetLogLevel ( int level );
+
+//
+/// \brief Return the number of messages dropped because the log ring was full
+//
+unsigned int ESUTIL_API esLogDroppedCount ( void );
+
+//
+/// \brief Wait until every message logged so far has been written.  Pending messages
+///        are also written at exit.
+//
+void ESUTIL_API esLogFlush ( void );
+
 //
 ///
 /// \brief Load a shader, check for compile errors, print error messages to output log
@@ -208,6 +929,255 @@ GLuint ESUTIL_API esLoadShader ( GLenum type, const char *shaderSrc );
 //
 GLuint ESUTIL_API esLoadProgram ( const char *vertShaderSrc, const char *fragShaderSrc );
 
+//
+///
+/// \brief Like esLoadProgram, but capture vertex shader outputs with transform feedback.
+///        The varyings are set before the program is linked, so no relink is needed.
+/// \param vertShaderSrc Vertex shader source code
+/// \param fragShaderSrc Fragment shader source code
+/// \param numVaryings Number of transform feedback varyings, 0 for none
+/// \param varyings Names of the transform feedback varyings
+/// \param bufferMode GL_INTERLEAVED_ATTRIBS or GL_SEPARATE_ATTRIBS
+/// \return A new program object linked with the vertex/fragment shader pair, 0 on failure
+//
+GLuint ESUTIL_API esLoadProgramWithVaryings ( const char *vertShaderSrc, const char *fragShaderSrc,
+                                              GLsizei numVaryings, const char *const *varyings,
+                                              GLenum bufferMode );
+
+//
+/// \brief Cache linked programs in a directory.  esLoadProgram then stores the
+///        glGetProgramBinary output keyed by a hash of the sources, transform feedback
+///        varyings and GL_RENDERER/GL_VERSION, and reloads it with glProgramBinary.
+///        Binaries the driver rejects are silently recompiled.
+/// \param dirName Existing directory, NULL to disable the cache (the default)
+//
+void ESUTIL_API esSetProgramCacheDir ( const char *dirName );
+
+//
+/// \brief Create a batch of programs that are compiled together.  Programs added to
+///        the batch are compiled and linked without checking their status, which lets
+///        drivers with threaded compilers (GL_KHR_parallel_shader_compile) overlap the
+///        work.  Errors are checked when a program is first asked for.
+/// \return The batch, NULL if out of memory
+//
+ESProgramBatch *ESUTIL_API esProgramBatchCreate ( void );
+
+//
+/// \brief Submit a vertex and fragment shader pair for compilation
+/// \param batch Batch created with esProgramBatchCreate
+/// \param vertShaderSrc Vertex shader source code, only needed until this returns
+/// \param fragShaderSrc Fragment shader source code, only needed until this returns
+/// \return Index of the program in the batch, -1 if out of memory
+//
+int ESUTIL_API esProgramBatchAdd ( ESProgramBatch *batch, const char *vertShaderSrc, const char *fragShaderSrc );
+
+//
+/// \brief Like esProgramBatchAdd, with transform feedback varyings as for
+///        esLoadProgramWithVaryings
+//
+int ESUTIL_API esProgramBatchAddWithVaryings ( ESProgramBatch *batch, const char *vertShaderSrc, const char *fragShaderSrc,
+                                               GLsizei numVaryings, const char *const *varyings, GLenum bufferMode );
+
+//
+/// \brief Check without blocking whether the driver has finished every program.
+///        Always GL_TRUE if the driver cannot report completion.
+/// \param batch Batch created with esProgramBatchCreate
+//
+GLboolean ESUTIL_API esProgramBatchIsComplete ( ESProgramBatch *batch );
+
+//
+/// \brief Wait for a program of the batch and check it for errors
+/// \param batch Batch created with esProgramBatchCreate
+/// \param index Index returned by esProgramBatchAdd
+/// \return The linked program object, 0 if it failed to compile or link
+//
+GLuint ESUTIL_API esProgramBatchGetProgram ( ESProgramBatch *batch, int index );
+
+//
+/// \brief Free a batch.  Program objects stay valid and belong to the caller.
+/// \param batch Batch created with esProgramBatchCreate
+//
+void ESUTIL_API esProgramBatchDestroy ( ESProgramBatch *batch );
+
+//
+/// \brief Hash a variable name for the esProgramFind* lookups.  Hash names once at
+///        load time so per-frame code never touches strings.
+//
+ESHash ESUTIL_API esHashName ( const char *name );
+
+//
+/// \brief Reflect all active uniforms, attributes and uniform blocks of a linked program
+/// \param programObject Linked program, owned by the ESProgram afterwards
+/// \return The reflected program, NULL if programObject is 0 or out of memory
+//
+ESProgram *ESUTIL_API esProgramCreate ( GLuint programObject );
+
+//
+/// \brief Log every name that is not an active uniform of the program, so mistyped or
+///        optimized out uniforms show up at load time
+/// \return GL_TRUE if all names are active uniforms
+//
+GLboolean ESUTIL_API esProgramCheckUniforms ( const ESProgram *program, const char *const *names, int numNames );
+
+//
+/// \brief Look up an active uniform, attribute or uniform block by name hash
+/// \return The variable, NULL if the program has none by that name
+//
+const ESProgramVariable *ESUTIL_API esProgramFindUniform ( const ESProgram *program, ESHash nameHash );
+const ESProgramVariable *ESUTIL_API esProgramFindAttribute ( const ESProgram *program, ESHash nameHash );
+const ESProgramVariable *ESUTIL_API esProgramFindBlock ( const ESProgram *program, ESHash nameHash );
+
+//
+/// \brief Location of a uniform by name hash, -1 if it is not active
+//
+GLint ESUTIL_API esProgramUniformLocation ( const ESProgram *program, ESHash nameHash );
+
+//
+/// \brief Delete the program object and free the reflection data
+/// \param esContext Application context, its state cache forgets the program
+/// \param program Program created with esProgramCreate
+//
+void ESUTIL_API esProgramDestroy ( ESContext *esContext, ESProgram *program );
+
+//
+/// \brief Set a uniform of the default block, skipping the glUniform call if the
+///        program already holds the value.  The program must be in use, and uniforms
+///        that are not active are ignored.  Matrices are never transposed.
+/// \param program Program the uniform belongs to
+/// \param nameHash Hashed uniform name
+/// \param count Number of array elements for the vector forms
+/// \param value Value or values to set
+//
+void ESUTIL_API esProgramUniform1i ( ESProgram *program, ESHash nameHash, GLint value );
+void ESUTIL_API esProgramUniform1f ( ESProgram *program, ESHash nameHash, GLfloat value );
+void ESUTIL_API esProgramUniform2fv ( ESProgram *program, ESHash nameHash, GLsizei count, const GLfloat *value );
+void ESUTIL_API esProgramUniform3fv ( ESProgram *program, ESHash nameHash, GLsizei count, const GLfloat *value );
+void ESUTIL_API esProgramUniform4fv ( ESProgram *program, ESHash nameHash, GLsizei count, const GLfloat *value );
+void ESUTIL_API esProgramUniformMatrix4fv ( ESProgram *program, ESHash nameHash, GLsizei count, const GLfloat *value );
+
+//
+/// \brief Forget the uploaded values, needed after setting uniforms of the program
+///        with glUniform* directly
+//
+void ESUTIL_API esProgramInvalidateUniforms ( ESProgram *program );
+
+//
+/// \brief Create a ring of uniform buffer memory for constants that change every frame.
+///        Each frame writes a region of one buffer; a fence keeps a region from being
+///        rewritten while earlier frames still draw from it.
+/// \param esContext Application context, binds go through its state cache
+/// \param frameSize Bytes of constants one frame can allocate
+/// \param numFrames Frames that can be in flight at once, at most 8
+/// \return The ring, NULL if out of memory
+//
+ESUniformRing *ESUTIL_API esUniformRingCreate ( ESContext *esContext, GLsizeiptr frameSize, int numFrames );
+
+//
+/// \brief Start a frame: wait for the next region to be free and map it.  Call once
+///        per frame before allocating.
+/// \return GL_FALSE if the region could not be mapped
+//
+GLboolean ESUTIL_API esUniformRingBeginFrame ( ESUniformRing *ring );
+
+//
+/// \brief Allocate constants for a draw from the current frame, aligned to
+///        GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT
+/// \param size Bytes to allocate, laid out as the std140 uniform block
+/// \param offset Returns the buffer offset to pass to esUniformRingBind
+/// \return Memory to write the constants to until esUniformRingUpload, NULL if the
+///         frame is full
+//
+void *ESUTIL_API esUniformRingAlloc ( ESUniformRing *ring, GLsizeiptr size, GLintptr *offset );
+
+//
+/// \brief Unmap the frame so its constants can be drawn with.  All allocations of a
+///        frame go up in this one upload.
+//
+void ESUTIL_API esUniformRingUpload ( ESUniformRing *ring );
+
+//
+/// \brief Bind an allocation to a uniform block binding point with glBindBufferRange
+//
+void ESUTIL_API esUniformRingBind ( ESUniformRing *ring, GLuint bindingPoint, GLintptr offset, GLsizeiptr size );
+
+//
+/// \brief Delete the buffer and fences of the ring
+//
+void ESUTIL_API esUniformRingDestroy ( ESUniformRing *ring );
+
+//
+/// \brief Create a library that builds programs from shader files.  Files may
+///        #include "file" other files relative to their own directory, and each set
+///        of defines builds and caches its own variant of a program.
+/// \param esContext Application context, files are read through its platform data
+/// \return The library, NULL if out of memory
+//
+ESShaderLibrary *ESUTIL_API esShaderLibraryCreate ( ESContext *esContext );
+
+//
+/// \brief Get the program built from a vertex and fragment shader file with a set of
+///        defines, compiling it the first time it is asked for
+/// \param library Library created with esShaderLibraryCreate
+/// \param vertFileName Vertex shader file
+/// \param fragFileName Fragment shader file
+/// \param defines "NAME=VALUE NAME ..." list, each becomes a #define after the
+///        #version line of both shaders; NULL for none
+/// \return The program object, owned by the library; 0 on failure
+//
+GLuint ESUTIL_API esShaderLibraryLoadProgram ( ESShaderLibrary *library, const char *vertFileName,
+                                               const char *fragFileName, const char *defines );
+
+//
+/// \brief Like esShaderLibraryLoadProgram, with transform feedback varyings as for
+///        esLoadProgramWithVaryings
+//
+GLuint ESUTIL_API esShaderLibraryLoadProgramWithVaryings ( ESShaderLibrary *library, const char *vertFileName,
+                                                           const char *fragFileName, const char *defines,
+                                                           GLsizei numVaryings, const char *const *varyings,
+                                                           GLenum bufferMode );
+
+//
+/// \brief Delete every program of the library and free it
+//
+void ESUTIL_API esShaderLibraryDestroy ( ESShaderLibrary *library );
+
+
+//
+/// \brief Create a background texture loader.  Files are decoded on worker threads and
+///        uploaded on a second EGL context sharing objects with esContext->eglContext.
+/// \param esContext Application context, must already have a window
+/// \param numThreads Number of decoding threads
+/// \return The loader, destroy it with esDestroyAsyncLoader.  NULL if out of memory.
+//
+ESAsyncLoader *ESUTIL_API esCreateAsyncLoader ( ESContext *esContext, int numThreads );
+
+//
+/// \brief Queue a TGA file to be loaded into a GL_TEXTURE_2D.  The texture uses LINEAR
+///        filtering and CLAMP_TO_EDGE wrapping, change them once it is ready if needed.
+/// \param loader Loader created by esCreateAsyncLoader
+/// \param ioContext Context related to IO facility on the platform
+/// \param fileName Name of the file on disk
+/// \param internalFormat, format Image format as passed to glTexImage2D
+/// \return Request handle for esAsyncGetTexture, -1 if out of memory
+//
+int ESUTIL_API esAsyncLoadTexture ( ESAsyncLoader *loader, void *ioContext, const char *fileName,
+                                    GLenum internalFormat, GLenum format );
+
+//
+/// \brief Poll a request without blocking.  Call from the thread the application
+///        context is current on.
+/// \param loader Loader created by esCreateAsyncLoader
+/// \param request Handle returned by esAsyncLoadTexture
+/// \param texture Set to the texture once it is ready, 0 otherwise
+/// \return ES_ASYNC_PENDING, ES_ASYNC_READY or ES_ASYNC_FAILED
+//
+int ESUTIL_API esAsyncGetTexture ( ESAsyncLoader *loader, int request, GLuint *texture );
+
+//
+/// \brief Stop the loader threads.  Textures already returned by esAsyncGetTexture stay alive.
+/// \param loader Loader created by esCreateAsyncLoader
+//
+void ESUTIL_API esDestroyAsyncLoader ( ESAsyncLoader *loader );
 
 //
 /// \brief Generates geometry for a sphere.  Allocates memory for the vertex data and stores
@@ -248,6 +1218,48 @@ int ESUTIL_API esGenCube ( float scale, GLfloat **vertices, GLfloat **normals,
 //
 int ESUTIL_API esGenSquareGrid ( int size, GLfloat **vertices, GLuint **indices );
 
+//
+/// \brief Generates a sphere like esGenSphere and uploads it once into a mesh with
+///        interleaved vertices (position, normal, texCoord), an index buffer and a
+///        vertex array, so drawing it does not copy any client memory.  The indices are
+///        narrowed to GLushort as the index policy allows, see esSetIndexPolicy.
+/// \param esContext Application context, binds go through its state cache
+/// \param numSlices The number of slices in the sphere
+/// \param radius The radius of the sphere
+/// \param positionLoc Attribute location of the float3 positions
+/// \param normalLoc Attribute location of the float3 normals, -1 to leave them out
+/// \param texCoordLoc Attribute location of the float2 texCoords, -1 to leave them out
+/// \param mesh Returns the mesh, draw it with esMeshDraw
+/// \return GL_FALSE if the buffers could not be filled
+//
+GLboolean ESUTIL_API esGenSphereToMesh ( ESContext *esContext, int numSlices, float radius,
+                                         GLint positionLoc, GLint normalLoc, GLint texCoordLoc, ESMesh *mesh );
+
+//
+/// \brief Generates a cube like esGenCube into a mesh, see esGenSphereToMesh
+//
+GLboolean ESUTIL_API esGenCubeToMesh ( ESContext *esContext, float scale,
+                                       GLint positionLoc, GLint normalLoc, GLint texCoordLoc, ESMesh *mesh );
+
+//
+/// \brief Generates a square grid like esGenSquareGrid into a mesh, see esGenSphereToMesh
+//
+GLboolean ESUTIL_API esGenSquareGridToMesh ( ESContext *esContext, int size, GLint positionLoc, ESMesh *mesh );
+
+//
+/// \brief Bind the vertex array of each sub-mesh through the state cache and draw it
+/// \param esContext Application context
+/// \param mesh Mesh to draw
+//
+void ESUTIL_API esMeshDraw ( ESContext *esContext, const ESMesh *mesh );
+
+//
+/// \brief Delete the buffers and vertex arrays of a mesh
+/// \param esContext Application context
+/// \param mesh Mesh to delete
+//
+void ESUTIL_API esMeshDestroy ( ESContext *esContext, ESMesh *mesh );
+
 //
 /// \brief Loads a 8-bit, 24-bit or 32-bit TGA image from a file
 /// \param ioContext Context related to IO facility on the platform
@@ -258,6 +1270,15 @@ int ESUTIL_API esGenSquareGrid ( int size, GLfloat **vertices, GLuint **indices
 //
 char *ESUTIL_API esLoadTGA ( void *ioContext, const char *fileName, int *width, int *height );
 
+//
+/// \brief Loads a whole file, e.g. shader source
+/// \param ioContext Context related to IO facility on the platform
+/// \param fileName Name of the file on disk
+/// \param size Returns the file size in bytes if not NULL
+/// \return Contents of the file followed by a '\0', free with free().  NULL on failure.
+//
+char *ESUTIL_API esLoadFile ( void *ioContext, const char *fileName, int *size );
+
 
 //
 /// \brief Multiply matrix specified by result with a scaling matrix and return new matrix in result
@@ -65,6 +65,86 @@ extern "C" {
 //
 GLboolean WinCreate ( ESContext *esContext, const char *title );
 
+///
+//  WinDestroy()
+//
+//      Destroy the window created by WinCreate
+//
+void WinDestroy ( ESContext *esContext );
+
+///
+//  esSwapBuffers()
+//
+//      Present a frame with the damage reported through esAddDamageRect
+//
+void esSwapBuffers ( ESContext *esContext );
+
+///
+//  esReadFramePixels()
+//
+//      Read back the frame that will be presented, see esUtil.c
+//
+void esReadFramePixels ( GLsizei width, GLsizei height, GLvoid *pixels );
+
+///
+//  esParseOptions()
+//
+//      Fill in the run options from the command line arguments passed to main()
+//
+GLboolean esParseOptions ( ESOptions *options, int argc, char *argv[] );
+
+///
+//  Benchmark mode support shared by the platform main loops (esBenchmark.c)
+//
+typedef struct ESBenchmark ESBenchmark;
+
+ESBenchmark *esBenchmarkCreate ( int numWarmupFrames, int numFrames );
+void esBenchmarkRecord ( ESBenchmark *benchmark, int frame, double frameStart, double frameEnd,
+                         double updateTime, double drawTime, double swapTime );
+void esBenchmarkRecordQueueDepth ( ESBenchmark *benchmark, int frame, int depth, int limit );
+void esBenchmarkHashFramebuffer ( ESBenchmark *benchmark, ESContext *esContext );
+void esBenchmarkReport ( ESBenchmark *benchmark, ESContext *esContext, const char *fileName );
+void esBenchmarkDestroy ( ESBenchmark *benchmark );
+
+///
+//  Clock sources for the update delta time (esClock.c)
+//
+typedef struct ESClock ESClock;
+
+double esGetTime ( void );
+ESClock *esClockCreate ( const ESOptions *options );
+float esClockDeltaTime ( ESClock *clock );
+void esClockDestroy ( ESClock *clock );
+
+///
+//  Update worker for the pipelined main loop (esPipeline.c)
+//
+typedef struct ESPipeline ESPipeline;
+
+ESPipeline *esPipelineCreate ( ESContext *esContext );
+void esPipelineBeginUpdate ( ESPipeline *pipeline, float deltaTime );
+double esPipelineEndUpdate ( ESPipeline *pipeline );
+void esPipelineDestroy ( ESPipeline *pipeline );
+
+///
+//  Frames-in-flight limit of the main loop (esFrameQueue.c)
+//
+typedef struct ESFrameQueue ESFrameQueue;
+
+ESFrameQueue *esFrameQueueCreate ( int maxFramesInFlight );
+int esFrameQueueBegin ( ESFrameQueue *queue );
+void esFrameQueueEnd ( ESFrameQueue *queue );
+void esFrameQueueDestroy ( ESFrameQueue *queue );
+
+///
+//  Framebuffer readback to an image stream (esCapture.c)
+//
+typedef struct ESCapture ESCapture;
+
+ESCapture *esCaptureCreate ( ESContext *esContext, const char *fileName );
+void esCaptureFrame ( ESCapture *capture );
+void esCaptureDestroy ( ESCapture *capture );
+
 #ifdef __cplusplus
 }
 #endif
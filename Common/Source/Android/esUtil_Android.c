@@ -41,6 +41,7 @@
 #include <android_native_app_glue.h>
 #include <time.h>
 #include "esUtil.h"
+#include "esUtil_win.h"
 
 #define LOGI(...) ((void)__android_log_print(ANDROID_LOG_INFO, "esUtil", __VA_ARGS__))
 
@@ -93,15 +94,7 @@ static void HandleCommand ( struct android_app *pApp, int32_t cmd )
       case APP_CMD_TERM_WINDOW:
 
          // Cleanup on shutdown
-         if ( esContext->shutdownFunc != NULL )
-         {
-            esContext->shutdownFunc ( esContext );
-         }
-
-         if ( esContext->userData != NULL )
-         {
-            free ( esContext->userData );
-         }
+         esDestroyContext ( esContext );
 
          memset ( esContext, 0, sizeof ( ESContext ) );
          break;
@@ -189,7 +182,14 @@ void android_main ( struct android_app *pApp )
       if ( esContext.drawFunc != NULL )
       {
          esContext.drawFunc ( &esContext );
-         eglSwapBuffers ( esContext.eglDisplay, esContext.eglSurface );
+         esSwapBuffers ( &esContext );
+      }
+
+      // The activity is torn down through destroyRequested like a user exit
+      if ( esContext.exitRequested )
+      {
+         esContext.exitRequested = GL_FALSE;
+         ANativeActivity_finish ( pApp->activity );
       }
    }
 }
@@ -206,3 +206,12 @@ GLboolean WinCreate ( ESContext *esContext, const char *title )
    // android_main()
    return GL_TRUE;
 }
+
+///
+//  WinDestroy()
+//
+//      The native window belongs to the activity, nothing to destroy
+//
+void WinDestroy ( ESContext *esContext )
+{
+}
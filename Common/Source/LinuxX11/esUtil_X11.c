@@ -20,16 +20,37 @@
 #include <stdlib.h>
 #include <string.h>
 #include <stdarg.h>
-#include <sys/time.h>
 #include "esUtil.h"
+#include "esUtil_win.h"
 
+#include  <pthread.h>
+#include  <poll.h>
 #include  <X11/Xlib.h>
 #include  <X11/Xatom.h>
 #include  <X11/Xutil.h>
 
-// X11 related local variables
-static Display *x_display = NULL;
-static Atom s_wmDeleteMessage;
+///
+// Types
+//
+
+// X11 state of one context, kept in esContext->windowData.  Every context
+// opens its own display connection, so contexts can run on separate threads.
+typedef struct
+{
+    Display *display;
+    Window   window;
+    Atom     wmDeleteMessage;
+} X11Window;
+
+// One thread of esRunContexts()
+typedef struct
+{
+    ESContext   esContext;
+    int         index;
+    int         ( ESCALLBACK *initFunc ) ( ESContext *, int );
+    int         result;
+    pthread_t   thread;
+} ContextThread;
 
 //////////////////////////////////////////////////////////////////
 //
@@ -37,6 +58,25 @@ static Atom s_wmDeleteMessage;
 //
 //
 
+///
+//  ContextThreadMain()
+//
+//      Initialize, run and destroy one context of esRunContexts()
+//
+static void *ContextThreadMain ( void *arg )
+{
+    ContextThread *ct = ( ContextThread * ) arg;
+
+    if ( ct->initFunc ( &ct->esContext, ct->index ) == GL_TRUE )
+    {
+        esMainLoop ( &ct->esContext );
+        ct->result = GL_TRUE;
+    }
+
+    esDestroyContext ( &ct->esContext );
+    return NULL;
+}
+
 
 //////////////////////////////////////////////////////////////////
 //
@@ -49,7 +89,7 @@ static Atom s_wmDeleteMessage;
 //
 //      This function initialized the native X11 display and window for EGL
 //
-EGLBoolean WinCreate(ESContext *esContext, const char *title)
+GLboolean WinCreate(ESContext *esContext, const char *title)
 {
     Window root;
     XSetWindowAttributes swa;
@@ -57,9 +97,9 @@ EGLBoolean WinCreate(ESContext *esContext, const char *title)
     Atom wm_state;
     XWMHints hints;
     XEvent xev;
-    EGLConfig ecfg;
-    EGLint num_config;
     Window win;
+    Display *x_display;
+    X11Window *x11Window;
 
     /*
      * X11 native display initialization
@@ -68,7 +108,7 @@ EGLBoolean WinCreate(ESContext *esContext, const char *title)
     x_display = XOpenDisplay(NULL);
     if ( x_display == NULL )
     {
-        return EGL_FALSE;
+        return GL_FALSE;
     }
 
     root = DefaultRootWindow(x_display);
@@ -80,8 +120,19 @@ EGLBoolean WinCreate(ESContext *esContext, const char *title)
                CopyFromParent, InputOutput,
                CopyFromParent, CWEventMask,
                &swa );
-    s_wmDeleteMessage = XInternAtom(x_display, "WM_DELETE_WINDOW", False);
-    XSetWMProtocols(x_display, win, &s_wmDeleteMessage, 1);
+
+    x11Window = calloc ( 1, sizeof ( X11Window ) );
+    if ( x11Window == NULL )
+    {
+        XDestroyWindow ( x_display, win );
+        XCloseDisplay ( x_display );
+        return GL_FALSE;
+    }
+
+    x11Window->display = x_display;
+    x11Window->window = win;
+    x11Window->wmDeleteMessage = XInternAtom(x_display, "WM_DELETE_WINDOW", False);
+    XSetWMProtocols(x_display, win, &x11Window->wmDeleteMessage, 1);
 
     xattr.override_redirect = FALSE;
     XChangeWindowAttributes ( x_display, win, CWOverrideRedirect, &xattr );
@@ -113,7 +164,26 @@ EGLBoolean WinCreate(ESContext *esContext, const char *title)
 
     esContext->eglNativeWindow = (EGLNativeWindowType) win;
     esContext->eglNativeDisplay = (EGLNativeDisplayType) x_display;
-    return EGL_TRUE;
+    esContext->windowData = x11Window;
+    return GL_TRUE;
+}
+
+///
+//  WinDestroy()
+//
+//      Destroy the window and close the display connection of a context
+//
+void WinDestroy ( ESContext *esContext )
+{
+    X11Window *x11Window = ( X11Window * ) esContext->windowData;
+
+    if ( x11Window == NULL )
+        return;
+
+    XDestroyWindow ( x11Window->display, x11Window->window );
+    XCloseDisplay ( x11Window->display );
+    free ( x11Window );
+    esContext->windowData = NULL;
 }
 
 ///
@@ -124,15 +194,16 @@ EGLBoolean WinCreate(ESContext *esContext, const char *title)
 //
 GLboolean userInterrupt(ESContext *esContext)
 {
+    X11Window *x11Window = ( X11Window * ) esContext->windowData;
     XEvent xev;
     KeySym key;
     GLboolean userinterrupt = GL_FALSE;
     char text;
 
     // Pump all messages from X server. Keypresses are directed to keyfunc (if defined)
-    while ( XPending ( x_display ) )
+    while ( XPending ( x11Window->display ) )
     {
-        XNextEvent( x_display, &xev );
+        XNextEvent( x11Window->display, &xev );
         if ( xev.type == KeyPress )
         {
             if (XLookupString(&xev.xkey,&text,1,&key,0)==1)
@@ -142,42 +213,234 @@ GLboolean userInterrupt(ESContext *esContext)
             }
         }
         if (xev.type == ClientMessage) {
-            if (xev.xclient.data.l[0] == s_wmDeleteMessage) {
+            if (xev.xclient.data.l[0] == x11Window->wmDeleteMessage) {
                 userinterrupt = GL_TRUE;
             }
         }
         if ( xev.type == DestroyNotify )
             userinterrupt = GL_TRUE;
+        if ( xev.type == Expose )
+            esContext->redraw = GL_TRUE;
     }
     return userinterrupt;
 }
 
+///
+//  WaitForEvents()
+//
+//      Block until the X server sends an event or timeout seconds have passed
+//      (timeout <= 0 waits for the next event).
+//
+static void WaitForEvents ( ESContext *esContext, float timeout )
+{
+    X11Window *x11Window = ( X11Window * ) esContext->windowData;
+    struct pollfd pfd;
+
+    // Requests still sitting in the output buffer may be what the server
+    // has to answer before anything happens
+    XFlush ( x11Window->display );
+
+    if ( XPending ( x11Window->display ) )
+        return;
+
+    pfd.fd = ConnectionNumber ( x11Window->display );
+    pfd.events = POLLIN;
+    pfd.revents = 0;
+    poll ( &pfd, 1, timeout > 0.0f ? ( int ) ( timeout * 1000.0f ) : -1 );
+}
+
 ///
 //  WinLoop()
 //
-//      Start main windows loop
+//      Start main windows loop.  For an ES_WINDOW_OFFSCREEN context there is no
+//      X11 connection, so no events are pumped and the loop only ends after
+//      options.numFrames frames.  In benchmark mode the update, draw and swap
+//      of every frame after warm-up are timed and reported on exit.  The
+//      delta time comes from the clock source selected by the run options.
+//      If the application enabled the pipeline, the update of the next frame
+//      runs on a worker thread while the current frame is drawn.  In
+//      on-demand mode the update callback runs after every batch of events
+//      (or idle timeout) but a frame is only drawn once a redraw is requested.
+//      With a frames-in-flight limit each frame first waits for the GPU to
+//      finish all but the last limit - 1 frames.
 //
 void WinLoop ( ESContext *esContext )
 {
-    struct timeval t1, t2;
-    struct timezone tz;
+    double t1, t2, t3, t4, t5;
+    double updateTime;
     float deltatime;
+    int numFrames = 0;
+    int maxFrames = 0;
+    int queueDepth = 0;
+    GLboolean offscreen = ( esContext->flags & ES_WINDOW_OFFSCREEN ) != 0;
+    GLboolean onDemand = esContext->options.onDemand && !offscreen;
+    ESBenchmark *benchmark = NULL;
+    ESClock *clock = esClockCreate ( &esContext->options );
+    ESPipeline *pipeline = NULL;
+    ESFrameQueue *frameQueue = NULL;
+    ESCapture *capture = NULL;
+
+    if ( clock == NULL )
+        return;
+
+    // The first frame's state has to exist before it can be drawn.  The
+    // update runs ahead of the draw in the pipeline, which cannot know
+    // whether the frame it prepares will be drawn in on-demand mode.
+    if ( !onDemand )
+        pipeline = esPipelineCreate ( esContext );
+    if ( pipeline != NULL )
+    {
+        esPipelineBeginUpdate ( pipeline, esClockDeltaTime ( clock ) );
+        esPipelineEndUpdate ( pipeline );
+    }
+
+    if ( esContext->options.numFrames > 0 )
+        maxFrames = esContext->options.numWarmupFrames + esContext->options.numFrames;
+
+    if ( esContext->options.benchmark )
+        benchmark = esBenchmarkCreate ( esContext->options.numWarmupFrames, esContext->options.numFrames );
+
+    // A benchmark measures the queue depth even without a limit
+    if ( esContext->options.maxFramesInFlight > 0 || benchmark != NULL )
+        frameQueue = esFrameQueueCreate ( esContext->options.maxFramesInFlight );
+
+    // Contexts run side by side would write the same file, only the first captures
+    if ( esContext->options.captureFile != NULL && esContext->options.contextIndex == 0 )
+        capture = esCaptureCreate ( esContext, esContext->options.captureFile );
 
-    gettimeofday ( &t1 , &tz );
+    esContext->redraw = GL_TRUE;
 
-    while(userInterrupt(esContext) == GL_FALSE)
+    while ( ( maxFrames == 0 || numFrames < maxFrames ) && !esContext->exitRequested )
     {
-        gettimeofday(&t2, &tz);
-        deltatime = (float)(t2.tv_sec - t1.tv_sec + (t2.tv_usec - t1.tv_usec) * 1e-6);
-        t1 = t2;
+        double frameStart = esGetTime();
 
-        if (esContext->updateFunc != NULL)
+        // Throttle before reading input so it is applied to the newest frame
+        if ( frameQueue != NULL )
+            queueDepth = esFrameQueueBegin ( frameQueue );
+
+        if ( !offscreen && userInterrupt ( esContext ) == GL_TRUE )
+            break;
+
+        t1 = esGetTime();
+        deltatime = esClockDeltaTime ( clock );
+
+        if ( pipeline != NULL )
+            esPipelineBeginUpdate ( pipeline, deltatime );
+        else if (esContext->updateFunc != NULL)
             esContext->updateFunc(esContext, deltatime);
+        t2 = esGetTime();
+
+        // Nothing changed, sleep until the next event instead of redrawing
+        if ( onDemand )
+        {
+            if ( !esContext->redraw )
+            {
+                WaitForEvents ( esContext, esContext->options.idleTimeout );
+                continue;
+            }
+            esContext->redraw = GL_FALSE;
+        }
+
         if (esContext->drawFunc != NULL)
             esContext->drawFunc(esContext);
 
-        eglSwapBuffers(esContext->eglDisplay, esContext->eglSurface);        
+        // The back buffer is only defined until the swap
+        if ( capture != NULL )
+            esCaptureFrame ( capture );
+        t3 = esGetTime();
+
+        esSwapBuffers ( esContext );
+        if ( frameQueue != NULL )
+            esFrameQueueEnd ( frameQueue );
+        t4 = esGetTime();
+
+        // Wait for the next frame's update, it overlapped with draw and swap
+        updateTime = t2 - t1;
+        if ( pipeline != NULL )
+            updateTime = esPipelineEndUpdate ( pipeline );
+        t5 = esGetTime();
+
+        if ( benchmark != NULL )
+        {
+            esBenchmarkRecord ( benchmark, numFrames, frameStart, t5, updateTime, t3 - t2, t4 - t3 );
+            esBenchmarkRecordQueueDepth ( benchmark, numFrames, queueDepth, esContext->options.maxFramesInFlight );
+        }
+
+        numFrames++;
+    }
+
+    if ( benchmark != NULL )
+    {
+        // A pbuffer still holds the last frame, fingerprint it for regression checks
+        if ( offscreen )
+            esBenchmarkHashFramebuffer ( benchmark, esContext );
+
+        esBenchmarkReport ( benchmark, esContext, esContext->options.benchmarkFile );
+        esBenchmarkDestroy ( benchmark );
     }
+
+    esCaptureDestroy ( capture );
+    esFrameQueueDestroy ( frameQueue );
+    esPipelineDestroy ( pipeline );
+    esClockDestroy ( clock );
+}
+
+///
+//  esMainLoop()
+//
+void ESUTIL_API esMainLoop ( ESContext *esContext )
+{
+    WinLoop ( esContext );
+}
+
+///
+//  esRunContexts()
+//
+//      Run every context on its own thread.  Each thread creates its
+//      context through initFunc, runs the main loop and destroys it again.
+//
+int ESUTIL_API esRunContexts ( int numContexts, const ESOptions *options,
+                               int ( ESCALLBACK *initFunc ) ( ESContext *, int ) )
+{
+    ContextThread *threads = calloc ( numContexts, sizeof ( ContextThread ) );
+    int result = GL_TRUE;
+    int i;
+
+    if ( threads == NULL )
+        return GL_FALSE;
+
+    // Each thread talks to its own display connection, but Xlib still
+    // needs to be told that it is used from several threads
+    XInitThreads ( );
+
+    for ( i = 0; i < numContexts; i++ )
+    {
+        ContextThread *ct = &threads[i];
+
+        ct->esContext.options = *options;
+        ct->esContext.options.contextIndex = i;
+        ct->index = i;
+        ct->initFunc = initFunc;
+
+        if ( pthread_create ( &ct->thread, NULL, ContextThreadMain, ct ) != 0 )
+        {
+            esLogMessage ( "Could not start thread for context %d\n", i );
+            numContexts = i;
+            result = GL_FALSE;
+            break;
+        }
+    }
+
+    for ( i = 0; i < numContexts; i++ )
+    {
+        pthread_join ( threads[i].thread, NULL );
+
+        if ( threads[i].result != GL_TRUE )
+            result = GL_FALSE;
+    }
+
+    free ( threads );
+    return result;
 }
 
 ///
@@ -186,6 +449,19 @@ void WinLoop ( ESContext *esContext )
 //
 extern int esMain( ESContext *esContext );
 
+///
+//  RunMain()
+//
+//      esRunContexts() entry point running the application on every context
+//
+static int ESCALLBACK RunMain ( ESContext *esContext, int index )
+{
+    // The index is already in esContext->options.contextIndex
+    ( void ) index;
+
+    return esMain ( esContext );
+}
+
 ///
 //  main()
 //
@@ -197,17 +473,18 @@ int main ( int argc, char *argv[] )
    
    memset ( &esContext, 0, sizeof( esContext ) );
 
+   if ( esParseOptions ( &esContext.options, argc, argv ) != GL_TRUE )
+      return 1;
+
+   // Several independent copies of the application, one thread each
+   if ( esContext.options.numContexts > 1 )
+      return esRunContexts ( esContext.options.numContexts, &esContext.options, RunMain ) == GL_TRUE ? 0 : 1;
 
    if ( esMain ( &esContext ) != GL_TRUE )
       return 1;   
  
-   WinLoop ( &esContext );
-
-   if ( esContext.shutdownFunc != NULL )
-	   esContext.shutdownFunc ( &esContext );
-
-   if ( esContext.userData != NULL )
-	   free ( esContext.userData );
+   esMainLoop ( &esContext );
+   esDestroyContext ( &esContext );
 
    return 0;
 }
@@ -41,11 +41,26 @@
 #include <windows.h>
 #include <stdlib.h>
 #include "esUtil.h"
+#include "esUtil_win.h"
 
 #ifdef _WIN64
 #define GWL_USERDATA GWLP_USERDATA
 #endif
 
+///
+// Types
+//
+
+// One thread of esRunContexts()
+typedef struct
+{
+   ESContext   esContext;
+   int         index;
+   int         ( ESCALLBACK *initFunc ) ( ESContext *, int );
+   int         result;
+   HANDLE      thread;
+} ContextThread;
+
 //////////////////////////////////////////////////////////////////
 //
 //  Private Functions
@@ -73,7 +88,7 @@ LRESULT WINAPI ESWindowProc ( HWND hWnd, UINT uMsg, WPARAM wParam, LPARAM lParam
          if ( esContext && esContext->drawFunc )
          {
             esContext->drawFunc ( esContext );
-            eglSwapBuffers ( esContext->eglDisplay, esContext->eglSurface );
+            esSwapBuffers ( esContext );
          }
 
 
@@ -131,7 +146,8 @@ GLboolean WinCreate ( ESContext *esContext, const char *title )
    wndclass.hbrBackground = ( HBRUSH ) GetStockObject ( BLACK_BRUSH );
    wndclass.lpszClassName = "opengles3.0";
 
-   if ( !RegisterClass ( &wndclass ) )
+   // Every context creates its window from the same class
+   if ( !RegisterClass ( &wndclass ) && GetLastError () != ERROR_CLASS_ALREADY_EXISTS )
    {
       return FALSE;
    }
@@ -182,6 +198,20 @@ GLboolean WinCreate ( ESContext *esContext, const char *title )
    return GL_TRUE;
 }
 
+///
+//  WinDestroy()
+//
+//      Destroy the window created by WinCreate
+//
+void WinDestroy ( ESContext *esContext )
+{
+   if ( esContext->eglNativeWindow != NULL )
+   {
+      DestroyWindow ( esContext->eglNativeWindow );
+      esContext->eglNativeWindow = NULL;
+   }
+}
+
 ///
 //  WinLoop()
 //
@@ -191,9 +221,112 @@ void WinLoop ( ESContext *esContext )
 {
    MSG msg = { 0 };
    int done = 0;
+   int numFrames = 0;
+   int queueDepth = 0;
    DWORD lastTime = GetTickCount();
+   ESFrameQueue *frameQueue = NULL;
+
+   esContext->redraw = GL_TRUE;
+
+   // A benchmark measures the queue depth even without a limit
+   if ( esContext->options.maxFramesInFlight > 0 || esContext->options.benchmark )
+   {
+      frameQueue = esFrameQueueCreate ( esContext->options.maxFramesInFlight );
+   }
 
-   while ( !done )
+   // There is no window to receive WM_PAINT, drive the callbacks directly
+   if ( esContext->flags & ES_WINDOW_OFFSCREEN )
+   {
+      int maxFrames = 0;
+      ESBenchmark *benchmark = NULL;
+      ESCapture *capture = NULL;
+      ESClock *clock = esClockCreate ( &esContext->options );
+
+      if ( clock == NULL )
+      {
+         return;
+      }
+
+      if ( esContext->options.numFrames > 0 )
+      {
+         maxFrames = esContext->options.numWarmupFrames + esContext->options.numFrames;
+      }
+
+      if ( esContext->options.benchmark )
+      {
+         benchmark = esBenchmarkCreate ( esContext->options.numWarmupFrames, esContext->options.numFrames );
+      }
+
+      // Offline rendering is captured from the pbuffer, one context per file
+      if ( esContext->options.captureFile != NULL && esContext->options.contextIndex == 0 )
+      {
+         capture = esCaptureCreate ( esContext, esContext->options.captureFile );
+      }
+
+      while ( ( maxFrames == 0 || numFrames < maxFrames ) && !esContext->exitRequested )
+      {
+         double t1 = esGetTime ();
+         double t2, t3, t4;
+         float deltaTime;
+
+         if ( frameQueue != NULL )
+         {
+            queueDepth = esFrameQueueBegin ( frameQueue );
+         }
+
+         deltaTime = esClockDeltaTime ( clock );
+
+         if ( esContext->updateFunc != NULL )
+         {
+            esContext->updateFunc ( esContext, deltaTime );
+         }
+
+         t2 = esGetTime ();
+
+         if ( esContext->drawFunc != NULL )
+         {
+            esContext->drawFunc ( esContext );
+         }
+
+         if ( capture != NULL )
+         {
+            esCaptureFrame ( capture );
+         }
+
+         t3 = esGetTime ();
+         esSwapBuffers ( esContext );
+
+         if ( frameQueue != NULL )
+         {
+            esFrameQueueEnd ( frameQueue );
+         }
+
+         t4 = esGetTime ();
+
+         if ( benchmark != NULL )
+         {
+            esBenchmarkRecord ( benchmark, numFrames, t1, t4, t2 - t1, t3 - t2, t4 - t3 );
+            esBenchmarkRecordQueueDepth ( benchmark, numFrames, queueDepth, esContext->options.maxFramesInFlight );
+         }
+
+         numFrames++;
+      }
+
+      if ( benchmark != NULL )
+      {
+         // The pbuffer still holds the last frame, fingerprint it for regression checks
+         esBenchmarkHashFramebuffer ( benchmark, esContext );
+         esBenchmarkReport ( benchmark, esContext, esContext->options.benchmarkFile );
+         esBenchmarkDestroy ( benchmark );
+      }
+
+      esCaptureDestroy ( capture );
+      esFrameQueueDestroy ( frameQueue );
+      esClockDestroy ( clock );
+      return;
+   }
+
+   while ( !done && !esContext->exitRequested )
    {
       int gotMsg = ( PeekMessage ( &msg, NULL, 0, 0, PM_REMOVE ) != 0 );
       DWORD curTime = GetTickCount();
@@ -212,9 +345,29 @@ void WinLoop ( ESContext *esContext )
             DispatchMessage ( &msg );
          }
       }
-      else
+      else if ( !esContext->options.onDemand || esContext->redraw )
       {
+         esContext->redraw = GL_FALSE;
+
+         if ( frameQueue != NULL )
+         {
+            esFrameQueueBegin ( frameQueue );
+         }
+
          SendMessage ( esContext->eglNativeWindow, WM_PAINT, 0, 0 );
+
+         if ( frameQueue != NULL )
+         {
+            esFrameQueueEnd ( frameQueue );
+         }
+      }
+      else
+      {
+         // Nothing changed, sleep until the next message or the idle timeout
+         DWORD timeout = esContext->options.idleTimeout > 0.0f ?
+                         ( DWORD ) ( esContext->options.idleTimeout * 1000.0f ) : INFINITE;
+
+         MsgWaitForMultipleObjects ( 0, NULL, FALSE, timeout, QS_ALLINPUT );
       }
 
       // Call update function if registered
@@ -223,6 +376,87 @@ void WinLoop ( ESContext *esContext )
          esContext->updateFunc ( esContext, deltaTime );
       }
    }
+
+   esFrameQueueDestroy ( frameQueue );
+}
+
+///
+//  esMainLoop()
+//
+void ESUTIL_API esMainLoop ( ESContext *esContext )
+{
+   WinLoop ( esContext );
+}
+
+///
+//  ContextThreadMain()
+//
+//      Initialize, run and destroy one context of esRunContexts()
+//
+static DWORD WINAPI ContextThreadMain ( LPVOID arg )
+{
+   ContextThread *ct = ( ContextThread * ) arg;
+
+   if ( ct->initFunc ( &ct->esContext, ct->index ) == GL_TRUE )
+   {
+      esMainLoop ( &ct->esContext );
+      ct->result = GL_TRUE;
+   }
+
+   esDestroyContext ( &ct->esContext );
+   return 0;
+}
+
+///
+//  esRunContexts()
+//
+//      Run every context on its own thread.  A window belongs to the thread
+//      that created it, so each thread also pumps its own message queue.
+//
+int ESUTIL_API esRunContexts ( int numContexts, const ESOptions *options,
+                               int ( ESCALLBACK *initFunc ) ( ESContext *, int ) )
+{
+   ContextThread *threads = calloc ( numContexts, sizeof ( ContextThread ) );
+   int result = GL_TRUE;
+   int i;
+
+   if ( threads == NULL )
+   {
+      return GL_FALSE;
+   }
+
+   for ( i = 0; i < numContexts; i++ )
+   {
+      ContextThread *ct = &threads[i];
+
+      ct->esContext.options = *options;
+      ct->esContext.options.contextIndex = i;
+      ct->index = i;
+      ct->initFunc = initFunc;
+      ct->thread = CreateThread ( NULL, 0, ContextThreadMain, ct, 0, NULL );
+
+      if ( ct->thread == NULL )
+      {
+         esLogMessage ( "Could not start thread for context %d\n", i );
+         numContexts = i;
+         result = GL_FALSE;
+         break;
+      }
+   }
+
+   for ( i = 0; i < numContexts; i++ )
+   {
+      WaitForSingleObject ( threads[i].thread, INFINITE );
+      CloseHandle ( threads[i].thread );
+
+      if ( threads[i].result != GL_TRUE )
+      {
+         result = GL_FALSE;
+      }
+   }
+
+   free ( threads );
+   return result;
 }
 
 ///
@@ -231,6 +465,19 @@ void WinLoop ( ESContext *esContext )
 //
 extern int esMain ( ESContext *esContext );
 
+///
+//  RunMain()
+//
+//      esRunContexts() entry point running the application on every context
+//
+static int ESCALLBACK RunMain ( ESContext *esContext, int index )
+{
+   // The index is already in esContext->options.contextIndex
+   ( void ) index;
+
+   return esMain ( esContext );
+}
+
 ///
 //  main()
 //
@@ -242,22 +489,24 @@ int main ( int argc, char *argv[] )
 
    memset ( &esContext, 0, sizeof ( ESContext ) );
 
-   if ( esMain ( &esContext ) != GL_TRUE )
+   if ( esParseOptions ( &esContext.options, argc, argv ) != GL_TRUE )
    {
       return 1;
    }
 
-   WinLoop ( &esContext );
-
-   if ( esContext.shutdownFunc != NULL )
+   // Several independent copies of the application, one thread each
+   if ( esContext.options.numContexts > 1 )
    {
-      esContext.shutdownFunc ( &esContext );
+      return esRunContexts ( esContext.options.numContexts, &esContext.options, RunMain ) == GL_TRUE ? 0 : 1;
    }
 
-   if ( esContext.userData != NULL )
+   if ( esMain ( &esContext ) != GL_TRUE )
    {
-      free ( esContext.userData );
+      return 1;
    }
 
+   esMainLoop ( &esContext );
+   esDestroyContext ( &esContext );
+
    return 0;
 }
@@ -0,0 +1,485 @@
+// The MIT License (MIT)
+//
+// Copyright (c) 2013 Dan Ginsburg, Budirijanto Purnomo
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+
+//
+// Book:      OpenGL(R) ES 3.0 Programming Guide, 2nd Edition
+// Authors:   Dan Ginsburg, Budirijanto Purnomo, Dave Shreiner, Aaftab Munshi
+// ISBN-10:   0-321-93388-5
+// ISBN-13:   978-0-321-93388-1
+// Publisher: Addison-Wesley Professional
+// URLs:      http://www.opengles-book.com
+//            http://my.safaribooksonline.com/book/animation-and-3d/9780133440133
+//
+// ESBenchmark.c
+//
+//    Frame timing for the benchmark mode of the main loop.  The platform
+//    loop records the update, draw and swap time of every measured frame
+//    and the statistics are reported as a single line of JSON.
+//
+
+///
+//  Includes
+//
+#include "esUtil.h"
+#include "esUtil_win.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+///
+//  Types
+//
+struct ESBenchmark
+{
+   int      numWarmupFrames;
+   int      numFrames;
+   int      numRecorded;
+
+   // Per-frame times in seconds, one entry per measured frame
+   double  *updateTime;
+   double  *drawTime;
+   double  *swapTime;
+   double  *frameTime;
+
+   // Frames still in flight at the start of every measured frame, NULL
+   // until the first depth is recorded
+   int     *queueDepth;
+   int      queueLimit;
+
+   // Difference hash of the last measured frame
+   unsigned long long hash;
+   GLboolean hashValid;
+
+   // Start of the first and end of the last measured frame
+   double   startTime;
+   double   endTime;
+};
+
+//////////////////////////////////////////////////////////////////
+//
+//  Private Functions
+//
+//
+
+///
+// CompareDouble()
+//
+static int CompareDouble ( const void *a, const void *b )
+{
+   double da = * ( const double * ) a;
+   double db = * ( const double * ) b;
+
+   return ( da > db ) - ( da < db );
+}
+
+///
+// Percentile()
+//
+//    Nearest-rank percentile of a sorted array
+//
+static double Percentile ( const double *sorted, int count, double p )
+{
+   int rank = ( int ) ( p * count + 0.999999 );
+
+   if ( rank < 1 )
+   {
+      rank = 1;
+   }
+
+   if ( rank > count )
+   {
+      rank = count;
+   }
+
+   return sorted[rank - 1];
+}
+
+///
+// PrintStats()
+//
+//    Append "name":{min,median,p95,p99,max,mean} in milliseconds to buf
+//
+static int PrintStats ( char *buf, size_t size, const char *name, const double *times, int count )
+{
+   double *sorted = malloc ( sizeof ( double ) * count );
+   double sum = 0.0;
+   int len;
+   int i;
+
+   // The report just leaves the statistics out
+   if ( sorted == NULL )
+   {
+      esLog ( ES_LOG_ERROR, "Out of memory for the %s statistics\n", name );
+      return 0;
+   }
+
+   for ( i = 0; i < count; i++ )
+   {
+      sorted[i] = times[i];
+      sum += times[i];
+   }
+
+   qsort ( sorted, count, sizeof ( double ), CompareDouble );
+
+   len = snprintf ( buf, size, ",\"%s\":{\"min\":%.4f,\"median\":%.4f,\"p95\":%.4f,\"p99\":%.4f,\"max\":%.4f,\"mean\":%.4f}",
+                    name,
+                    sorted[0] * 1000.0,
+                    Percentile ( sorted, count, 0.50 ) * 1000.0,
+                    Percentile ( sorted, count, 0.95 ) * 1000.0,
+                    Percentile ( sorted, count, 0.99 ) * 1000.0,
+                    sorted[count - 1] * 1000.0,
+                    sum / count * 1000.0 );
+
+   free ( sorted );
+   return len;
+}
+
+///
+// EscapeJson()
+//
+//    Copy src into a JSON string, escaping quotes and backslashes.  Too long
+//    strings are cut short.
+//
+static void EscapeJson ( char *dst, size_t size, const char *src )
+{
+   size_t len = 0;
+
+   for ( ; *src != '\0'; src++ )
+   {
+      int escape = *src == '"' || *src == '\\';
+
+      if ( len + escape + 1 >= size )
+      {
+         break;
+      }
+
+      if ( escape )
+      {
+         dst[len++] = '\\';
+      }
+
+      dst[len++] = *src;
+   }
+
+   dst[len] = '\0';
+}
+
+///
+// Appended()
+//
+//    Length of the line after appending written characters with snprintf,
+//    which returns what it would have written had the line been long enough
+//
+static int Appended ( int len, int written, size_t size )
+{
+   if ( written < 0 )
+   {
+      return len;
+   }
+
+   return len + written < ( int ) size ? len + written : ( int ) size - 1;
+}
+
+//////////////////////////////////////////////////////////////////
+//
+//  Public Functions
+//
+//
+
+///
+// esBenchmarkCreate()
+//
+//    Allocate storage for numFrames measured frames after numWarmupFrames.
+//    Returns NULL if out of memory.
+//
+ESBenchmark *esBenchmarkCreate ( int numWarmupFrames, int numFrames )
+{
+   ESBenchmark *benchmark;
+
+   if ( numFrames <= 0 )
+   {
+      return NULL;
+   }
+
+   benchmark = calloc ( 1, sizeof ( ESBenchmark ) );
+
+   if ( benchmark == NULL )
+   {
+      esLog ( ES_LOG_ERROR, "Out of memory for the benchmark\n" );
+      return NULL;
+   }
+
+   benchmark->numWarmupFrames = numWarmupFrames;
+   benchmark->numFrames = numFrames;
+   benchmark->updateTime = malloc ( sizeof ( double ) * numFrames );
+   benchmark->drawTime = malloc ( sizeof ( double ) * numFrames );
+   benchmark->swapTime = malloc ( sizeof ( double ) * numFrames );
+   benchmark->frameTime = malloc ( sizeof ( double ) * numFrames );
+
+   if ( benchmark->updateTime == NULL || benchmark->drawTime == NULL ||
+         benchmark->swapTime == NULL || benchmark->frameTime == NULL )
+   {
+      esLog ( ES_LOG_ERROR, "Out of memory for %d benchmark frames\n", numFrames );
+      esBenchmarkDestroy ( benchmark );
+      return NULL;
+   }
+
+   return benchmark;
+}
+
+///
+// esBenchmarkRecord()
+//
+//    Record the times of frame number 'frame' (counting warm-up frames).
+//    frameStart and frameEnd bracket the whole frame including event handling.
+//
+void esBenchmarkRecord ( ESBenchmark *benchmark, int frame, double frameStart, double frameEnd,
+                         double updateTime, double drawTime, double swapTime )
+{
+   int index = frame - benchmark->numWarmupFrames;
+
+   if ( index < 0 || index >= benchmark->numFrames )
+   {
+      return;
+   }
+
+   if ( index == 0 )
+   {
+      benchmark->startTime = frameStart;
+   }
+
+   benchmark->endTime = frameEnd;
+   benchmark->updateTime[index] = updateTime;
+   benchmark->drawTime[index] = drawTime;
+   benchmark->swapTime[index] = swapTime;
+   benchmark->frameTime[index] = frameEnd - frameStart;
+   benchmark->numRecorded = index + 1;
+}
+
+///
+// esBenchmarkRecordQueueDepth()
+//
+//    Record how many frames were queued when frame 'frame' started, with
+//    the frames-in-flight limit in effect (0 for none)
+//
+void esBenchmarkRecordQueueDepth ( ESBenchmark *benchmark, int frame, int depth, int limit )
+{
+   int index = frame - benchmark->numWarmupFrames;
+
+   if ( index < 0 || index >= benchmark->numFrames )
+   {
+      return;
+   }
+
+   if ( benchmark->queueDepth == NULL )
+   {
+      benchmark->queueDepth = calloc ( benchmark->numFrames, sizeof ( int ) );
+
+      // Reported without queue depths
+      if ( benchmark->queueDepth == NULL )
+      {
+         return;
+      }
+   }
+
+   benchmark->queueDepth[index] = depth;
+   benchmark->queueLimit = limit;
+}
+
+///
+// esBenchmarkHashFramebuffer()
+//
+//    Compute a 64-bit difference hash of the frame about to be presented:
+//    the luminance is box-filtered down to 9x8 cells and every bit tells
+//    whether a cell is brighter than its right neighbour.  Similar
+//    images give hashes a few bits apart, so small rasterization
+//    differences between drivers do not count as regressions.
+//
+void esBenchmarkHashFramebuffer ( ESBenchmark *benchmark, ESContext *esContext )
+{
+   int width = esContext->width;
+   int height = esContext->height;
+   unsigned char *pixels = malloc ( ( size_t ) width * height * 4 );
+   double cells[8][9];
+   int x, y;
+
+   if ( pixels == NULL || width < 9 || height < 8 )
+   {
+      free ( pixels );
+      return;
+   }
+
+   // The presented frame, not what the sample left bound for reading
+   esReadFramePixels ( width, height, pixels );
+
+   memset ( cells, 0, sizeof ( cells ) );
+
+   for ( y = 0; y < height; y++ )
+   {
+      const unsigned char *row = pixels + ( size_t ) y * width * 4;
+      int cellY = y * 8 / height;
+
+      for ( x = 0; x < width; x++ )
+      {
+         cells[cellY][x * 9 / width] += 0.299 * row[x * 4] + 0.587 * row[x * 4 + 1] + 0.114 * row[x * 4 + 2];
+      }
+   }
+
+   benchmark->hash = 0;
+
+   for ( y = 0; y < 8; y++ )
+   {
+      for ( x = 0; x < 8; x++ )
+      {
+         // Cells of one row differ in width by at most a pixel column, compare averages
+         double left = cells[y][x] / ( ( ( x + 1 ) * width + 8 ) / 9 - ( x * width + 8 ) / 9 );
+         double right = cells[y][x + 1] / ( ( ( x + 2 ) * width + 8 ) / 9 - ( ( x + 1 ) * width + 8 ) / 9 );
+
+         benchmark->hash = ( benchmark->hash << 1 ) | ( left > right );
+      }
+   }
+
+   benchmark->hashValid = GL_TRUE;
+   free ( pixels );
+}
+
+///
+// esBenchmarkReport()
+//
+//    Write the statistics as one line of JSON to fileName, or to stdout if
+//    fileName is NULL.  All times are in milliseconds.
+//
+void esBenchmarkReport ( ESBenchmark *benchmark, ESContext *esContext, const char *fileName )
+{
+   FILE *fp = stdout;
+   char line[1024];
+   char name[256];
+   int len;
+   int count = benchmark->numRecorded;
+   double elapsed = benchmark->endTime - benchmark->startTime;
+
+   if ( count == 0 )
+   {
+      esLogMessage ( "Benchmark ended before any measured frames\n" );
+      return;
+   }
+
+   EscapeJson ( name, sizeof ( name ), esContext->options.name != NULL ? esContext->options.name : "" );
+
+   // Build the whole line first and write it with a single call so reports
+   // of contexts running on other threads do not interleave
+   len = snprintf ( line, sizeof ( line ),
+                    "{\"name\":\"%s\",\"context\":%d,\"width\":%d,\"height\":%d,\"offscreen\":%s,"
+                    "\"warmupFrames\":%d,\"frames\":%d,\"seconds\":%.6f,\"fps\":%.3f",
+                    name,
+                    esContext->options.contextIndex,
+                    esContext->width, esContext->height,
+                    ( esContext->flags & ES_WINDOW_OFFSCREEN ) ? "true" : "false",
+                    benchmark->numWarmupFrames, count, elapsed,
+                    elapsed > 0.0 ? count / elapsed : 0.0 );
+   len = Appended ( 0, len, sizeof ( line ) );
+   len = Appended ( len, PrintStats ( line + len, sizeof ( line ) - len, "frame", benchmark->frameTime, count ),
+                    sizeof ( line ) );
+   len = Appended ( len, PrintStats ( line + len, sizeof ( line ) - len, "update", benchmark->updateTime, count ),
+                    sizeof ( line ) );
+   len = Appended ( len, PrintStats ( line + len, sizeof ( line ) - len, "draw", benchmark->drawTime, count ),
+                    sizeof ( line ) );
+   len = Appended ( len, PrintStats ( line + len, sizeof ( line ) - len, "swap", benchmark->swapTime, count ),
+                    sizeof ( line ) );
+
+   if ( benchmark->queueDepth != NULL )
+   {
+      int maxDepth = 0;
+      int sum = 0;
+      int i;
+
+      for ( i = 0; i < count; i++ )
+      {
+         sum += benchmark->queueDepth[i];
+
+         if ( benchmark->queueDepth[i] > maxDepth )
+         {
+            maxDepth = benchmark->queueDepth[i];
+         }
+      }
+
+      len = Appended ( len, snprintf ( line + len, sizeof ( line ) - len,
+                                       ",\"queueDepth\":{\"limit\":%d,\"mean\":%.3f,\"max\":%d}",
+                                       benchmark->queueLimit, ( double ) sum / count, maxDepth ),
+                       sizeof ( line ) );
+   }
+
+   if ( benchmark->hashValid )
+   {
+      len = Appended ( len, snprintf ( line + len, sizeof ( line ) - len, ",\"hash\":\"%016llx\"", benchmark->hash ),
+                       sizeof ( line ) );
+   }
+   len = Appended ( len, snprintf ( line + len, sizeof ( line ) - len, "}\n" ), sizeof ( line ) );
+
+   // The name is cut to leave room, but a cut short report is not valid JSON
+   if ( len == ( int ) sizeof ( line ) - 1 )
+   {
+      esLog ( ES_LOG_WARNING, "Benchmark report was cut short at %d characters\n", len );
+   }
+
+   if ( fileName != NULL )
+   {
+      // With several contexts every context appends its own line to the
+      // report, which main() truncates before the contexts start
+      fp = fopen ( fileName, esContext->options.numContexts > 1 ? "a" : "w" );
+
+      if ( fp == NULL )
+      {
+         esLog ( ES_LOG_ERROR, "Could not open benchmark report %s\n", fileName );
+         return;
+      }
+   }
+
+   fwrite ( line, 1, len, fp );
+
+   if ( fp != stdout )
+   {
+      fclose ( fp );
+   }
+   else
+   {
+      fflush ( fp );
+   }
+}
+
+///
+// esBenchmarkDestroy()
+//
+void esBenchmarkDestroy ( ESBenchmark *benchmark )
+{
+   if ( benchmark == NULL )
+   {
+      return;
+   }
+
+   free ( benchmark->updateTime );
+   free ( benchmark->drawTime );
+   free ( benchmark->swapTime );
+   free ( benchmark->frameTime );
+   free ( benchmark->queueDepth );
+   free ( benchmark );
+}
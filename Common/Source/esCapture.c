@@ -0,0 +1,517 @@
+// The MIT License (MIT)
+//
+// Copyright (c) 2013 Dan Ginsburg, Budirijanto Purnomo
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+
+//
+// Book:      OpenGL(R) ES 3.0 Programming Guide, 2nd Edition
+// Authors:   Dan Ginsburg, Budirijanto Purnomo, Dave Shreiner, Aaftab Munshi
+// ISBN-10:   0-321-93388-5
+// ISBN-13:   978-0-321-93388-1
+// Publisher: Addison-Wesley Professional
+// URLs:      http://www.opengles-book.com
+//            http://my.safaribooksonline.com/book/animation-and-3d/9780133440133
+//
+// ESCapture.c
+//
+//    Frame capture for offline rendering.  Every frame is read back into
+//    one of a ring of pixel pack buffers and fenced; the buffer is mapped a
+//    few frames later, once the GPU is done with it, so glReadPixels never
+//    waits for the frame to finish.  A writer thread converts the frames
+//    and streams them to disk as raw RGBA, PPM or YUV4MPEG2.
+//
+
+///
+//  Includes
+//
+#include "esUtil.h"
+#include "esUtil_win.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifndef _WIN32
+#include <pthread.h>
+#endif
+
+///
+//  Macros
+//
+
+// Pack buffers in flight, a frame is mapped this many frames after it was read
+#define ES_CAPTURE_PBOS          3
+
+// Frames waiting for the writer before the GL thread has to wait for it
+#define ES_CAPTURE_QUEUE         4
+
+// How long one wait on a readback fence may take, in ns
+#define ES_CAPTURE_FENCE_TIMEOUT 1000000000ull
+
+// Output formats
+#define ES_CAPTURE_RAW           0
+#define ES_CAPTURE_PPM           1
+#define ES_CAPTURE_Y4M           2
+
+///
+//  Types
+//
+struct ESCapture
+{
+   ESContext  *esContext;
+   FILE       *fp;
+   int         format;
+   int         width;
+   int         height;
+   int         frameRate;
+   size_t      frameSize;
+
+   // Readback ring, 'first' is the oldest of 'count' frames in flight
+   GLuint      pbos[ES_CAPTURE_PBOS];
+   GLsync      fences[ES_CAPTURE_PBOS];
+   int         first;
+   int         count;
+
+   // Frames handed to the writer, 'head' is the next one it writes.  The
+   // buffers of the other ES_CAPTURE_QUEUE - queued frames are free.
+   unsigned char *frames[ES_CAPTURE_QUEUE];
+   int         head;
+   int         queued;
+
+   // Scratch row or planes for the conversion, writer only
+   unsigned char *scratch;
+
+   int         numFrames;
+   GLboolean   failed;
+
+#ifndef _WIN32
+   pthread_t         thread;
+   pthread_mutex_t   mutex;
+   pthread_cond_t    cond;
+
+   // Set when the writer should exit once the queue is empty
+   int               quit;
+#endif
+};
+
+//////////////////////////////////////////////////////////////////
+//
+//  Private Functions
+//
+//
+
+///
+// WriteFrame()
+//
+//    Convert one bottom-up RGBA frame and append it to the stream
+//
+static void WriteFrame ( ESCapture *capture, const unsigned char *pixels )
+{
+   int width = capture->width;
+   int height = capture->height;
+   size_t stride = ( size_t ) width * 4;
+   size_t written = 0;
+   size_t expected = 0;
+   int x, y;
+
+   if ( capture->format == ES_CAPTURE_RAW )
+   {
+      for ( y = height - 1; y >= 0; y-- )
+      {
+         written += fwrite ( pixels + y * stride, 1, stride, capture->fp );
+      }
+
+      expected = stride * height;
+   }
+   else if ( capture->format == ES_CAPTURE_PPM )
+   {
+      fprintf ( capture->fp, "P6\n%d %d\n255\n", width, height );
+
+      for ( y = height - 1; y >= 0; y-- )
+      {
+         const unsigned char *src = pixels + y * stride;
+         unsigned char *dst = capture->scratch;
+
+         for ( x = 0; x < width; x++ )
+         {
+            *dst++ = src[0];
+            *dst++ = src[1];
+            *dst++ = src[2];
+            src += 4;
+         }
+
+         written += fwrite ( capture->scratch, 1, ( size_t ) width * 3, capture->fp );
+      }
+
+      expected = ( size_t ) width * 3 * height;
+   }
+   else
+   {
+      // 4:4:4 planes, BT.601 studio range
+      size_t planeSize = ( size_t ) width * height;
+      unsigned char *planeY = capture->scratch;
+      unsigned char *planeU = planeY + planeSize;
+      unsigned char *planeV = planeU + planeSize;
+
+      for ( y = 0; y < height; y++ )
+      {
+         const unsigned char *src = pixels + ( height - 1 - y ) * stride;
+
+         for ( x = 0; x < width; x++ )
+         {
+            int r = src[0];
+            int g = src[1];
+            int b = src[2];
+
+            *planeY++ = ( unsigned char ) ( ( ( 66 * r + 129 * g + 25 * b + 128 ) >> 8 ) + 16 );
+            *planeU++ = ( unsigned char ) ( ( ( -38 * r - 74 * g + 112 * b + 128 ) >> 8 ) + 128 );
+            *planeV++ = ( unsigned char ) ( ( ( 112 * r - 94 * g - 18 * b + 128 ) >> 8 ) + 128 );
+            src += 4;
+         }
+      }
+
+      fputs ( "FRAME\n", capture->fp );
+      written = fwrite ( capture->scratch, 1, planeSize * 3, capture->fp );
+      expected = planeSize * 3;
+   }
+
+   if ( written != expected && !capture->failed )
+   {
+      esLog ( ES_LOG_ERROR, "Capture stream write failed after %d frames\n", capture->numFrames );
+      capture->failed = GL_TRUE;
+   }
+
+   capture->numFrames++;
+}
+
+#ifndef _WIN32
+///
+// WriterThread()
+//
+static void *WriterThread ( void *arg )
+{
+   ESCapture *capture = ( ESCapture * ) arg;
+
+   pthread_mutex_lock ( &capture->mutex );
+
+   for ( ;; )
+   {
+      while ( capture->queued == 0 && !capture->quit )
+      {
+         pthread_cond_wait ( &capture->cond, &capture->mutex );
+      }
+
+      if ( capture->queued == 0 )
+      {
+         break;
+      }
+
+      pthread_mutex_unlock ( &capture->mutex );
+      WriteFrame ( capture, capture->frames[capture->head] );
+      pthread_mutex_lock ( &capture->mutex );
+
+      capture->head = ( capture->head + 1 ) % ES_CAPTURE_QUEUE;
+      capture->queued--;
+      pthread_cond_broadcast ( &capture->cond );
+   }
+
+   pthread_mutex_unlock ( &capture->mutex );
+   return NULL;
+}
+#endif
+
+///
+// RetireOldest()
+//
+//    Map the oldest readback, copy it into a free frame of the writer queue
+//    and recycle its pack buffer.  Waits for the GPU only if 'wait' is set,
+//    so it returns GL_FALSE only for an unfinished readback without 'wait'.
+//
+static GLboolean RetireOldest ( ESCapture *capture, GLboolean wait )
+{
+   GLsync fence = capture->fences[capture->first];
+   unsigned char *frame;
+   void *pixels;
+   GLenum result;
+
+   do
+   {
+      result = glClientWaitSync ( fence, wait ? GL_SYNC_FLUSH_COMMANDS_BIT : 0,
+                                  wait ? ES_CAPTURE_FENCE_TIMEOUT : 0 );
+   }
+   while ( wait && result == GL_TIMEOUT_EXPIRED );
+
+   if ( result == GL_TIMEOUT_EXPIRED )
+   {
+      return GL_FALSE;
+   }
+
+   if ( result == GL_WAIT_FAILED )
+   {
+      // The pack buffer can still be recycled, only this frame is lost
+      esLog ( ES_LOG_ERROR, "Capture readback fence failed, frame dropped\n" );
+      glDeleteSync ( fence );
+      capture->first = ( capture->first + 1 ) % ES_CAPTURE_PBOS;
+      capture->count--;
+      return GL_TRUE;
+   }
+
+#ifndef _WIN32
+   // Offline rendering must not lose frames, wait for the writer to catch up
+   pthread_mutex_lock ( &capture->mutex );
+
+   while ( capture->queued == ES_CAPTURE_QUEUE )
+   {
+      pthread_cond_wait ( &capture->cond, &capture->mutex );
+   }
+
+   frame = capture->frames[( capture->head + capture->queued ) % ES_CAPTURE_QUEUE];
+   pthread_mutex_unlock ( &capture->mutex );
+#else
+   frame = capture->frames[0];
+#endif
+
+   esBindBuffer ( capture->esContext, GL_PIXEL_PACK_BUFFER, capture->pbos[capture->first] );
+   pixels = glMapBufferRange ( GL_PIXEL_PACK_BUFFER, 0, capture->frameSize, GL_MAP_READ_BIT );
+
+   if ( pixels != NULL )
+   {
+      memcpy ( frame, pixels, capture->frameSize );
+      glUnmapBuffer ( GL_PIXEL_PACK_BUFFER );
+   }
+
+   esBindBuffer ( capture->esContext, GL_PIXEL_PACK_BUFFER, 0 );
+
+   glDeleteSync ( fence );
+   capture->first = ( capture->first + 1 ) % ES_CAPTURE_PBOS;
+   capture->count--;
+
+   if ( pixels == NULL )
+   {
+      return GL_TRUE;
+   }
+
+#ifndef _WIN32
+   pthread_mutex_lock ( &capture->mutex );
+   capture->queued++;
+   pthread_cond_broadcast ( &capture->cond );
+   pthread_mutex_unlock ( &capture->mutex );
+#else
+   WriteFrame ( capture, frame );
+#endif
+
+   return GL_TRUE;
+}
+
+//////////////////////////////////////////////////////////////////
+//
+//  Public Functions
+//
+//
+
+///
+// esCaptureCreate()
+//
+//    Open the capture stream.  The format follows the file extension:
+//    .ppm for concatenated binary PPM images, .y4m for YUV4MPEG2 and raw
+//    top-down RGBA for anything else.
+//
+ESCapture *esCaptureCreate ( ESContext *esContext, const char *fileName )
+{
+   ESCapture *capture;
+   const char *extension = strrchr ( fileName, '.' );
+   size_t scratchSize;
+   int i;
+
+   capture = calloc ( 1, sizeof ( ESCapture ) );
+
+   if ( capture == NULL )
+   {
+      return NULL;
+   }
+
+   capture->esContext = esContext;
+   capture->width = esContext->width;
+   capture->height = esContext->height;
+   capture->frameSize = ( size_t ) capture->width * capture->height * 4;
+   capture->format = ES_CAPTURE_RAW;
+   capture->frameRate = 60;
+
+   if ( esContext->options.fixedDeltaTime > 0.0f )
+   {
+      capture->frameRate = ( int ) ( 1.0f / esContext->options.fixedDeltaTime + 0.5f );
+   }
+
+   if ( extension != NULL && strcmp ( extension, ".ppm" ) == 0 )
+   {
+      capture->format = ES_CAPTURE_PPM;
+   }
+   else if ( extension != NULL && strcmp ( extension, ".y4m" ) == 0 )
+   {
+      capture->format = ES_CAPTURE_Y4M;
+   }
+
+   // Not stdout, log messages and the benchmark report go there
+   capture->fp = fopen ( fileName, "wb" );
+
+   if ( capture->fp == NULL )
+   {
+      esLog ( ES_LOG_ERROR, "Could not create capture file %s\n", fileName );
+      free ( capture );
+      return NULL;
+   }
+
+   if ( capture->format == ES_CAPTURE_Y4M )
+   {
+      fprintf ( capture->fp, "YUV4MPEG2 W%d H%d F%d:1 Ip A1:1 C444\n",
+                capture->width, capture->height, capture->frameRate );
+   }
+
+   scratchSize = capture->format == ES_CAPTURE_Y4M ? ( size_t ) capture->width * capture->height * 3 :
+                 ( size_t ) capture->width * 3;
+   capture->scratch = malloc ( scratchSize );
+
+   for ( i = 0; i < ES_CAPTURE_QUEUE; i++ )
+   {
+      capture->frames[i] = malloc ( capture->frameSize );
+
+      if ( capture->frames[i] == NULL )
+      {
+         break;
+      }
+   }
+
+   if ( capture->scratch == NULL || i < ES_CAPTURE_QUEUE )
+   {
+      esLog ( ES_LOG_ERROR, "Out of memory for the capture frames\n" );
+#ifndef _WIN32
+      // There is no writer to stop
+      capture->quit = -1;
+#endif
+      esCaptureDestroy ( capture );
+      return NULL;
+   }
+
+   glGenBuffers ( ES_CAPTURE_PBOS, capture->pbos );
+
+   for ( i = 0; i < ES_CAPTURE_PBOS; i++ )
+   {
+      esBindBuffer ( esContext, GL_PIXEL_PACK_BUFFER, capture->pbos[i] );
+      glBufferData ( GL_PIXEL_PACK_BUFFER, capture->frameSize, NULL, GL_STREAM_READ );
+   }
+
+   esBindBuffer ( esContext, GL_PIXEL_PACK_BUFFER, 0 );
+
+#ifndef _WIN32
+   pthread_mutex_init ( &capture->mutex, NULL );
+   pthread_cond_init ( &capture->cond, NULL );
+
+   if ( pthread_create ( &capture->thread, NULL, WriterThread, capture ) != 0 )
+   {
+      esLog ( ES_LOG_ERROR, "Could not start the capture writer thread\n" );
+      pthread_cond_destroy ( &capture->cond );
+      pthread_mutex_destroy ( &capture->mutex );
+      // There is no writer to stop
+      capture->quit = -1;
+      esCaptureDestroy ( capture );
+      return NULL;
+   }
+#endif
+
+   return capture;
+}
+
+///
+// esCaptureFrame()
+//
+//    Queue the readback of the frame just drawn.  Call after the draw
+//    callback and before the swap, while the back buffer holds the frame.
+//
+void esCaptureFrame ( ESCapture *capture )
+{
+   int slot;
+
+   // Hand every finished readback to the writer, oldest first
+   while ( capture->count > 0 && RetireOldest ( capture, GL_FALSE ) )
+   {
+   }
+
+   // All pack buffers busy, the GPU is ES_CAPTURE_PBOS frames behind
+   if ( capture->count == ES_CAPTURE_PBOS )
+   {
+      RetireOldest ( capture, GL_TRUE );
+   }
+
+   slot = ( capture->first + capture->count ) % ES_CAPTURE_PBOS;
+
+   // The presented frame, not whatever the sample left bound for reading
+   esBindBuffer ( capture->esContext, GL_PIXEL_PACK_BUFFER, capture->pbos[slot] );
+   esReadFramePixels ( capture->width, capture->height, 0 );
+   esBindBuffer ( capture->esContext, GL_PIXEL_PACK_BUFFER, 0 );
+
+   capture->fences[slot] = glFenceSync ( GL_SYNC_GPU_COMMANDS_COMPLETE, 0 );
+   capture->count++;
+}
+
+///
+// esCaptureDestroy()
+//
+//    Write out the frames still in flight and close the stream
+//
+void esCaptureDestroy ( ESCapture *capture )
+{
+   int i;
+
+   if ( capture == NULL )
+   {
+      return;
+   }
+
+   while ( capture->count > 0 )
+   {
+      RetireOldest ( capture, GL_TRUE );
+   }
+
+#ifndef _WIN32
+   if ( capture->quit == 0 )
+   {
+      pthread_mutex_lock ( &capture->mutex );
+      capture->quit = 1;
+      pthread_cond_broadcast ( &capture->cond );
+      pthread_mutex_unlock ( &capture->mutex );
+
+      pthread_join ( capture->thread, NULL );
+      pthread_cond_destroy ( &capture->cond );
+      pthread_mutex_destroy ( &capture->mutex );
+   }
+#endif
+
+   esDeleteBuffers ( capture->esContext, ES_CAPTURE_PBOS, capture->pbos );
+
+   for ( i = 0; i < ES_CAPTURE_QUEUE; i++ )
+   {
+      free ( capture->frames[i] );
+   }
+
+   free ( capture->scratch );
+
+   fclose ( capture->fp );
+
+   free ( capture );
+}
@@ -0,0 +1,261 @@
+// The MIT License (MIT)
+//
+// Copyright (c) 2013 Dan Ginsburg, Budirijanto Purnomo
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+
+//
+// Book:      OpenGL(R) ES 3.0 Programming Guide, 2nd Edition
+// Authors:   Dan Ginsburg, Budirijanto Purnomo, Dave Shreiner, Aaftab Munshi
+// ISBN-10:   0-321-93388-5
+// ISBN-13:   978-0-321-93388-1
+// Publisher: Addison-Wesley Professional
+// URLs:      http://www.opengles-book.com
+//            http://my.safaribooksonline.com/book/animation-and-3d/9780133440133
+//
+// ESClock.c
+//
+//    Clock sources for the main loop.  The delta time handed to the update
+//    callback comes from the monotonic wall clock, a fixed time step, or a
+//    trace recorded by an earlier run, so benchmark runs can replay exactly
+//    the same workload.
+//
+
+///
+//  Includes
+//
+#include "esUtil.h"
+#include "esUtil_win.h"
+#include <stdio.h>
+#include <stdlib.h>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#else
+#include <time.h>
+#endif
+
+///
+//  Types
+//
+struct ESClock
+{
+   // Fixed time step in seconds, 0 for wall clock
+   float    fixedDeltaTime;
+
+   // Trace of delta times to replay, one value per frame
+   float   *trace;
+   int      traceLength;
+   int      tracePos;
+
+   // Trace file delta times are recorded to
+   FILE    *recordFile;
+
+   // Time of the previous call to esClockDeltaTime()
+   double   lastTime;
+};
+
+//////////////////////////////////////////////////////////////////
+//
+//  Private Functions
+//
+//
+
+///
+// LoadTrace()
+//
+//    Read a text file with one delta time in seconds per line
+//
+static GLboolean LoadTrace ( ESClock *clock, const char *fileName )
+{
+   FILE *fp = fopen ( fileName, "r" );
+   int capacity = 256;
+   float deltaTime;
+
+   if ( fp == NULL )
+   {
+      esLog ( ES_LOG_ERROR, "Could not open delta time trace %s\n", fileName );
+      return GL_FALSE;
+   }
+
+   clock->trace = malloc ( sizeof ( float ) * capacity );
+
+   if ( clock->trace == NULL )
+   {
+      esLog ( ES_LOG_ERROR, "Out of memory for delta time trace %s\n", fileName );
+      fclose ( fp );
+      return GL_FALSE;
+   }
+
+   while ( fscanf ( fp, "%f", &deltaTime ) == 1 )
+   {
+      if ( clock->traceLength == capacity )
+      {
+         float *trace = realloc ( clock->trace, sizeof ( float ) * capacity * 2 );
+
+         if ( trace == NULL )
+         {
+            esLog ( ES_LOG_ERROR, "Out of memory for delta time trace %s\n", fileName );
+            fclose ( fp );
+            return GL_FALSE;
+         }
+
+         clock->trace = trace;
+         capacity *= 2;
+      }
+
+      clock->trace[clock->traceLength++] = deltaTime;
+   }
+
+   fclose ( fp );
+
+   if ( clock->traceLength == 0 )
+   {
+      esLog ( ES_LOG_ERROR, "Delta time trace %s is empty\n", fileName );
+      return GL_FALSE;
+   }
+
+   return GL_TRUE;
+}
+
+//////////////////////////////////////////////////////////////////
+//
+//  Public Functions
+//
+//
+
+///
+// esGetTime()
+//
+//    Monotonic time in seconds
+//
+double esGetTime ( void )
+{
+#ifdef _WIN32
+   LARGE_INTEGER frequency;
+   LARGE_INTEGER counter;
+
+   QueryPerformanceFrequency ( &frequency );
+   QueryPerformanceCounter ( &counter );
+   return ( double ) counter.QuadPart / ( double ) frequency.QuadPart;
+#else
+   struct timespec ts;
+
+   clock_gettime ( CLOCK_MONOTONIC, &ts );
+   return ( double ) ts.tv_sec + ( double ) ts.tv_nsec * 1e-9;
+#endif
+}
+
+///
+// esClockCreate()
+//
+//    Create the clock source selected by the run options.  Returns NULL if a
+//    trace file cannot be read or written, or out of memory.
+//
+ESClock *esClockCreate ( const ESOptions *options )
+{
+   ESClock *clock = calloc ( 1, sizeof ( ESClock ) );
+
+   if ( clock == NULL )
+   {
+      esLog ( ES_LOG_ERROR, "Out of memory for the clock\n" );
+      return NULL;
+   }
+
+   clock->fixedDeltaTime = options->fixedDeltaTime;
+
+   if ( options->replayFile != NULL && !LoadTrace ( clock, options->replayFile ) )
+   {
+      esClockDestroy ( clock );
+      return NULL;
+   }
+
+   // Contexts run side by side would overwrite each other's trace, only the
+   // first records, as only the first captures
+   if ( options->recordFile != NULL && options->contextIndex == 0 )
+   {
+      clock->recordFile = fopen ( options->recordFile, "w" );
+
+      if ( clock->recordFile == NULL )
+      {
+         esLog ( ES_LOG_ERROR, "Could not create delta time trace %s\n", options->recordFile );
+         esClockDestroy ( clock );
+         return NULL;
+      }
+   }
+
+   clock->lastTime = esGetTime ( );
+
+   return clock;
+}
+
+///
+// esClockDeltaTime()
+//
+//    Delta time for the next update.  A replayed trace wraps around when
+//    the run is longer than the recording.
+//
+float esClockDeltaTime ( ESClock *clock )
+{
+   double now = esGetTime ( );
+   float deltaTime;
+
+   if ( clock->trace != NULL )
+   {
+      deltaTime = clock->trace[clock->tracePos];
+      clock->tracePos = ( clock->tracePos + 1 ) % clock->traceLength;
+   }
+   else if ( clock->fixedDeltaTime > 0.0f )
+   {
+      deltaTime = clock->fixedDeltaTime;
+   }
+   else
+   {
+      deltaTime = ( float ) ( now - clock->lastTime );
+   }
+
+   clock->lastTime = now;
+
+   if ( clock->recordFile != NULL )
+   {
+      fprintf ( clock->recordFile, "%.9g\n", deltaTime );
+   }
+
+   return deltaTime;
+}
+
+///
+// esClockDestroy()
+//
+void esClockDestroy ( ESClock *clock )
+{
+   if ( clock == NULL )
+   {
+      return;
+   }
+
+   if ( clock->recordFile != NULL )
+   {
+      fclose ( clock->recordFile );
+   }
+
+   free ( clock->trace );
+   free ( clock );
+}
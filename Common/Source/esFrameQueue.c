@@ -0,0 +1,185 @@
+// The MIT License (MIT)
+//
+// Copyright (c) 2013 Dan Ginsburg, Budirijanto Purnomo
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+
+//
+// Book:      OpenGL(R) ES 3.0 Programming Guide, 2nd Edition
+// Authors:   Dan Ginsburg, Budirijanto Purnomo, Dave Shreiner, Aaftab Munshi
+// ISBN-10:   0-321-93388-5
+// ISBN-13:   978-0-321-93388-1
+// Publisher: Addison-Wesley Professional
+// URLs:      http://www.opengles-book.com
+//            http://my.safaribooksonline.com/book/animation-and-3d/9780133440133
+//
+// ESFrameQueue.c
+//
+//    Bounds the number of frames the driver may queue ahead of the GPU.  A
+//    fence is inserted after every swap; before a new frame is drawn the
+//    loop waits for the oldest fence once the limit is reached, so input
+//    applied in update shows up at most that many frames later.  The fences
+//    also measure how many frames were still in flight at each frame start.
+//
+
+///
+//  Includes
+//
+#include "esUtil.h"
+#include "esUtil_win.h"
+#include <stdlib.h>
+
+///
+//  Macros
+//
+
+// Most frames tracked at once, also the limit used when only measuring
+#define ES_MAX_FRAMES_IN_FLIGHT  8
+
+// How long one wait on a fence may take before it is given up, in ns
+#define ES_FRAME_FENCE_TIMEOUT   1000000000ull
+
+///
+//  Types
+//
+struct ESFrameQueue
+{
+   // Allowed frames in flight, 0 to only measure
+   int         maxFramesInFlight;
+
+   // Fences of the frames in flight, oldest at 'first'
+   GLsync      fences[ES_MAX_FRAMES_IN_FLIGHT];
+   int         first;
+   int         count;
+};
+
+//////////////////////////////////////////////////////////////////
+//
+//  Private Functions
+//
+//
+
+///
+// PopFence()
+//
+//    Forget the oldest fence
+//
+static void PopFence ( ESFrameQueue *queue )
+{
+   glDeleteSync ( queue->fences[queue->first] );
+   queue->first = ( queue->first + 1 ) % ES_MAX_FRAMES_IN_FLIGHT;
+   queue->count--;
+}
+
+//////////////////////////////////////////////////////////////////
+//
+//  Public Functions
+//
+//
+
+///
+// esFrameQueueCreate()
+//
+//    Limit the queue to maxFramesInFlight frames, or only measure its depth
+//    if maxFramesInFlight is 0
+//
+ESFrameQueue *esFrameQueueCreate ( int maxFramesInFlight )
+{
+   ESFrameQueue *queue = calloc ( 1, sizeof ( ESFrameQueue ) );
+
+   if ( queue == NULL )
+   {
+      return NULL;
+   }
+
+   if ( maxFramesInFlight > ES_MAX_FRAMES_IN_FLIGHT )
+   {
+      maxFramesInFlight = ES_MAX_FRAMES_IN_FLIGHT;
+   }
+
+   queue->maxFramesInFlight = maxFramesInFlight;
+   return queue;
+}
+
+///
+// esFrameQueueBegin()
+//
+//    Call before drawing a frame.  Returns the number of earlier frames the
+//    GPU had not finished, then waits until fewer than the limit remain.
+//
+int esFrameQueueBegin ( ESFrameQueue *queue )
+{
+   int depth;
+
+   // Fences signal in order, the first unsignaled one ends the finished frames
+   while ( queue->count > 0 &&
+           glClientWaitSync ( queue->fences[queue->first], 0, 0 ) != GL_TIMEOUT_EXPIRED )
+   {
+      PopFence ( queue );
+   }
+
+   depth = queue->count;
+
+   if ( queue->maxFramesInFlight > 0 )
+   {
+      while ( queue->count >= queue->maxFramesInFlight )
+      {
+         glClientWaitSync ( queue->fences[queue->first], GL_SYNC_FLUSH_COMMANDS_BIT, ES_FRAME_FENCE_TIMEOUT );
+         PopFence ( queue );
+      }
+   }
+
+   return depth;
+}
+
+///
+// esFrameQueueEnd()
+//
+//    Call after the frame was swapped
+//
+void esFrameQueueEnd ( ESFrameQueue *queue )
+{
+   // Measuring only, stop tracking frames beyond what the ring holds
+   if ( queue->count == ES_MAX_FRAMES_IN_FLIGHT )
+   {
+      PopFence ( queue );
+   }
+
+   queue->fences[( queue->first + queue->count ) % ES_MAX_FRAMES_IN_FLIGHT] =
+      glFenceSync ( GL_SYNC_GPU_COMMANDS_COMPLETE, 0 );
+   queue->count++;
+}
+
+///
+// esFrameQueueDestroy()
+//
+void esFrameQueueDestroy ( ESFrameQueue *queue )
+{
+   if ( queue == NULL )
+   {
+      return;
+   }
+
+   while ( queue->count > 0 )
+   {
+      PopFence ( queue );
+   }
+
+   free ( queue );
+}
@@ -0,0 +1,594 @@
+// The MIT License (MIT)
+//
+// Copyright (c) 2013 Dan Ginsburg, Budirijanto Purnomo
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+
+//
+// Book:      OpenGL(R) ES 3.0 Programming Guide, 2nd Edition
+// Authors:   Dan Ginsburg, Budirijanto Purnomo, Dave Shreiner, Aaftab Munshi
+// ISBN-10:   0-321-93388-5
+// ISBN-13:   978-0-321-93388-1
+// Publisher: Addison-Wesley Professional
+// URLs:      http://www.opengles-book.com
+//            http://my.safaribooksonline.com/book/animation-and-3d/9780133440133
+//
+// ESLoader.c
+//
+//    Background texture loading.  Worker threads decode image files while
+//    an upload thread, current on an EGL context that shares objects with
+//    the application context, creates the textures.  Each upload is
+//    followed by a fence, and a texture is handed to the application only
+//    once its fence has signaled.  If no shared context can be created the
+//    uploads happen on the application thread instead.
+//
+
+///
+//  Includes
+//
+#include "esUtil.h"
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(_WIN32) || defined(__APPLE__)
+#define ES_LOADER_SYNCHRONOUS
+#else
+#include <pthread.h>
+#endif
+
+///
+//  Macros
+//
+#define MAX_LOADER_THREADS    8
+
+///
+//  Types
+//
+typedef enum
+{
+   REQUEST_QUEUED,
+   REQUEST_DECODING,
+   REQUEST_DECODED,
+   REQUEST_UPLOADING,
+   REQUEST_UPLOADED,
+   REQUEST_DONE,
+   REQUEST_FAILED
+} RequestState;
+
+typedef struct
+{
+   char          *fileName;
+   void          *ioContext;
+   GLenum         internalFormat;
+   GLenum         format;
+   RequestState   state;
+
+   // Decoded image
+   char          *pixels;
+   int            width;
+   int            height;
+
+   // Texture and the fence that follows its upload
+   GLuint         texture;
+   GLsync         fence;
+} LoadRequest;
+
+struct ESAsyncLoader
+{
+   ESContext     *esContext;
+
+   LoadRequest   *requests;
+   int            numRequests;
+   int            maxRequests;
+
+#ifndef ES_LOADER_SYNCHRONOUS
+   pthread_mutex_t   mutex;
+   pthread_cond_t    decodeCond;
+   pthread_cond_t    uploadCond;
+   int               quit;
+
+   pthread_t         decodeThreads[MAX_LOADER_THREADS];
+   int               numDecodeThreads;
+
+   // Upload thread and its shared context.  uploadOnCaller is set when
+   // textures have to be uploaded on the application thread instead.
+   pthread_t         uploadThread;
+   EGLContext        uploadContext;
+   EGLSurface        uploadSurface;
+   int               uploadOnCaller;
+#endif
+};
+
+//////////////////////////////////////////////////////////////////
+//
+//  Private Functions
+//
+//
+
+///
+// UploadTexture()
+//
+//    Create the texture for a decoded request on the current context.  The
+//    previous binding is restored, so the state cache of the application
+//    context stays valid when uploads run on the caller.
+//
+static void UploadTexture ( LoadRequest *request )
+{
+   GLint unpackAlignment;
+   GLint textureBinding;
+
+   glGetIntegerv ( GL_TEXTURE_BINDING_2D, &textureBinding );
+   glGetIntegerv ( GL_UNPACK_ALIGNMENT, &unpackAlignment );
+   glPixelStorei ( GL_UNPACK_ALIGNMENT, 1 );
+
+   glGenTextures ( 1, &request->texture );
+   glBindTexture ( GL_TEXTURE_2D, request->texture );
+
+   glTexImage2D ( GL_TEXTURE_2D, 0, request->internalFormat, request->width, request->height, 0,
+                  request->format, GL_UNSIGNED_BYTE, request->pixels );
+   glTexParameteri ( GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR );
+   glTexParameteri ( GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR );
+   glTexParameteri ( GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE );
+   glTexParameteri ( GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE );
+
+   glBindTexture ( GL_TEXTURE_2D, textureBinding );
+   glPixelStorei ( GL_UNPACK_ALIGNMENT, unpackAlignment );
+
+   free ( request->pixels );
+   request->pixels = NULL;
+}
+
+///
+// DecodeRequest()
+//
+static GLboolean DecodeRequest ( LoadRequest *request )
+{
+   request->pixels = esLoadTGA ( request->ioContext, request->fileName,
+                                 &request->width, &request->height );
+
+   if ( request->pixels == NULL )
+   {
+      esLog ( ES_LOG_ERROR, "Error loading (%s) image.\n", request->fileName );
+      return GL_FALSE;
+   }
+
+   return GL_TRUE;
+}
+
+#ifndef ES_LOADER_SYNCHRONOUS
+///
+// DecodeThread()
+//
+//    Decode queued requests.  The file is read with the mutex released, so
+//    several files decode in parallel.
+//
+static void *DecodeThread ( void *arg )
+{
+   ESAsyncLoader *loader = ( ESAsyncLoader * ) arg;
+
+   pthread_mutex_lock ( &loader->mutex );
+
+   while ( !loader->quit )
+   {
+      int i;
+      int index = -1;
+      LoadRequest request;
+      GLboolean decoded;
+
+      for ( i = 0; i < loader->numRequests; i++ )
+      {
+         if ( loader->requests[i].state == REQUEST_QUEUED )
+         {
+            index = i;
+            break;
+         }
+      }
+
+      if ( index < 0 )
+      {
+         pthread_cond_wait ( &loader->decodeCond, &loader->mutex );
+         continue;
+      }
+
+      // The request array may be reallocated while unlocked, work on a copy
+      loader->requests[index].state = REQUEST_DECODING;
+      request = loader->requests[index];
+
+      pthread_mutex_unlock ( &loader->mutex );
+      decoded = DecodeRequest ( &request );
+      pthread_mutex_lock ( &loader->mutex );
+
+      loader->requests[index].pixels = request.pixels;
+      loader->requests[index].width = request.width;
+      loader->requests[index].height = request.height;
+      loader->requests[index].state = decoded ? REQUEST_DECODED : REQUEST_FAILED;
+      pthread_cond_broadcast ( &loader->uploadCond );
+   }
+
+   pthread_mutex_unlock ( &loader->mutex );
+   return NULL;
+}
+
+///
+// UploadThread()
+//
+//    Upload decoded requests on the shared context and fence each upload
+//
+static void *UploadThread ( void *arg )
+{
+   ESAsyncLoader *loader = ( ESAsyncLoader * ) arg;
+   ESContext *esContext = loader->esContext;
+
+   if ( !eglMakeCurrent ( esContext->eglDisplay, loader->uploadSurface,
+                          loader->uploadSurface, loader->uploadContext ) )
+   {
+      esLog ( ES_LOG_WARNING, "Async loader could not make its context current, uploading on the application thread\n" );
+      pthread_mutex_lock ( &loader->mutex );
+      loader->uploadOnCaller = 1;
+      pthread_mutex_unlock ( &loader->mutex );
+      return NULL;
+   }
+
+   pthread_mutex_lock ( &loader->mutex );
+
+   while ( !loader->quit )
+   {
+      int i;
+      int index = -1;
+      LoadRequest request;
+
+      for ( i = 0; i < loader->numRequests; i++ )
+      {
+         if ( loader->requests[i].state == REQUEST_DECODED )
+         {
+            index = i;
+            break;
+         }
+      }
+
+      if ( index < 0 )
+      {
+         pthread_cond_wait ( &loader->uploadCond, &loader->mutex );
+         continue;
+      }
+
+      loader->requests[index].state = REQUEST_UPLOADING;
+      request = loader->requests[index];
+
+      pthread_mutex_unlock ( &loader->mutex );
+      UploadTexture ( &request );
+      request.fence = glFenceSync ( GL_SYNC_GPU_COMMANDS_COMPLETE, 0 );
+
+      // Make sure the fence reaches the GPU, the application polls it from another context
+      glFlush ( );
+      pthread_mutex_lock ( &loader->mutex );
+
+      loader->requests[index].pixels = NULL;
+      loader->requests[index].texture = request.texture;
+      loader->requests[index].fence = request.fence;
+      loader->requests[index].state = REQUEST_UPLOADED;
+   }
+
+   pthread_mutex_unlock ( &loader->mutex );
+
+   eglMakeCurrent ( esContext->eglDisplay, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT );
+   eglReleaseThread ( );
+   return NULL;
+}
+
+///
+// CreateUploadContext()
+//
+//    Create a context sharing objects with the application context.  It is
+//    made current without a surface if EGL_KHR_surfaceless_context is
+//    supported, otherwise on a 1x1 pbuffer.
+//
+static GLboolean CreateUploadContext ( ESAsyncLoader *loader )
+{
+   ESContext *esContext = loader->esContext;
+   EGLint contextAttribs[] = { EGL_CONTEXT_CLIENT_VERSION, 3, EGL_NONE };
+   EGLint pbufferAttribs[] = { EGL_WIDTH, 1, EGL_HEIGHT, 1, EGL_NONE };
+   const char *extensions = eglQueryString ( esContext->eglDisplay, EGL_EXTENSIONS );
+
+   loader->uploadContext = eglCreateContext ( esContext->eglDisplay, esContext->eglConfig,
+                                              esContext->eglContext, contextAttribs );
+
+   if ( loader->uploadContext == EGL_NO_CONTEXT )
+   {
+      return GL_FALSE;
+   }
+
+   loader->uploadSurface = EGL_NO_SURFACE;
+
+   if ( extensions == NULL || strstr ( extensions, "EGL_KHR_surfaceless_context" ) == NULL )
+   {
+      loader->uploadSurface = eglCreatePbufferSurface ( esContext->eglDisplay, esContext->eglConfig,
+                                                        pbufferAttribs );
+
+      if ( loader->uploadSurface == EGL_NO_SURFACE )
+      {
+         eglDestroyContext ( esContext->eglDisplay, loader->uploadContext );
+         loader->uploadContext = EGL_NO_CONTEXT;
+         return GL_FALSE;
+      }
+   }
+
+   return GL_TRUE;
+}
+#endif // ES_LOADER_SYNCHRONOUS
+
+//////////////////////////////////////////////////////////////////
+//
+//  Public Functions
+//
+//
+
+///
+// esCreateAsyncLoader()
+//
+ESAsyncLoader *ESUTIL_API esCreateAsyncLoader ( ESContext *esContext, int numThreads )
+{
+   ESAsyncLoader *loader = calloc ( 1, sizeof ( ESAsyncLoader ) );
+
+   if ( loader == NULL )
+   {
+      return NULL;
+   }
+
+   loader->esContext = esContext;
+
+#ifndef ES_LOADER_SYNCHRONOUS
+   pthread_mutex_init ( &loader->mutex, NULL );
+   pthread_cond_init ( &loader->decodeCond, NULL );
+   pthread_cond_init ( &loader->uploadCond, NULL );
+
+   if ( numThreads < 1 )
+   {
+      numThreads = 1;
+   }
+
+   if ( numThreads > MAX_LOADER_THREADS )
+   {
+      numThreads = MAX_LOADER_THREADS;
+   }
+
+   while ( loader->numDecodeThreads < numThreads )
+   {
+      if ( pthread_create ( &loader->decodeThreads[loader->numDecodeThreads], NULL,
+                            DecodeThread, loader ) != 0 )
+      {
+         break;
+      }
+
+      loader->numDecodeThreads++;
+   }
+
+   if ( !CreateUploadContext ( loader ) )
+   {
+      esLog ( ES_LOG_WARNING, "Async loader has no shared context, uploading on the application thread\n" );
+      loader->uploadOnCaller = 1;
+   }
+   else if ( pthread_create ( &loader->uploadThread, NULL, UploadThread, loader ) != 0 )
+   {
+      eglDestroyContext ( esContext->eglDisplay, loader->uploadContext );
+
+      if ( loader->uploadSurface != EGL_NO_SURFACE )
+      {
+         eglDestroySurface ( esContext->eglDisplay, loader->uploadSurface );
+      }
+
+      loader->uploadContext = EGL_NO_CONTEXT;
+      loader->uploadOnCaller = 1;
+   }
+#endif
+
+   return loader;
+}
+
+///
+// esAsyncLoadTexture()
+//
+int ESUTIL_API esAsyncLoadTexture ( ESAsyncLoader *loader, void *ioContext, const char *fileName,
+                                    GLenum internalFormat, GLenum format )
+{
+   LoadRequest *request;
+   char *name = malloc ( strlen ( fileName ) + 1 );
+   int index;
+
+   if ( name == NULL )
+   {
+      return -1;
+   }
+
+   strcpy ( name, fileName );
+
+#ifndef ES_LOADER_SYNCHRONOUS
+   pthread_mutex_lock ( &loader->mutex );
+#endif
+
+   if ( loader->numRequests == loader->maxRequests )
+   {
+      int maxRequests = loader->maxRequests ? loader->maxRequests * 2 : 16;
+      LoadRequest *requests = realloc ( loader->requests, sizeof ( LoadRequest ) * maxRequests );
+
+      if ( requests == NULL )
+      {
+#ifndef ES_LOADER_SYNCHRONOUS
+         pthread_mutex_unlock ( &loader->mutex );
+#endif
+         free ( name );
+         return -1;
+      }
+
+      loader->requests = requests;
+      loader->maxRequests = maxRequests;
+   }
+
+   index = loader->numRequests++;
+   request = &loader->requests[index];
+   memset ( request, 0, sizeof ( LoadRequest ) );
+
+   request->fileName = name;
+   request->ioContext = ioContext;
+   request->internalFormat = internalFormat;
+   request->format = format;
+   request->state = REQUEST_QUEUED;
+
+#ifndef ES_LOADER_SYNCHRONOUS
+   pthread_cond_broadcast ( &loader->decodeCond );
+   pthread_mutex_unlock ( &loader->mutex );
+#else
+   // No threads, load right away
+   if ( DecodeRequest ( request ) )
+   {
+      UploadTexture ( request );
+      request->state = REQUEST_DONE;
+   }
+   else
+   {
+      request->state = REQUEST_FAILED;
+   }
+#endif
+
+   return index;
+}
+
+///
+// esAsyncGetTexture()
+//
+int ESUTIL_API esAsyncGetTexture ( ESAsyncLoader *loader, int request, GLuint *texture )
+{
+   LoadRequest *req;
+   int status = ES_ASYNC_PENDING;
+
+   *texture = 0;
+
+#ifndef ES_LOADER_SYNCHRONOUS
+   pthread_mutex_lock ( &loader->mutex );
+#endif
+
+   if ( request < 0 || request >= loader->numRequests )
+   {
+#ifndef ES_LOADER_SYNCHRONOUS
+      pthread_mutex_unlock ( &loader->mutex );
+#endif
+      return ES_ASYNC_FAILED;
+   }
+
+   req = &loader->requests[request];
+
+#ifndef ES_LOADER_SYNCHRONOUS
+   if ( req->state == REQUEST_DECODED && loader->uploadOnCaller )
+   {
+      // No upload thread, upload on the calling thread
+      UploadTexture ( req );
+      req->state = REQUEST_DONE;
+   }
+   else if ( req->state == REQUEST_UPLOADED )
+   {
+      GLenum result = glClientWaitSync ( req->fence, 0, 0 );
+
+      if ( result == GL_ALREADY_SIGNALED || result == GL_CONDITION_SATISFIED )
+      {
+         glDeleteSync ( req->fence );
+         req->fence = 0;
+         req->state = REQUEST_DONE;
+      }
+   }
+#endif
+
+   if ( req->state == REQUEST_DONE )
+   {
+      *texture = req->texture;
+      status = ES_ASYNC_READY;
+   }
+   else if ( req->state == REQUEST_FAILED )
+   {
+      status = ES_ASYNC_FAILED;
+   }
+
+#ifndef ES_LOADER_SYNCHRONOUS
+   pthread_mutex_unlock ( &loader->mutex );
+#endif
+
+   return status;
+}
+
+///
+// esDestroyAsyncLoader()
+//
+void ESUTIL_API esDestroyAsyncLoader ( ESAsyncLoader *loader )
+{
+   int i;
+
+   if ( loader == NULL )
+   {
+      return;
+   }
+
+#ifndef ES_LOADER_SYNCHRONOUS
+   pthread_mutex_lock ( &loader->mutex );
+   loader->quit = 1;
+   pthread_cond_broadcast ( &loader->decodeCond );
+   pthread_cond_broadcast ( &loader->uploadCond );
+   pthread_mutex_unlock ( &loader->mutex );
+
+   for ( i = 0; i < loader->numDecodeThreads; i++ )
+   {
+      pthread_join ( loader->decodeThreads[i], NULL );
+   }
+
+   if ( loader->uploadContext != EGL_NO_CONTEXT )
+   {
+      pthread_join ( loader->uploadThread, NULL );
+      eglDestroyContext ( loader->esContext->eglDisplay, loader->uploadContext );
+
+      if ( loader->uploadSurface != EGL_NO_SURFACE )
+      {
+         eglDestroySurface ( loader->esContext->eglDisplay, loader->uploadSurface );
+      }
+   }
+
+   pthread_cond_destroy ( &loader->uploadCond );
+   pthread_cond_destroy ( &loader->decodeCond );
+   pthread_mutex_destroy ( &loader->mutex );
+#endif
+
+   // Textures handed to the application belong to it, delete the rest
+   for ( i = 0; i < loader->numRequests; i++ )
+   {
+      LoadRequest *req = &loader->requests[i];
+
+      if ( req->state != REQUEST_DONE && req->texture != 0 )
+      {
+         esDeleteTextures ( loader->esContext, 1, &req->texture );
+      }
+
+      if ( req->fence != 0 )
+      {
+         glDeleteSync ( req->fence );
+      }
+
+      free ( req->pixels );
+      free ( req->fileName );
+   }
+
+   free ( loader->requests );
+   free ( loader );
+}
@@ -0,0 +1,261 @@
+// The MIT License (MIT)
+//
+// Copyright (c) 2013 Dan Ginsburg, Budirijanto Purnomo
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+
+//
+// Book:      OpenGL(R) ES 3.0 Programming Guide, 2nd Edition
+// Authors:   Dan Ginsburg, Budirijanto Purnomo, Dave Shreiner, Aaftab Munshi
+// ISBN-10:   0-321-93388-5
+// ISBN-13:   978-0-321-93388-1
+// Publisher: Addison-Wesley Professional
+// URLs:      http://www.opengles-book.com
+//            http://my.safaribooksonline.com/book/animation-and-3d/9780133440133
+//
+// ESPipeline.c
+//
+//    Two-stage main loop pipeline.  While the GL thread draws frame N from
+//    the draw snapshot, a worker thread runs the update callback for frame
+//    N+1 into the update snapshot.  The loop flips the snapshots once both
+//    stages are done, so the callbacks never share data within a frame.
+//
+
+///
+//  Includes
+//
+#include "esUtil.h"
+#include "esUtil_win.h"
+#include <stdlib.h>
+
+#ifndef _WIN32
+#include <pthread.h>
+#endif
+
+///
+//  Types
+//
+struct ESPipeline
+{
+   ESContext  *esContext;
+
+   // Delta time of the update in flight
+   float       deltaTime;
+
+   // Time spent in the last update callback, in seconds
+   double      updateTime;
+
+#ifndef _WIN32
+   pthread_t         thread;
+   pthread_mutex_t   mutex;
+   pthread_cond_t    cond;
+
+   // Set by the GL thread to start an update, cleared by the worker when done
+   int               pending;
+   int               quit;
+#endif
+};
+
+//////////////////////////////////////////////////////////////////
+//
+//  Private Functions
+//
+//
+
+///
+// RunUpdate()
+//
+static void RunUpdate ( ESPipeline *pipeline )
+{
+   double start = esGetTime ( );
+   ESContext *esContext = pipeline->esContext;
+
+   if ( esContext->updateFunc != NULL )
+   {
+      esContext->updateFunc ( esContext, pipeline->deltaTime );
+   }
+
+   pipeline->updateTime = esGetTime ( ) - start;
+}
+
+#ifndef _WIN32
+///
+// WorkerThread()
+//
+static void *WorkerThread ( void *arg )
+{
+   ESPipeline *pipeline = ( ESPipeline * ) arg;
+
+   pthread_mutex_lock ( &pipeline->mutex );
+
+   for ( ;; )
+   {
+      while ( !pipeline->pending && !pipeline->quit )
+      {
+         pthread_cond_wait ( &pipeline->cond, &pipeline->mutex );
+      }
+
+      if ( pipeline->quit )
+      {
+         break;
+      }
+
+      pthread_mutex_unlock ( &pipeline->mutex );
+      RunUpdate ( pipeline );
+      pthread_mutex_lock ( &pipeline->mutex );
+
+      pipeline->pending = 0;
+      pthread_cond_broadcast ( &pipeline->cond );
+   }
+
+   pthread_mutex_unlock ( &pipeline->mutex );
+   return NULL;
+}
+#endif
+
+//////////////////////////////////////////////////////////////////
+//
+//  Public Functions
+//
+//
+
+///
+// esPipelineCreate()
+//
+//    Start the update worker if the application enabled the pipeline with
+//    esEnablePipeline and it was not disabled on the command line.  Returns
+//    NULL when the loop should call the update callback itself.
+//
+ESPipeline *esPipelineCreate ( ESContext *esContext )
+{
+   ESPipeline *pipeline;
+
+   if ( esContext->snapshots[0] == NULL || esContext->options.noPipeline )
+   {
+      return NULL;
+   }
+
+   pipeline = calloc ( 1, sizeof ( ESPipeline ) );
+
+   if ( pipeline == NULL )
+   {
+      esLog ( ES_LOG_WARNING, "Out of memory for the update thread, running serially\n" );
+      return NULL;
+   }
+
+   pipeline->esContext = esContext;
+
+#ifndef _WIN32
+   pthread_mutex_init ( &pipeline->mutex, NULL );
+   pthread_cond_init ( &pipeline->cond, NULL );
+
+   if ( pthread_create ( &pipeline->thread, NULL, WorkerThread, pipeline ) != 0 )
+   {
+      esLog ( ES_LOG_WARNING, "Could not start the update thread, running serially\n" );
+      pthread_cond_destroy ( &pipeline->cond );
+      pthread_mutex_destroy ( &pipeline->mutex );
+      free ( pipeline );
+      return NULL;
+   }
+#endif
+
+   // From here on update and draw use different snapshots
+   esContext->updateSnapshot = 1 - esContext->drawSnapshot;
+
+   return pipeline;
+}
+
+///
+// esPipelineBeginUpdate()
+//
+//    Start the update of the next frame into the update snapshot
+//
+void esPipelineBeginUpdate ( ESPipeline *pipeline, float deltaTime )
+{
+   pipeline->deltaTime = deltaTime;
+
+#ifndef _WIN32
+   pthread_mutex_lock ( &pipeline->mutex );
+   pipeline->pending = 1;
+   pthread_cond_broadcast ( &pipeline->cond );
+   pthread_mutex_unlock ( &pipeline->mutex );
+#else
+   RunUpdate ( pipeline );
+#endif
+}
+
+///
+// esPipelineEndUpdate()
+//
+//    Wait for the update started by esPipelineBeginUpdate and make its
+//    snapshot the one the next draw reads.  Returns the update time in seconds.
+//
+double esPipelineEndUpdate ( ESPipeline *pipeline )
+{
+   ESContext *esContext = pipeline->esContext;
+
+#ifndef _WIN32
+   pthread_mutex_lock ( &pipeline->mutex );
+
+   while ( pipeline->pending )
+   {
+      pthread_cond_wait ( &pipeline->cond, &pipeline->mutex );
+   }
+
+   pthread_mutex_unlock ( &pipeline->mutex );
+#endif
+
+   esContext->drawSnapshot = esContext->updateSnapshot;
+   esContext->updateSnapshot = 1 - esContext->drawSnapshot;
+
+   return pipeline->updateTime;
+}
+
+///
+// esPipelineDestroy()
+//
+//    Stop the worker.  Update and draw share one snapshot again afterwards.
+//
+void esPipelineDestroy ( ESPipeline *pipeline )
+{
+   if ( pipeline == NULL )
+   {
+      return;
+   }
+
+#ifndef _WIN32
+   pthread_mutex_lock ( &pipeline->mutex );
+
+   while ( pipeline->pending )
+   {
+      pthread_cond_wait ( &pipeline->cond, &pipeline->mutex );
+   }
+
+   pipeline->quit = 1;
+   pthread_cond_broadcast ( &pipeline->cond );
+   pthread_mutex_unlock ( &pipeline->mutex );
+
+   pthread_join ( pipeline->thread, NULL );
+   pthread_cond_destroy ( &pipeline->cond );
+   pthread_mutex_destroy ( &pipeline->mutex );
+#endif
+
+   pipeline->esContext->updateSnapshot = pipeline->esContext->drawSnapshot;
+   free ( pipeline );
+}
@@ -32,13 +32,156 @@
 // ESShader.c
 //
 //    Utility functions for loading shaders and creating program objects.
+//    Linked programs can be cached on disk with glGetProgramBinary, see
+//    esSetProgramCacheDir, and compiled in batches so drivers with
+//    threaded compilers can work on several programs at once.  ESProgram
+//    reflects the active variables of a linked program into hash tables
+//    and skips uniform uploads that would not change anything.
+//    ESUniformRing streams per-draw uniform blocks through one buffer.
+//    ESShaderLibrary builds program variants from shader files.
 //
 
 ///
 //  Includes
 //
 #include "esUtil.h"
+#include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <unistd.h>
+#endif
+
+///
+//  Macros
+//
+
+// Longest program cache directory name
+#define ES_MAX_CACHE_PATH     512
+
+// Identifies a program cache file, the last digit is the file format version
+#define ES_CACHE_MAGIC        0x45535031
+
+// GL_KHR_parallel_shader_compile, missing from older headers
+#ifndef GL_COMPLETION_STATUS_KHR
+#define GL_MAX_SHADER_COMPILER_THREADS_KHR   0x91B0
+#define GL_COMPLETION_STATUS_KHR             0x91B1
+#endif
+
+#ifndef __APPLE__
+typedef void ( GL_APIENTRY *ESMaxShaderCompilerThreadsProc ) ( GLuint count );
+#endif
+
+// Deepest #include nesting, also stops include cycles
+#define ES_MAX_INCLUDE_DEPTH  16
+
+///
+//  Types
+//
+
+// Header of a program cache file, followed by the program binary
+typedef struct
+{
+   unsigned int   magic;
+   unsigned int   binaryFormat;
+   unsigned int   binaryLength;
+   unsigned int   keyLow;
+   unsigned int   keyHigh;
+} ESProgramCacheHeader;
+
+// A program submitted for compilation whose status has not been checked yet
+typedef struct
+{
+   GLuint   programObject;
+   GLuint   vertexShader;
+   GLuint   fragmentShader;
+
+   // Taken from the program cache or already resolved, nothing left to check
+   GLboolean done;
+
+   // Program cache key, only valid if the cache was enabled at submission
+   GLboolean cached;
+   unsigned long long key;
+} ESPendingProgram;
+
+struct ESProgramBatch
+{
+   ESPendingProgram *programs;
+   int      numPrograms;
+   int      maxPrograms;
+
+   // The driver can report completion without blocking
+   GLboolean parallel;
+};
+
+// Open addressing hash table mapping name hashes to variable indices
+typedef struct
+{
+   int            *slots;
+   unsigned int   mask;
+} ESNameTable;
+
+// Last value uploaded to a uniform of the default block
+typedef struct
+{
+   size_t         offset;
+   size_t         size;
+   GLboolean      valid;
+} ESUniformValue;
+
+struct ESProgramLookup
+{
+   ESNameTable    uniforms;
+   ESNameTable    attributes;
+   ESNameTable    blocks;
+
+   // Shadow copy of the uniform values, indexed like ESProgram.uniforms
+   ESUniformValue *values;
+   unsigned char  *storage;
+};
+
+// A stream buffer that waits for its regions, aligned for uniform block binds
+struct ESUniformRing
+{
+   ESContext      *esContext;
+   ESStreamBuffer *stream;
+};
+
+// Growing buffer a preprocessed shader source is assembled in
+typedef struct
+{
+   char     *data;
+   size_t   length;
+   size_t   capacity;
+} ESSourceBuffer;
+
+// A program built from a set of files and defines
+typedef struct
+{
+   unsigned long long key;
+   GLuint   programObject;
+
+   // The file names, defines, varyings and mode the key hashes, each with
+   // its terminator, so a hash collision does not return another program
+   char     *name;
+   size_t   nameLength;
+} ESShaderVariant;
+
+struct ESShaderLibrary
+{
+   ESContext *esContext;
+   void     *ioContext;
+
+   ESShaderVariant *variants;
+   int      numVariants;
+   int      maxVariants;
+};
+
+// Directory the program binaries are cached in, empty to disable the cache
+static char s_programCacheDir[ES_MAX_CACHE_PATH];
 
 //////////////////////////////////////////////////////////////////
 //
@@ -46,41 +189,248 @@
 //
 //
 
+///
+// HashString()
+//
+//    64-bit FNV-1a over a string including its terminator
+//
+static unsigned long long HashString ( unsigned long long hash, const char *str )
+{
+   do
+   {
+      hash ^= ( unsigned char ) *str;
+      hash *= 0x100000001b3ull;
+   }
+   while ( *str++ != '\0' );
 
+   return hash;
+}
 
-//////////////////////////////////////////////////////////////////
+///
+// VariantName()
 //
-//  Public Functions
+//    The strings HashString() is run over for a shader library variant, one
+//    after the other with their terminators.  NULL if out of memory.
+//
+static char *VariantName ( const char *const *parts, int numParts, const char *const *varyings,
+                           GLsizei numVaryings, const char *mode, size_t *length )
+{
+   char *name;
+   size_t len = strlen ( mode ) + 1;
+   int i;
+
+   for ( i = 0; i < numParts; i++ )
+   {
+      len += strlen ( parts[i] ) + 1;
+   }
+
+   for ( i = 0; i < numVaryings; i++ )
+   {
+      len += strlen ( varyings[i] ) + 1;
+   }
+
+   name = malloc ( len );
+
+   if ( name == NULL )
+   {
+      return NULL;
+   }
+
+   *length = len;
+   len = 0;
+
+   for ( i = 0; i < numParts; i++ )
+   {
+      strcpy ( name + len, parts[i] );
+      len += strlen ( parts[i] ) + 1;
+   }
+
+   for ( i = 0; i < numVaryings; i++ )
+   {
+      strcpy ( name + len, varyings[i] );
+      len += strlen ( varyings[i] ) + 1;
+   }
+
+   strcpy ( name + len, mode );
+
+   return name;
+}
+
+///
+// ProgramCacheKey()
 //
+//    Everything that decides whether a stored binary can be reused: the
+//    sources, the transform feedback setup and the driver that built it
 //
+static unsigned long long ProgramCacheKey ( const char *vertShaderSrc, const char *fragShaderSrc,
+                                            GLsizei numVaryings, const char *const *varyings, GLenum bufferMode )
+{
+   unsigned long long hash = 0xcbf29ce484222325ull;
+   const char *renderer = ( const char * ) glGetString ( GL_RENDERER );
+   const char *version = ( const char * ) glGetString ( GL_VERSION );
+   char mode[32];
+   GLsizei i;
+
+   hash = HashString ( hash, vertShaderSrc );
+   hash = HashString ( hash, fragShaderSrc );
+
+   for ( i = 0; i < numVaryings; i++ )
+   {
+      hash = HashString ( hash, varyings[i] );
+   }
+
+   snprintf ( mode, sizeof ( mode ), "%d:%u", ( int ) numVaryings, ( unsigned int ) bufferMode );
+   hash = HashString ( hash, mode );
+   hash = HashString ( hash, renderer != NULL ? renderer : "" );
+   hash = HashString ( hash, version != NULL ? version : "" );
+
+   return hash;
+}
 
+///
+// ProgramCachePath()
 //
+static void ProgramCachePath ( char *path, size_t size, unsigned long long key )
+{
+   snprintf ( path, size, "%s/%08x%08x.bin", s_programCacheDir,
+              ( unsigned int ) ( key >> 32 ), ( unsigned int ) key );
+}
+
 ///
-/// \brief Load a shader, check for compile errors, print error messages to output log
-/// \param type Type of shader (GL_VERTEX_SHADER or GL_FRAGMENT_SHADER)
-/// \param shaderSrc Shader source string
-/// \return A new shader object on success, 0 on failure
+// LoadCachedProgram()
 //
-GLuint ESUTIL_API esLoadShader ( GLenum type, const char *shaderSrc )
+//    Create a program from the cached binary for key.  Returns 0 if there is
+//    none or the driver rejects it, e.g. after a driver update.
+//
+static GLuint LoadCachedProgram ( unsigned long long key )
 {
-   GLuint shader;
-   GLint compiled;
+   char path[ES_MAX_CACHE_PATH + 32];
+   ESProgramCacheHeader header;
+   GLuint programObject = 0;
+   GLint linked = GL_FALSE;
+   void *binary;
+   FILE *fp;
 
-   // Create the shader object
-   shader = glCreateShader ( type );
+   ProgramCachePath ( path, sizeof ( path ), key );
+   fp = fopen ( path, "rb" );
 
-   if ( shader == 0 )
+   if ( fp == NULL )
    {
       return 0;
    }
 
-   // Load the shader source
-   glShaderSource ( shader, 1, &shaderSrc, NULL );
+   if ( fread ( &header, sizeof ( header ), 1, fp ) != 1 ||
+         header.magic != ES_CACHE_MAGIC ||
+         header.keyLow != ( unsigned int ) key ||
+         header.keyHigh != ( unsigned int ) ( key >> 32 ) )
+   {
+      fclose ( fp );
+      return 0;
+   }
 
-   // Compile the shader
-   glCompileShader ( shader );
+   binary = malloc ( header.binaryLength );
+
+   if ( binary != NULL && fread ( binary, 1, header.binaryLength, fp ) == header.binaryLength )
+   {
+      programObject = glCreateProgram ( );
+      glProgramBinary ( programObject, header.binaryFormat, binary, header.binaryLength );
+      glGetProgramiv ( programObject, GL_LINK_STATUS, &linked );
+
+      if ( !linked )
+      {
+         esLog ( ES_LOG_DEBUG, "Cached program %s was rejected, recompiling\n", path );
+         glDeleteProgram ( programObject );
+         programObject = 0;
+      }
+   }
+
+   free ( binary );
+   fclose ( fp );
+
+   return programObject;
+}
+
+///
+// StoreProgramBinary()
+//
+//    Write the binary of a linked program to the cache.  The file is written
+//    under a temporary name and renamed, so a program loaded at the same
+//    time by another context or process never sees half a file.
+//
+static void StoreProgramBinary ( GLuint programObject, unsigned long long key )
+{
+   char path[ES_MAX_CACHE_PATH + 32];
+   char tempPath[ES_MAX_CACHE_PATH + 80];
+   ESProgramCacheHeader header;
+   GLint binaryLength = 0;
+   GLenum binaryFormat = 0;
+   void *binary;
+   FILE *fp;
+   size_t written = 0;
+
+   glGetProgramiv ( programObject, GL_PROGRAM_BINARY_LENGTH, &binaryLength );
+
+   if ( binaryLength <= 0 )
+   {
+      return;
+   }
+
+   binary = malloc ( binaryLength );
+
+   if ( binary == NULL )
+   {
+      return;
+   }
+
+   glGetProgramBinary ( programObject, binaryLength, &binaryLength, &binaryFormat, binary );
+
+   header.magic = ES_CACHE_MAGIC;
+   header.binaryFormat = binaryFormat;
+   header.binaryLength = ( unsigned int ) binaryLength;
+   header.keyLow = ( unsigned int ) key;
+   header.keyHigh = ( unsigned int ) ( key >> 32 );
+
+   ProgramCachePath ( path, sizeof ( path ), key );
+   // Unique per process and, through the stack address, per thread
+#ifdef _WIN32
+   snprintf ( tempPath, sizeof ( tempPath ), "%s.%lu.%p.tmp", path,
+              ( unsigned long ) GetCurrentProcessId ( ), ( void * ) &header );
+#else
+   snprintf ( tempPath, sizeof ( tempPath ), "%s.%lu.%p.tmp", path,
+              ( unsigned long ) getpid ( ), ( void * ) &header );
+#endif
+
+   fp = fopen ( tempPath, "wb" );
+
+   if ( fp != NULL )
+   {
+      written = fwrite ( &header, sizeof ( header ), 1, fp );
+      written += fwrite ( binary, binaryLength, 1, fp );
+      fclose ( fp );
+
+      remove ( path );
+
+      if ( written != 2 || rename ( tempPath, path ) != 0 )
+      {
+         esLog ( ES_LOG_WARNING, "Could not write program cache file %s\n", path );
+         remove ( tempPath );
+      }
+   }
+
+   free ( binary );
+}
+
+
+
+///
+// CheckCompileStatus()
+//
+//    Returns GL_TRUE if the shader compiled, otherwise logs the info log
+//
+static GLboolean CheckCompileStatus ( GLuint shader )
+{
+   GLint compiled;
 
-   // Check the compile status
    glGetShaderiv ( shader, GL_COMPILE_STATUS, &compiled );
 
    if ( !compiled )
@@ -94,91 +444,1393 @@ GLuint ESUTIL_API esLoadShader ( GLenum type, const char *shaderSrc )
          char *infoLog = malloc ( sizeof ( char ) * infoLen );
 
          glGetShaderInfoLog ( shader, infoLen, NULL, infoLog );
-         esLogMessage ( "Error compiling shader:\n%s\n", infoLog );
+         esLog ( ES_LOG_ERROR, "Error compiling shader:\n%s\n", infoLog );
 
          free ( infoLog );
       }
+   }
 
-      glDeleteShader ( shader );
-      return 0;
+   return compiled ? GL_TRUE : GL_FALSE;
+}
+
+///
+// SubmitShader()
+//
+//    Create and compile a shader without waiting for the result
+//
+static GLuint SubmitShader ( GLenum type, const char *shaderSrc )
+{
+   GLuint shader = glCreateShader ( type );
+
+   if ( shader != 0 )
+   {
+      glShaderSource ( shader, 1, &shaderSrc, NULL );
+      glCompileShader ( shader );
    }
 
    return shader;
-
 }
 
-
-//
 ///
-/// \brief Load a vertex and fragment shader, create a program object, link program.
-//         Errors output to log.
-/// \param vertShaderSrc Vertex shader source code
-/// \param fragShaderSrc Fragment shader source code
-/// \return A new program object linked with the vertex/fragment shader pair, 0 on failure
+// SubmitProgram()
 //
-GLuint ESUTIL_API esLoadProgram ( const char *vertShaderSrc, const char *fragShaderSrc )
+//    Take a program from the cache or hand its shaders to the compiler and
+//    link it.  Nothing here queries a status, so the driver is free to do the
+//    work in the background until ResolveProgram needs the result.
+//
+static void SubmitProgram ( ESPendingProgram *pending, const char *vertShaderSrc, const char *fragShaderSrc,
+                            GLsizei numVaryings, const char *const *varyings, GLenum bufferMode )
 {
-   GLuint vertexShader;
-   GLuint fragmentShader;
-   GLuint programObject;
-   GLint linked;
+   GLint numBinaryFormats = 0;
 
-   // Load the vertex/fragment shaders
-   vertexShader = esLoadShader ( GL_VERTEX_SHADER, vertShaderSrc );
+   memset ( pending, 0, sizeof ( ESPendingProgram ) );
 
-   if ( vertexShader == 0 )
+   // The cache needs a driver that can hand out program binaries
+   if ( s_programCacheDir[0] != '\0' )
    {
-      return 0;
+      glGetIntegerv ( GL_NUM_PROGRAM_BINARY_FORMATS, &numBinaryFormats );
+   }
+
+   if ( numBinaryFormats > 0 )
+   {
+      pending->cached = GL_TRUE;
+      pending->key = ProgramCacheKey ( vertShaderSrc, fragShaderSrc, numVaryings, varyings, bufferMode );
+      pending->programObject = LoadCachedProgram ( pending->key );
+
+      if ( pending->programObject != 0 )
+      {
+         pending->done = GL_TRUE;
+         return;
+      }
    }
 
-   fragmentShader = esLoadShader ( GL_FRAGMENT_SHADER, fragShaderSrc );
+   pending->vertexShader = SubmitShader ( GL_VERTEX_SHADER, vertShaderSrc );
+   pending->fragmentShader = SubmitShader ( GL_FRAGMENT_SHADER, fragShaderSrc );
+   pending->programObject = glCreateProgram ( );
 
-   if ( fragmentShader == 0 )
+   if ( pending->programObject == 0 || pending->vertexShader == 0 || pending->fragmentShader == 0 )
    {
-      glDeleteShader ( vertexShader );
-      return 0;
+      return;
    }
 
-   // Create the program object
-   programObject = glCreateProgram ( );
+   glAttachShader ( pending->programObject, pending->vertexShader );
+   glAttachShader ( pending->programObject, pending->fragmentShader );
 
-   if ( programObject == 0 )
+   // Transform feedback varyings have to be known before linking
+   if ( numVaryings > 0 )
    {
-      return 0;
+      glTransformFeedbackVaryings ( pending->programObject, numVaryings, varyings, bufferMode );
+   }
+
+   if ( pending->cached )
+   {
+      glProgramParameteri ( pending->programObject, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE );
    }
 
-   glAttachShader ( programObject, vertexShader );
-   glAttachShader ( programObject, fragmentShader );
+   glLinkProgram ( pending->programObject );
+}
+
+///
+// ResolveProgram()
+//
+//    Wait for a submitted program, log compile and link errors and store
+//    the binary in the cache.  The program object is 0 afterwards if it
+//    failed.
+//
+static void ResolveProgram ( ESPendingProgram *pending )
+{
+   GLint linked = GL_FALSE;
 
-   // Link the program
-   glLinkProgram ( programObject );
+   if ( pending->done )
+   {
+      return;
+   }
 
-   // Check the link status
-   glGetProgramiv ( programObject, GL_LINK_STATUS, &linked );
+   pending->done = GL_TRUE;
+
+   if ( pending->programObject != 0 && pending->vertexShader != 0 && pending->fragmentShader != 0 )
+   {
+      glGetProgramiv ( pending->programObject, GL_LINK_STATUS, &linked );
+   }
 
    if ( !linked )
    {
       GLint infoLen = 0;
 
-      glGetProgramiv ( programObject, GL_INFO_LOG_LENGTH, &infoLen );
+      // The shader logs usually say more than the link log
+      if ( pending->vertexShader != 0 )
+      {
+         CheckCompileStatus ( pending->vertexShader );
+      }
+
+      if ( pending->fragmentShader != 0 )
+      {
+         CheckCompileStatus ( pending->fragmentShader );
+      }
+
+      if ( pending->programObject != 0 )
+      {
+         glGetProgramiv ( pending->programObject, GL_INFO_LOG_LENGTH, &infoLen );
+      }
 
       if ( infoLen > 1 )
       {
          char *infoLog = malloc ( sizeof ( char ) * infoLen );
 
-         glGetProgramInfoLog ( programObject, infoLen, NULL, infoLog );
-         esLogMessage ( "Error linking program:\n%s\n", infoLog );
+         glGetProgramInfoLog ( pending->programObject, infoLen, NULL, infoLog );
+         esLog ( ES_LOG_ERROR, "Error linking program:\n%s\n", infoLog );
 
          free ( infoLog );
       }
 
-      glDeleteProgram ( programObject );
-      return 0;
+      glDeleteProgram ( pending->programObject );
+      pending->programObject = 0;
    }
 
    // Free up no longer needed shader resources
-   glDeleteShader ( vertexShader );
-   glDeleteShader ( fragmentShader );
+   glDeleteShader ( pending->vertexShader );
+   glDeleteShader ( pending->fragmentShader );
+   pending->vertexShader = 0;
+   pending->fragmentShader = 0;
 
-   return programObject;
-}
\ No newline at end of file
+   if ( linked && pending->cached )
+   {
+      StoreProgramBinary ( pending->programObject, pending->key );
+   }
+}
+
+///
+// HasParallelCompile()
+//
+//    Check for GL_KHR_parallel_shader_compile and let the driver use as many
+//    compiler threads as it likes
+//
+static GLboolean HasParallelCompile ( void )
+{
+   GLint numExtensions = 0;
+   GLint i;
+
+   glGetIntegerv ( GL_NUM_EXTENSIONS, &numExtensions );
+
+   for ( i = 0; i < numExtensions; i++ )
+   {
+      const char *extension = ( const char * ) glGetStringi ( GL_EXTENSIONS, i );
+
+      if ( extension != NULL && strcmp ( extension, "GL_KHR_parallel_shader_compile" ) == 0 )
+      {
+#ifndef __APPLE__
+         ESMaxShaderCompilerThreadsProc maxShaderCompilerThreads =
+            ( ESMaxShaderCompilerThreadsProc ) eglGetProcAddress ( "glMaxShaderCompilerThreadsKHR" );
+
+         if ( maxShaderCompilerThreads != NULL )
+         {
+            maxShaderCompilerThreads ( 0xFFFFFFFF );
+         }
+#endif
+         return GL_TRUE;
+      }
+   }
+
+   return GL_FALSE;
+}
+
+///
+// BuildNameTable()
+//
+//    Hash the variables into a table at most half full.  Returns GL_FALSE if
+//    out of memory.
+//
+static GLboolean BuildNameTable ( ESNameTable *table, const ESProgramVariable *variables, int numVariables )
+{
+   unsigned int numSlots = 8;
+   int i;
+
+   while ( numSlots < ( unsigned int ) numVariables * 2 )
+   {
+      numSlots *= 2;
+   }
+
+   table->slots = malloc ( numSlots * sizeof ( int ) );
+   table->mask = numSlots - 1;
+
+   if ( table->slots == NULL )
+   {
+      return GL_FALSE;
+   }
+
+   for ( i = 0; i < ( int ) numSlots; i++ )
+   {
+      table->slots[i] = -1;
+   }
+
+   for ( i = 0; i < numVariables; i++ )
+   {
+      unsigned int slot = variables[i].hash & table->mask;
+
+      while ( table->slots[slot] != -1 )
+      {
+         if ( variables[table->slots[slot]].hash == variables[i].hash )
+         {
+            esLog ( ES_LOG_WARNING, "Names %s and %s have the same hash, %s cannot be looked up\n",
+                    variables[table->slots[slot]].name, variables[i].name, variables[i].name );
+            break;
+         }
+
+         slot = ( slot + 1 ) & table->mask;
+      }
+
+      if ( table->slots[slot] == -1 )
+      {
+         table->slots[slot] = i;
+      }
+   }
+
+   return GL_TRUE;
+}
+
+///
+// FindVariable()
+//
+static const ESProgramVariable *FindVariable ( const ESNameTable *table, const ESProgramVariable *variables,
+                                               ESHash hash )
+{
+   unsigned int slot = hash & table->mask;
+
+   while ( table->slots[slot] != -1 )
+   {
+      const ESProgramVariable *variable = &variables[table->slots[slot]];
+
+      if ( variable->hash == hash )
+      {
+         return variable;
+      }
+
+      slot = ( slot + 1 ) & table->mask;
+   }
+
+   return NULL;
+}
+
+///
+// SetVariableName()
+//
+//    Copy a name, dropping the "[0]" GL appends to arrays, and hash it
+//
+static GLboolean SetVariableName ( ESProgramVariable *variable, const char *name )
+{
+   size_t length = strlen ( name );
+
+   if ( length > 3 && strcmp ( name + length - 3, "[0]" ) == 0 )
+   {
+      length -= 3;
+   }
+
+   variable->name = malloc ( length + 1 );
+
+   if ( variable->name == NULL )
+   {
+      return GL_FALSE;
+   }
+
+   memcpy ( variable->name, name, length );
+   variable->name[length] = '\0';
+   variable->hash = esHashName ( variable->name );
+
+   return GL_TRUE;
+}
+
+///
+// ReflectUniforms()
+//
+static GLboolean ReflectUniforms ( ESProgram *program, char *name, GLsizei nameSize )
+{
+   GLuint i;
+
+   glGetProgramiv ( program->programObject, GL_ACTIVE_UNIFORMS, &program->numUniforms );
+   program->uniforms = calloc ( program->numUniforms + 1, sizeof ( ESProgramVariable ) );
+
+   if ( program->uniforms == NULL )
+   {
+      return GL_FALSE;
+   }
+
+   for ( i = 0; i < ( GLuint ) program->numUniforms; i++ )
+   {
+      ESProgramVariable *uniform = &program->uniforms[i];
+
+      glGetActiveUniform ( program->programObject, i, nameSize, NULL, &uniform->size, &uniform->type, name );
+
+      if ( !SetVariableName ( uniform, name ) )
+      {
+         return GL_FALSE;
+      }
+
+      glGetActiveUniformsiv ( program->programObject, 1, &i, GL_UNIFORM_BLOCK_INDEX, &uniform->blockIndex );
+      glGetActiveUniformsiv ( program->programObject, 1, &i, GL_UNIFORM_OFFSET, &uniform->offset );
+      uniform->location = glGetUniformLocation ( program->programObject, name );
+   }
+
+   return BuildNameTable ( &program->lookup->uniforms, program->uniforms, program->numUniforms );
+}
+
+///
+// ReflectAttributes()
+//
+static GLboolean ReflectAttributes ( ESProgram *program, char *name, GLsizei nameSize )
+{
+   GLuint i;
+
+   glGetProgramiv ( program->programObject, GL_ACTIVE_ATTRIBUTES, &program->numAttributes );
+   program->attributes = calloc ( program->numAttributes + 1, sizeof ( ESProgramVariable ) );
+
+   if ( program->attributes == NULL )
+   {
+      return GL_FALSE;
+   }
+
+   for ( i = 0; i < ( GLuint ) program->numAttributes; i++ )
+   {
+      ESProgramVariable *attribute = &program->attributes[i];
+
+      glGetActiveAttrib ( program->programObject, i, nameSize, NULL, &attribute->size, &attribute->type, name );
+
+      if ( !SetVariableName ( attribute, name ) )
+      {
+         return GL_FALSE;
+      }
+
+      attribute->location = glGetAttribLocation ( program->programObject, name );
+      attribute->blockIndex = -1;
+      attribute->offset = -1;
+   }
+
+   return BuildNameTable ( &program->lookup->attributes, program->attributes, program->numAttributes );
+}
+
+///
+// ReflectBlocks()
+//
+static GLboolean ReflectBlocks ( ESProgram *program, char *name, GLsizei nameSize )
+{
+   GLuint i;
+
+   glGetProgramiv ( program->programObject, GL_ACTIVE_UNIFORM_BLOCKS, &program->numBlocks );
+   program->blocks = calloc ( program->numBlocks + 1, sizeof ( ESProgramVariable ) );
+
+   if ( program->blocks == NULL )
+   {
+      return GL_FALSE;
+   }
+
+   for ( i = 0; i < ( GLuint ) program->numBlocks; i++ )
+   {
+      ESProgramVariable *block = &program->blocks[i];
+
+      glGetActiveUniformBlockName ( program->programObject, i, nameSize, NULL, name );
+
+      if ( !SetVariableName ( block, name ) )
+      {
+         return GL_FALSE;
+      }
+
+      glGetActiveUniformBlockiv ( program->programObject, i, GL_UNIFORM_BLOCK_DATA_SIZE, &block->size );
+      block->location = i;
+      block->blockIndex = i;
+      block->offset = 0;
+   }
+
+   return BuildNameTable ( &program->lookup->blocks, program->blocks, program->numBlocks );
+}
+
+///
+// UniformElementSize()
+//
+//    Bytes of one array element of a uniform type
+//
+static size_t UniformElementSize ( GLenum type )
+{
+   switch ( type )
+   {
+      case GL_FLOAT_VEC2:
+      case GL_INT_VEC2:
+      case GL_UNSIGNED_INT_VEC2:
+      case GL_BOOL_VEC2:
+         return 2 * sizeof ( GLfloat );
+
+      case GL_FLOAT_VEC3:
+      case GL_INT_VEC3:
+      case GL_UNSIGNED_INT_VEC3:
+      case GL_BOOL_VEC3:
+         return 3 * sizeof ( GLfloat );
+
+      case GL_FLOAT_VEC4:
+      case GL_INT_VEC4:
+      case GL_UNSIGNED_INT_VEC4:
+      case GL_BOOL_VEC4:
+      case GL_FLOAT_MAT2:
+         return 4 * sizeof ( GLfloat );
+
+      case GL_FLOAT_MAT2x3:
+      case GL_FLOAT_MAT3x2:
+         return 6 * sizeof ( GLfloat );
+
+      case GL_FLOAT_MAT2x4:
+      case GL_FLOAT_MAT4x2:
+         return 8 * sizeof ( GLfloat );
+
+      case GL_FLOAT_MAT3:
+         return 9 * sizeof ( GLfloat );
+
+      case GL_FLOAT_MAT3x4:
+      case GL_FLOAT_MAT4x3:
+         return 12 * sizeof ( GLfloat );
+
+      case GL_FLOAT_MAT4:
+         return 16 * sizeof ( GLfloat );
+
+      default:
+         // Scalars and samplers
+         return sizeof ( GLfloat );
+   }
+}
+
+///
+// CreateUniformValues()
+//
+//    Room for the shadow copy of every uniform in the default block
+//
+static GLboolean CreateUniformValues ( ESProgram *program )
+{
+   struct ESProgramLookup *lookup = program->lookup;
+   size_t storageSize = 0;
+   int i;
+
+   lookup->values = calloc ( program->numUniforms + 1, sizeof ( ESUniformValue ) );
+
+   if ( lookup->values == NULL )
+   {
+      return GL_FALSE;
+   }
+
+   for ( i = 0; i < program->numUniforms; i++ )
+   {
+      if ( program->uniforms[i].location != -1 )
+      {
+         lookup->values[i].offset = storageSize;
+         lookup->values[i].size = UniformElementSize ( program->uniforms[i].type ) * program->uniforms[i].size;
+         storageSize += lookup->values[i].size;
+      }
+   }
+
+   lookup->storage = malloc ( storageSize + 1 );
+
+   return lookup->storage != NULL;
+}
+
+///
+// UniformChanged()
+//
+//    Compare a value with the shadow copy of the uniform and update it.
+//    Returns the location to upload to, or -1 if the upload can be skipped.
+//
+static GLint UniformChanged ( ESProgram *program, ESHash nameHash, const void *value, size_t size )
+{
+   const ESProgramVariable *uniform = esProgramFindUniform ( program, nameHash );
+   ESUniformValue *shadow;
+   unsigned char *storage;
+
+   if ( uniform == NULL || uniform->location == -1 )
+   {
+      return -1;
+   }
+
+   shadow = &program->lookup->values[uniform - program->uniforms];
+   storage = program->lookup->storage + shadow->offset;
+
+   // Values past the end of the array are ignored by GL as well
+   if ( size > shadow->size )
+   {
+      size = shadow->size;
+   }
+
+   if ( shadow->valid && memcmp ( storage, value, size ) == 0 )
+   {
+      program->uniformsSkipped++;
+      return -1;
+   }
+
+   memcpy ( storage, value, size );
+
+   // A complete upload makes the whole shadow copy known
+   shadow->valid = shadow->valid || size == shadow->size;
+   program->uniformsIssued++;
+
+   return uniform->location;
+}
+
+///
+// AppendSource()
+//
+static GLboolean AppendSource ( ESSourceBuffer *buffer, const char *str, size_t length )
+{
+   if ( buffer->length + length + 1 > buffer->capacity )
+   {
+      size_t capacity = buffer->capacity > 0 ? buffer->capacity : 4096;
+      char *data;
+
+      while ( buffer->length + length + 1 > capacity )
+      {
+         capacity *= 2;
+      }
+
+      data = realloc ( buffer->data, capacity );
+
+      if ( data == NULL )
+      {
+         return GL_FALSE;
+      }
+
+      buffer->data = data;
+      buffer->capacity = capacity;
+   }
+
+   memcpy ( buffer->data + buffer->length, str, length );
+   buffer->length += length;
+   buffer->data[buffer->length] = '\0';
+
+   return GL_TRUE;
+}
+
+///
+// AppendDefines()
+//
+//    Turn "NAME=VALUE NAME ..." into a #define line for each name
+//
+static GLboolean AppendDefines ( ESSourceBuffer *buffer, const char *defines )
+{
+   while ( defines != NULL && *defines != '\0' )
+   {
+      size_t length = strcspn ( defines, " \t\r\n;" );
+      const char *equals = memchr ( defines, '=', length );
+
+      if ( length > 0 )
+      {
+         GLboolean ok = AppendSource ( buffer, "#define ", 8 );
+
+         if ( equals != NULL )
+         {
+            ok = ok && AppendSource ( buffer, defines, equals - defines ) &&
+                 AppendSource ( buffer, " ", 1 ) &&
+                 AppendSource ( buffer, equals + 1, length - ( equals + 1 - defines ) );
+         }
+         else
+         {
+            ok = ok && AppendSource ( buffer, defines, length );
+         }
+
+         if ( !ok || !AppendSource ( buffer, "\n", 1 ) )
+         {
+            return GL_FALSE;
+         }
+      }
+
+      defines += length;
+      defines += strspn ( defines, " \t\r\n;" );
+   }
+
+   return GL_TRUE;
+}
+
+///
+// PreprocessFile()
+//
+//    Append a shader file to the buffer with its #include "file" lines
+//    replaced by the files they name, relative to the including file.  The
+//    defines go right after the #version line of the top level file.
+//
+static GLboolean PreprocessFile ( ESShaderLibrary *library, ESSourceBuffer *buffer, const char *fileName,
+                                  const char *defines, int depth )
+{
+   char *source;
+   const char *line;
+   GLboolean ok = GL_TRUE;
+   GLboolean firstLine = GL_TRUE;
+
+   if ( depth > ES_MAX_INCLUDE_DEPTH )
+   {
+      esLog ( ES_LOG_ERROR, "Shader includes nested too deep at %s\n", fileName );
+      return GL_FALSE;
+   }
+
+   source = esLoadFile ( library->ioContext, fileName, NULL );
+
+   if ( source == NULL )
+   {
+      return GL_FALSE;
+   }
+
+   for ( line = source; ok && *line != '\0'; firstLine = GL_FALSE )
+   {
+      size_t length = strcspn ( line, "\n" );
+      const char *directive = line + strspn ( line, " \t" );
+
+      if ( strncmp ( directive, "#include", 8 ) == 0 )
+      {
+         const char *name = strchr ( directive, '"' );
+         const char *nameEnd = name != NULL ? strchr ( name + 1, '"' ) : NULL;
+         const char *dirEnd = strrchr ( fileName, '/' );
+         char path[ES_MAX_CACHE_PATH];
+
+         if ( nameEnd == NULL || nameEnd > line + length )
+         {
+            esLog ( ES_LOG_ERROR, "Malformed #include in %s\n", fileName );
+            ok = GL_FALSE;
+         }
+         else
+         {
+            // Paths are relative to the directory of the including file
+            int dirLength = dirEnd != NULL ? ( int ) ( dirEnd + 1 - fileName ) : 0;
+
+            snprintf ( path, sizeof ( path ), "%.*s%.*s", dirLength, fileName,
+                       ( int ) ( nameEnd - name - 1 ), name + 1 );
+            ok = PreprocessFile ( library, buffer, path, NULL, depth + 1 );
+         }
+      }
+      else if ( firstLine && depth == 0 && strncmp ( directive, "#version", 8 ) == 0 )
+      {
+         ok = AppendSource ( buffer, line, length ) && AppendSource ( buffer, "\n", 1 ) &&
+              AppendDefines ( buffer, defines );
+      }
+      else
+      {
+         // Without a #version line the defines come first
+         if ( firstLine && depth == 0 )
+         {
+            ok = AppendDefines ( buffer, defines );
+         }
+
+         ok = ok && AppendSource ( buffer, line, length ) && AppendSource ( buffer, "\n", 1 );
+      }
+
+      line += length;
+      line += *line == '\n';
+   }
+
+   free ( source );
+
+   return ok;
+}
+
+//////////////////////////////////////////////////////////////////
+//
+//  Public Functions
+//
+//
+
+//
+///
+/// \brief Load a shader, check for compile errors, print error messages to output log
+/// \param type Type of shader (GL_VERTEX_SHADER or GL_FRAGMENT_SHADER)
+/// \param shaderSrc Shader source string
+/// \return A new shader object on success, 0 on failure
+//
+GLuint ESUTIL_API esLoadShader ( GLenum type, const char *shaderSrc )
+{
+   GLuint shader;
+
+   // Create the shader object
+   shader = glCreateShader ( type );
+
+   if ( shader == 0 )
+   {
+      return 0;
+   }
+
+   // Load the shader source
+   glShaderSource ( shader, 1, &shaderSrc, NULL );
+
+   // Compile the shader
+   glCompileShader ( shader );
+
+   // Check the compile status
+   if ( !CheckCompileStatus ( shader ) )
+   {
+      glDeleteShader ( shader );
+      return 0;
+   }
+
+   return shader;
+
+}
+
+
+///
+// esSetProgramCacheDir()
+//
+void ESUTIL_API esSetProgramCacheDir ( const char *dirName )
+{
+   s_programCacheDir[0] = '\0';
+
+   if ( dirName != NULL )
+   {
+      strncpy ( s_programCacheDir, dirName, sizeof ( s_programCacheDir ) - 1 );
+      s_programCacheDir[sizeof ( s_programCacheDir ) - 1] = '\0';
+   }
+}
+
+//
+///
+/// \brief Load a vertex and fragment shader, create a program object, link program.
+//         Errors output to log.
+/// \param vertShaderSrc Vertex shader source code
+/// \param fragShaderSrc Fragment shader source code
+/// \return A new program object linked with the vertex/fragment shader pair, 0 on failure
+//
+GLuint ESUTIL_API esLoadProgram ( const char *vertShaderSrc, const char *fragShaderSrc )
+{
+   return esLoadProgramWithVaryings ( vertShaderSrc, fragShaderSrc, 0, NULL, GL_INTERLEAVED_ATTRIBS );
+}
+
+//
+///
+/// \brief Like esLoadProgram, but capture the given vertex shader outputs with
+//         transform feedback.  The program binary is taken from and stored in the
+//         program cache if one is set.
+/// \param vertShaderSrc Vertex shader source code
+/// \param fragShaderSrc Fragment shader source code
+/// \param numVaryings Number of transform feedback varyings, 0 for none
+/// \param varyings Names of the transform feedback varyings
+/// \param bufferMode GL_INTERLEAVED_ATTRIBS or GL_SEPARATE_ATTRIBS
+/// \return A new program object linked with the vertex/fragment shader pair, 0 on failure
+//
+GLuint ESUTIL_API esLoadProgramWithVaryings ( const char *vertShaderSrc, const char *fragShaderSrc,
+                                              GLsizei numVaryings, const char *const *varyings,
+                                              GLenum bufferMode )
+{
+   ESPendingProgram pending;
+
+   SubmitProgram ( &pending, vertShaderSrc, fragShaderSrc, numVaryings, varyings, bufferMode );
+   ResolveProgram ( &pending );
+
+   return pending.programObject;
+}
+
+///
+// esProgramBatchCreate()
+//
+ESProgramBatch *ESUTIL_API esProgramBatchCreate ( void )
+{
+   ESProgramBatch *batch = calloc ( 1, sizeof ( ESProgramBatch ) );
+
+   if ( batch != NULL )
+   {
+      batch->parallel = HasParallelCompile ( );
+   }
+
+   return batch;
+}
+
+///
+// esProgramBatchAddWithVaryings()
+//
+int ESUTIL_API esProgramBatchAddWithVaryings ( ESProgramBatch *batch, const char *vertShaderSrc, const char *fragShaderSrc,
+                                               GLsizei numVaryings, const char *const *varyings, GLenum bufferMode )
+{
+   if ( batch->numPrograms == batch->maxPrograms )
+   {
+      int maxPrograms = batch->maxPrograms > 0 ? batch->maxPrograms * 2 : 8;
+      ESPendingProgram *programs = realloc ( batch->programs, maxPrograms * sizeof ( ESPendingProgram ) );
+
+      if ( programs == NULL )
+      {
+         return -1;
+      }
+
+      batch->programs = programs;
+      batch->maxPrograms = maxPrograms;
+   }
+
+   SubmitProgram ( &batch->programs[batch->numPrograms], vertShaderSrc, fragShaderSrc,
+                   numVaryings, varyings, bufferMode );
+
+   return batch->numPrograms++;
+}
+
+///
+// esProgramBatchAdd()
+//
+int ESUTIL_API esProgramBatchAdd ( ESProgramBatch *batch, const char *vertShaderSrc, const char *fragShaderSrc )
+{
+   return esProgramBatchAddWithVaryings ( batch, vertShaderSrc, fragShaderSrc, 0, NULL, GL_INTERLEAVED_ATTRIBS );
+}
+
+///
+// esProgramBatchIsComplete()
+//
+GLboolean ESUTIL_API esProgramBatchIsComplete ( ESProgramBatch *batch )
+{
+   int i;
+
+   // Without the extension every status query blocks, so there is nothing to poll
+   if ( !batch->parallel )
+   {
+      return GL_TRUE;
+   }
+
+   for ( i = 0; i < batch->numPrograms; i++ )
+   {
+      ESPendingProgram *pending = &batch->programs[i];
+      GLint complete = GL_TRUE;
+
+      if ( !pending->done && pending->programObject != 0 )
+      {
+         glGetProgramiv ( pending->programObject, GL_COMPLETION_STATUS_KHR, &complete );
+      }
+
+      if ( !complete )
+      {
+         return GL_FALSE;
+      }
+   }
+
+   return GL_TRUE;
+}
+
+///
+// esProgramBatchGetProgram()
+//
+GLuint ESUTIL_API esProgramBatchGetProgram ( ESProgramBatch *batch, int index )
+{
+   if ( index < 0 || index >= batch->numPrograms )
+   {
+      return 0;
+   }
+
+   ResolveProgram ( &batch->programs[index] );
+
+   return batch->programs[index].programObject;
+}
+
+///
+// esProgramBatchDestroy()
+//
+void ESUTIL_API esProgramBatchDestroy ( ESProgramBatch *batch )
+{
+   int i;
+
+   if ( batch == NULL )
+   {
+      return;
+   }
+
+   // Release the shaders of programs that were never asked for
+   for ( i = 0; i < batch->numPrograms; i++ )
+   {
+      ResolveProgram ( &batch->programs[i] );
+   }
+
+   free ( batch->programs );
+   free ( batch );
+}
+
+///
+// esHashName()
+//
+//    32-bit FNV-1a
+//
+ESHash ESUTIL_API esHashName ( const char *name )
+{
+   ESHash hash = 0x811c9dc5u;
+
+   while ( *name != '\0' )
+   {
+      hash ^= ( unsigned char ) *name++;
+      hash *= 0x01000193u;
+   }
+
+   return hash;
+}
+
+///
+// esProgramCreate()
+//
+ESProgram *ESUTIL_API esProgramCreate ( GLuint programObject )
+{
+   ESProgram *program;
+   GLint maxUniformName = 0;
+   GLint maxAttributeName = 0;
+   GLint maxBlockName = 0;
+   GLint numBlocks = 0;
+   GLsizei nameSize;
+   char *name;
+   GLboolean ok;
+   GLint i;
+
+   if ( programObject == 0 )
+   {
+      return NULL;
+   }
+
+   program = calloc ( 1, sizeof ( ESProgram ) );
+
+   if ( program == NULL )
+   {
+      return NULL;
+   }
+
+   program->programObject = programObject;
+   program->lookup = calloc ( 1, sizeof ( struct ESProgramLookup ) );
+
+   // One buffer big enough for every name
+   glGetProgramiv ( programObject, GL_ACTIVE_UNIFORM_MAX_LENGTH, &maxUniformName );
+   glGetProgramiv ( programObject, GL_ACTIVE_ATTRIBUTE_MAX_LENGTH, &maxAttributeName );
+   glGetProgramiv ( programObject, GL_ACTIVE_UNIFORM_BLOCKS, &numBlocks );
+
+   for ( i = 0; i < numBlocks; i++ )
+   {
+      GLint length = 0;
+
+      glGetActiveUniformBlockiv ( programObject, i, GL_UNIFORM_BLOCK_NAME_LENGTH, &length );
+      maxBlockName = length > maxBlockName ? length : maxBlockName;
+   }
+
+   nameSize = maxUniformName;
+   nameSize = maxAttributeName > nameSize ? maxAttributeName : nameSize;
+   nameSize = maxBlockName > nameSize ? maxBlockName : nameSize;
+   name = malloc ( nameSize + 1 );
+
+   ok = program->lookup != NULL && name != NULL &&
+        ReflectUniforms ( program, name, nameSize + 1 ) &&
+        ReflectAttributes ( program, name, nameSize + 1 ) &&
+        ReflectBlocks ( program, name, nameSize + 1 ) &&
+        CreateUniformValues ( program );
+
+   free ( name );
+
+   if ( !ok )
+   {
+      esLog ( ES_LOG_ERROR, "Out of memory reflecting program %u\n", programObject );
+
+      // Leave the program object to the caller, no context is needed then
+      program->programObject = 0;
+      esProgramDestroy ( NULL, program );
+      return NULL;
+   }
+
+   return program;
+}
+
+///
+// esProgramCheckUniforms()
+//
+GLboolean ESUTIL_API esProgramCheckUniforms ( const ESProgram *program, const char *const *names, int numNames )
+{
+   GLboolean found = GL_TRUE;
+   int i;
+
+   for ( i = 0; i < numNames; i++ )
+   {
+      if ( esProgramFindUniform ( program, esHashName ( names[i] ) ) == NULL )
+      {
+         esLog ( ES_LOG_ERROR, "Program %u has no active uniform %s\n", program->programObject, names[i] );
+         found = GL_FALSE;
+      }
+   }
+
+   return found;
+}
+
+///
+// esProgramFindUniform()
+//
+const ESProgramVariable *ESUTIL_API esProgramFindUniform ( const ESProgram *program, ESHash nameHash )
+{
+   return FindVariable ( &program->lookup->uniforms, program->uniforms, nameHash );
+}
+
+///
+// esProgramFindAttribute()
+//
+const ESProgramVariable *ESUTIL_API esProgramFindAttribute ( const ESProgram *program, ESHash nameHash )
+{
+   return FindVariable ( &program->lookup->attributes, program->attributes, nameHash );
+}
+
+///
+// esProgramFindBlock()
+//
+const ESProgramVariable *ESUTIL_API esProgramFindBlock ( const ESProgram *program, ESHash nameHash )
+{
+   return FindVariable ( &program->lookup->blocks, program->blocks, nameHash );
+}
+
+///
+// esProgramUniformLocation()
+//
+GLint ESUTIL_API esProgramUniformLocation ( const ESProgram *program, ESHash nameHash )
+{
+   const ESProgramVariable *uniform = esProgramFindUniform ( program, nameHash );
+
+   return uniform != NULL ? uniform->location : -1;
+}
+
+///
+// esProgramDestroy()
+//
+void ESUTIL_API esProgramDestroy ( ESContext *esContext, ESProgram *program )
+{
+   int i;
+
+   if ( program == NULL )
+   {
+      return;
+   }
+
+   for ( i = 0; i < program->numUniforms && program->uniforms != NULL; i++ )
+   {
+      free ( program->uniforms[i].name );
+   }
+
+   for ( i = 0; i < program->numAttributes && program->attributes != NULL; i++ )
+   {
+      free ( program->attributes[i].name );
+   }
+
+   for ( i = 0; i < program->numBlocks && program->blocks != NULL; i++ )
+   {
+      free ( program->blocks[i].name );
+   }
+
+   if ( program->lookup != NULL )
+   {
+      free ( program->lookup->uniforms.slots );
+      free ( program->lookup->attributes.slots );
+      free ( program->lookup->blocks.slots );
+      free ( program->lookup->values );
+      free ( program->lookup->storage );
+      free ( program->lookup );
+   }
+
+   free ( program->uniforms );
+   free ( program->attributes );
+   free ( program->blocks );
+
+   if ( program->programObject != 0 )
+   {
+      esDeleteProgram ( esContext, program->programObject );
+   }
+
+   free ( program );
+}
+
+///
+// esProgramUniform1i()
+//
+void ESUTIL_API esProgramUniform1i ( ESProgram *program, ESHash nameHash, GLint value )
+{
+   GLint location = UniformChanged ( program, nameHash, &value, sizeof ( GLint ) );
+
+   if ( location != -1 )
+   {
+      glUniform1i ( location, value );
+   }
+}
+
+///
+// esProgramUniform1f()
+//
+void ESUTIL_API esProgramUniform1f ( ESProgram *program, ESHash nameHash, GLfloat value )
+{
+   GLint location = UniformChanged ( program, nameHash, &value, sizeof ( GLfloat ) );
+
+   if ( location != -1 )
+   {
+      glUniform1f ( location, value );
+   }
+}
+
+///
+// esProgramUniform2fv()
+//
+void ESUTIL_API esProgramUniform2fv ( ESProgram *program, ESHash nameHash, GLsizei count, const GLfloat *value )
+{
+   GLint location = UniformChanged ( program, nameHash, value, 2 * sizeof ( GLfloat ) * count );
+
+   if ( location != -1 )
+   {
+      glUniform2fv ( location, count, value );
+   }
+}
+
+///
+// esProgramUniform3fv()
+//
+void ESUTIL_API esProgramUniform3fv ( ESProgram *program, ESHash nameHash, GLsizei count, const GLfloat *value )
+{
+   GLint location = UniformChanged ( program, nameHash, value, 3 * sizeof ( GLfloat ) * count );
+
+   if ( location != -1 )
+   {
+      glUniform3fv ( location, count, value );
+   }
+}
+
+///
+// esProgramUniform4fv()
+//
+void ESUTIL_API esProgramUniform4fv ( ESProgram *program, ESHash nameHash, GLsizei count, const GLfloat *value )
+{
+   GLint location = UniformChanged ( program, nameHash, value, 4 * sizeof ( GLfloat ) * count );
+
+   if ( location != -1 )
+   {
+      glUniform4fv ( location, count, value );
+   }
+}
+
+///
+// esProgramUniformMatrix4fv()
+//
+void ESUTIL_API esProgramUniformMatrix4fv ( ESProgram *program, ESHash nameHash, GLsizei count, const GLfloat *value )
+{
+   GLint location = UniformChanged ( program, nameHash, value, 16 * sizeof ( GLfloat ) * count );
+
+   if ( location != -1 )
+   {
+      glUniformMatrix4fv ( location, count, GL_FALSE, value );
+   }
+}
+
+///
+// esProgramInvalidateUniforms()
+//
+void ESUTIL_API esProgramInvalidateUniforms ( ESProgram *program )
+{
+   int i;
+
+   for ( i = 0; i < program->numUniforms; i++ )
+   {
+      program->lookup->values[i].valid = GL_FALSE;
+   }
+}
+
+///
+// esUniformRingCreate()
+//
+ESUniformRing *ESUTIL_API esUniformRingCreate ( ESContext *esContext, GLsizeiptr frameSize, int numFrames )
+{
+   ESUniformRing *ring = calloc ( 1, sizeof ( ESUniformRing ) );
+   GLint alignment = 0;
+
+   if ( ring == NULL )
+   {
+      return NULL;
+   }
+
+   glGetIntegerv ( GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &alignment );
+
+   if ( alignment < 1 )
+   {
+      alignment = 256;
+   }
+
+   // Constants of earlier frames must not change under their draws, so wait
+   // for a region rather than orphan the whole buffer
+   ring->esContext = esContext;
+   ring->stream = esStreamBufferCreate ( esContext, GL_UNIFORM_BUFFER, frameSize, numFrames, alignment,
+                                         ES_STREAM_WAIT );
+
+   if ( ring->stream == NULL )
+   {
+      free ( ring );
+      return NULL;
+   }
+
+   return ring;
+}
+
+///
+// esUniformRingBeginFrame()
+//
+GLboolean ESUTIL_API esUniformRingBeginFrame ( ESUniformRing *ring )
+{
+   return esStreamBufferBeginFrame ( ring->stream );
+}
+
+///
+// esUniformRingAlloc()
+//
+void *ESUTIL_API esUniformRingAlloc ( ESUniformRing *ring, GLsizeiptr size, GLintptr *offset )
+{
+   return esStreamBufferAlloc ( ring->stream, size, offset );
+}
+
+///
+// esUniformRingUpload()
+//
+void ESUTIL_API esUniformRingUpload ( ESUniformRing *ring )
+{
+   esStreamBufferUpload ( ring->stream );
+}
+
+///
+// esUniformRingBind()
+//
+void ESUTIL_API esUniformRingBind ( ESUniformRing *ring, GLuint bindingPoint, GLintptr offset, GLsizeiptr size )
+{
+   esBindBufferRange ( ring->esContext, GL_UNIFORM_BUFFER, bindingPoint, esStreamBufferGetBuffer ( ring->stream ),
+                       offset, size );
+}
+
+///
+// esUniformRingDestroy()
+//
+void ESUTIL_API esUniformRingDestroy ( ESUniformRing *ring )
+{
+   if ( ring == NULL )
+   {
+      return;
+   }
+
+   esStreamBufferDestroy ( ring->stream );
+   free ( ring );
+}
+
+///
+// esShaderLibraryCreate()
+//
+ESShaderLibrary *ESUTIL_API esShaderLibraryCreate ( ESContext *esContext )
+{
+   ESShaderLibrary *library = calloc ( 1, sizeof ( ESShaderLibrary ) );
+
+   if ( library != NULL )
+   {
+      library->esContext = esContext;
+      library->ioContext = esContext->platformData;
+   }
+
+   return library;
+}
+
+///
+// esShaderLibraryLoadProgramWithVaryings()
+//
+GLuint ESUTIL_API esShaderLibraryLoadProgramWithVaryings ( ESShaderLibrary *library, const char *vertFileName,
+                                                           const char *fragFileName, const char *defines,
+                                                           GLsizei numVaryings, const char *const *varyings,
+                                                           GLenum bufferMode )
+{
+   ESSourceBuffer vertSource = { NULL, 0, 0 };
+   ESSourceBuffer fragSource = { NULL, 0, 0 };
+   unsigned long long key = 0xcbf29ce484222325ull;
+   GLuint programObject = 0;
+   const char *parts[3];
+   char mode[32];
+   char *name;
+   size_t nameLength;
+   size_t offset;
+   GLsizei i;
+
+   // The files, defines and varyings identify a variant
+   parts[0] = vertFileName;
+   parts[1] = fragFileName;
+   parts[2] = defines != NULL ? defines : "";
+   snprintf ( mode, sizeof ( mode ), "%d:%u", ( int ) numVaryings, ( unsigned int ) bufferMode );
+   name = VariantName ( parts, 3, varyings, numVaryings, mode, &nameLength );
+
+   if ( name == NULL )
+   {
+      esLog ( ES_LOG_ERROR, "Out of memory loading %s and %s\n", vertFileName, fragFileName );
+      return 0;
+   }
+
+   for ( offset = 0; offset < nameLength; offset += strlen ( name + offset ) + 1 )
+   {
+      key = HashString ( key, name + offset );
+   }
+
+   for ( i = 0; i < library->numVariants; i++ )
+   {
+      ESShaderVariant *variant = &library->variants[i];
+
+      if ( variant->key == key && variant->nameLength == nameLength &&
+            memcmp ( variant->name, name, nameLength ) == 0 )
+      {
+         free ( name );
+         return variant->programObject;
+      }
+   }
+
+   if ( library->numVariants == library->maxVariants )
+   {
+      int maxVariants = library->maxVariants > 0 ? library->maxVariants * 2 : 8;
+      ESShaderVariant *variants = realloc ( library->variants, maxVariants * sizeof ( ESShaderVariant ) );
+
+      if ( variants == NULL )
+      {
+         free ( name );
+         return 0;
+      }
+
+      library->variants = variants;
+      library->maxVariants = maxVariants;
+   }
+
+   if ( PreprocessFile ( library, &vertSource, vertFileName, defines, 0 ) &&
+         PreprocessFile ( library, &fragSource, fragFileName, defines, 0 ) )
+   {
+      programObject = esLoadProgramWithVaryings ( vertSource.data, fragSource.data,
+                                                  numVaryings, varyings, bufferMode );
+   }
+
+   free ( vertSource.data );
+   free ( fragSource.data );
+
+   // Failures are not cached, so fixing a file and loading again works
+   if ( programObject != 0 )
+   {
+      library->variants[library->numVariants].key = key;
+      library->variants[library->numVariants].programObject = programObject;
+      library->variants[library->numVariants].name = name;
+      library->variants[library->numVariants].nameLength = nameLength;
+      library->numVariants++;
+   }
+   else
+   {
+      free ( name );
+   }
+
+   return programObject;
+}
+
+///
+// esShaderLibraryLoadProgram()
+//
+GLuint ESUTIL_API esShaderLibraryLoadProgram ( ESShaderLibrary *library, const char *vertFileName,
+                                               const char *fragFileName, const char *defines )
+{
+   return esShaderLibraryLoadProgramWithVaryings ( library, vertFileName, fragFileName, defines,
+                                                   0, NULL, GL_INTERLEAVED_ATTRIBS );
+}
+
+///
+// esShaderLibraryDestroy()
+//
+void ESUTIL_API esShaderLibraryDestroy ( ESShaderLibrary *library )
+{
+   int i;
+
+   if ( library == NULL )
+   {
+      return;
+   }
+
+   for ( i = 0; i < library->numVariants; i++ )
+   {
+      esDeleteProgram ( library->esContext, library->variants[i].programObject );
+      free ( library->variants[i].name );
+   }
+
+   free ( library->variants );
+   free ( library );
+}
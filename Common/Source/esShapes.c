@@ -31,7 +31,8 @@
 //
 // ESShapes.c
 //
-//    Utility functions for generating shapes
+//    Utility functions for generating shapes, either into client arrays or
+//    uploaded once into an ESMesh
 //
 
 ///
@@ -53,6 +54,267 @@
 //
 //
 
+///
+// SplitMesh()
+//
+//    Split a triangle list into runs of triangles whose vertices all lie
+//    within ES_MAX_SHORT_VERTICES of each other, so each run can draw with
+//    GLushort indices relative to its lowest vertex.  The index offsets are
+//    left in indices, not bytes.  Returns the number of sub-meshes, 0 if a
+//    single triangle spans too far or out of memory.
+//
+static int SplitMesh ( const GLuint *indices, int numIndices, ESSubMesh **subMeshes )
+{
+   ESSubMesh *runs = NULL;
+   int numRuns = 0;
+   GLuint runMin = 0;
+   GLuint runMax = 0;
+   int i, j;
+
+   for ( i = 0; i + 2 < numIndices; i += 3 )
+   {
+      GLuint triMin = indices[i];
+      GLuint triMax = indices[i];
+
+      for ( j = 1; j < 3; j++ )
+      {
+         triMin = indices[i + j] < triMin ? indices[i + j] : triMin;
+         triMax = indices[i + j] > triMax ? indices[i + j] : triMax;
+      }
+
+      if ( triMax - triMin >= ES_MAX_SHORT_VERTICES )
+      {
+         free ( runs );
+         return 0;
+      }
+
+      if ( numRuns > 0 )
+      {
+         GLuint newMin = triMin < runMin ? triMin : runMin;
+         GLuint newMax = triMax > runMax ? triMax : runMax;
+
+         if ( newMax - newMin < ES_MAX_SHORT_VERTICES )
+         {
+            runMin = newMin;
+            runMax = newMax;
+            runs[numRuns - 1].numIndices += 3;
+            continue;
+         }
+
+         runs[numRuns - 1].firstVertex = runMin;
+      }
+
+      {
+         ESSubMesh *grown = realloc ( runs, ( numRuns + 1 ) * sizeof ( ESSubMesh ) );
+
+         if ( grown == NULL )
+         {
+            free ( runs );
+            return 0;
+         }
+
+         runs = grown;
+      }
+
+      memset ( &runs[numRuns], 0, sizeof ( ESSubMesh ) );
+      runs[numRuns].indexOffset = i;
+      runs[numRuns].numIndices = 3;
+      numRuns++;
+      runMin = triMin;
+      runMax = triMax;
+   }
+
+   if ( numRuns > 0 )
+   {
+      runs[numRuns - 1].firstVertex = runMin;
+   }
+
+   *subMeshes = runs;
+   return numRuns;
+}
+
+///
+// CreateMesh()
+//
+//    Interleave the generated arrays straight into a mapped vertex buffer,
+//    upload the indices as GLushort when the index policy allows and record
+//    both in a vertex array per sub-mesh.  Attributes with a location below
+//    0 are left out.
+//
+static GLboolean CreateMesh ( ESContext *esContext, ESMesh *mesh, int numVertices,
+                              const GLfloat *positions, GLint positionLoc,
+                              const GLfloat *normals, GLint normalLoc,
+                              const GLfloat *texCoords, GLint texCoordLoc,
+                              const GLuint *indices, int numIndices )
+{
+   GLfloat *dst;
+   GLushort *shortIndices;
+   int stride = 0;
+   int normalOffset;
+   int texCoordOffset;
+   int i, j, k;
+
+   memset ( mesh, 0, sizeof ( ESMesh ) );
+
+   if ( positions == NULL || indices == NULL )
+   {
+      return GL_FALSE;
+   }
+
+   // Offsets in floats, positions always come first for the bounding box
+   stride += 3;
+   normalOffset = stride;
+   stride += normalLoc >= 0 ? 3 : 0;
+   texCoordOffset = stride;
+   stride += texCoordLoc >= 0 ? 2 : 0;
+
+   mesh->mode = GL_TRIANGLES;
+   mesh->numVertices = numVertices;
+   mesh->numIndices = numIndices;
+   mesh->indexType = GL_UNSIGNED_INT;
+   mesh->vertexStride = stride * sizeof ( GLfloat );
+
+   if ( esGetIndexPolicy ( esContext ) == ES_INDEX_AUTO )
+   {
+      if ( numVertices <= ES_MAX_SHORT_VERTICES )
+      {
+         mesh->indexType = GL_UNSIGNED_SHORT;
+      }
+      else
+      {
+         mesh->numSubMeshes = SplitMesh ( indices, numIndices, &mesh->subMeshes );
+         mesh->indexType = mesh->numSubMeshes > 0 ? GL_UNSIGNED_SHORT : GL_UNSIGNED_INT;
+      }
+   }
+
+   if ( mesh->numSubMeshes == 0 )
+   {
+      mesh->subMeshes = calloc ( 1, sizeof ( ESSubMesh ) );
+
+      if ( mesh->subMeshes == NULL )
+      {
+         return GL_FALSE;
+      }
+
+      mesh->numSubMeshes = 1;
+      mesh->subMeshes[0].numIndices = numIndices;
+   }
+
+   for ( j = 0; j < 3; j++ )
+   {
+      mesh->boundsMin[j] = positions[j];
+      mesh->boundsMax[j] = positions[j];
+   }
+
+   glGenBuffers ( 1, &mesh->vertexBuffer );
+   glGenBuffers ( 1, &mesh->indexBuffer );
+
+   esBindBuffer ( esContext, GL_ARRAY_BUFFER, mesh->vertexBuffer );
+   glBufferData ( GL_ARRAY_BUFFER, numVertices * mesh->vertexStride, NULL, GL_STATIC_DRAW );
+
+   dst = glMapBufferRange ( GL_ARRAY_BUFFER, 0, numVertices * mesh->vertexStride,
+                            GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT );
+
+   if ( dst == NULL )
+   {
+      esMeshDestroy ( esContext, mesh );
+      return GL_FALSE;
+   }
+
+   for ( i = 0; i < numVertices; i++ )
+   {
+      for ( j = 0; j < 3; j++ )
+      {
+         GLfloat value = positions[i * 3 + j];
+
+         dst[j] = value;
+         mesh->boundsMin[j] = value < mesh->boundsMin[j] ? value : mesh->boundsMin[j];
+         mesh->boundsMax[j] = value > mesh->boundsMax[j] ? value : mesh->boundsMax[j];
+      }
+
+      if ( normalLoc >= 0 )
+      {
+         memcpy ( &dst[normalOffset], &normals[i * 3], 3 * sizeof ( GLfloat ) );
+      }
+
+      if ( texCoordLoc >= 0 )
+      {
+         memcpy ( &dst[texCoordOffset], &texCoords[i * 2], 2 * sizeof ( GLfloat ) );
+      }
+
+      dst += stride;
+   }
+
+   glUnmapBuffer ( GL_ARRAY_BUFFER );
+
+   // Sub-mesh index offsets are still counted in indices until here
+   esBindBuffer ( esContext, GL_COPY_WRITE_BUFFER, mesh->indexBuffer );
+
+   if ( mesh->indexType == GL_UNSIGNED_INT )
+   {
+      glBufferData ( GL_COPY_WRITE_BUFFER, numIndices * sizeof ( GLuint ), indices, GL_STATIC_DRAW );
+   }
+   else
+   {
+      shortIndices = malloc ( numIndices * sizeof ( GLushort ) );
+
+      if ( shortIndices == NULL )
+      {
+         esMeshDestroy ( esContext, mesh );
+         return GL_FALSE;
+      }
+
+      for ( k = 0; k < mesh->numSubMeshes; k++ )
+      {
+         const ESSubMesh *subMesh = &mesh->subMeshes[k];
+
+         for ( i = ( int ) subMesh->indexOffset; i < subMesh->indexOffset + subMesh->numIndices; i++ )
+         {
+            shortIndices[i] = ( GLushort ) ( indices[i] - subMesh->firstVertex );
+         }
+      }
+
+      glBufferData ( GL_COPY_WRITE_BUFFER, numIndices * sizeof ( GLushort ), shortIndices, GL_STATIC_DRAW );
+      free ( shortIndices );
+   }
+
+   // ES 3.0 has no base vertex draws, so each sub-mesh moves the attribute
+   // pointers to its first vertex instead
+   for ( k = 0; k < mesh->numSubMeshes; k++ )
+   {
+      ESSubMesh *subMesh = &mesh->subMeshes[k];
+      GLintptr base = ( GLintptr ) subMesh->firstVertex * mesh->vertexStride;
+
+      subMesh->indexOffset *= mesh->indexType == GL_UNSIGNED_SHORT ? sizeof ( GLushort ) : sizeof ( GLuint );
+
+      glGenVertexArrays ( 1, &subMesh->vertexArray );
+      esBindVertexArray ( esContext, subMesh->vertexArray );
+
+      glVertexAttribPointer ( positionLoc, 3, GL_FLOAT, GL_FALSE, mesh->vertexStride, ( const void * ) base );
+      glEnableVertexAttribArray ( positionLoc );
+
+      if ( normalLoc >= 0 )
+      {
+         glVertexAttribPointer ( normalLoc, 3, GL_FLOAT, GL_FALSE, mesh->vertexStride,
+                                 ( const void * ) ( base + normalOffset * sizeof ( GLfloat ) ) );
+         glEnableVertexAttribArray ( normalLoc );
+      }
+
+      if ( texCoordLoc >= 0 )
+      {
+         glVertexAttribPointer ( texCoordLoc, 2, GL_FLOAT, GL_FALSE, mesh->vertexStride,
+                                 ( const void * ) ( base + texCoordOffset * sizeof ( GLfloat ) ) );
+         glEnableVertexAttribArray ( texCoordLoc );
+      }
+
+      esBindBuffer ( esContext, GL_ELEMENT_ARRAY_BUFFER, mesh->indexBuffer );
+   }
+
+   esBindVertexArray ( esContext, 0 );
+
+   return GL_TRUE;
+}
+
 
 
 //////////////////////////////////////////////////////////////////
@@ -366,3 +628,125 @@ int ESUTIL_API esGenSquareGrid ( int size, GLfloat **vertices, GLuint **indices
 
    return numIndices;
 }
+
+//
+/// \brief Generates a sphere into a mesh, see esGenSphere
+//
+GLboolean ESUTIL_API esGenSphereToMesh ( ESContext *esContext, int numSlices, float radius,
+                                         GLint positionLoc, GLint normalLoc, GLint texCoordLoc, ESMesh *mesh )
+{
+   GLfloat *vertices = NULL;
+   GLfloat *normals = NULL;
+   GLfloat *texCoords = NULL;
+   GLuint *indices = NULL;
+   int numParallels = numSlices / 2;
+   int numIndices;
+   GLboolean result;
+
+   numIndices = esGenSphere ( numSlices, radius, &vertices, normalLoc >= 0 ? &normals : NULL,
+                              texCoordLoc >= 0 ? &texCoords : NULL, &indices );
+
+   result = CreateMesh ( esContext, mesh, ( numParallels + 1 ) * ( numSlices + 1 ),
+                         vertices, positionLoc, normals, normalLoc, texCoords, texCoordLoc,
+                         indices, numIndices );
+
+   free ( vertices );
+   free ( normals );
+   free ( texCoords );
+   free ( indices );
+
+   return result;
+}
+
+//
+/// \brief Generates a cube into a mesh, see esGenCube
+//
+GLboolean ESUTIL_API esGenCubeToMesh ( ESContext *esContext, float scale,
+                                       GLint positionLoc, GLint normalLoc, GLint texCoordLoc, ESMesh *mesh )
+{
+   GLfloat *vertices = NULL;
+   GLfloat *normals = NULL;
+   GLfloat *texCoords = NULL;
+   GLuint *indices = NULL;
+   int numIndices;
+   GLboolean result;
+
+   numIndices = esGenCube ( scale, &vertices, normalLoc >= 0 ? &normals : NULL,
+                            texCoordLoc >= 0 ? &texCoords : NULL, &indices );
+
+   result = CreateMesh ( esContext, mesh, 24, vertices, positionLoc, normals, normalLoc,
+                         texCoords, texCoordLoc, indices, numIndices );
+
+   free ( vertices );
+   free ( normals );
+   free ( texCoords );
+   free ( indices );
+
+   return result;
+}
+
+//
+/// \brief Generates a square grid into a mesh, see esGenSquareGrid
+//
+GLboolean ESUTIL_API esGenSquareGridToMesh ( ESContext *esContext, int size, GLint positionLoc, ESMesh *mesh )
+{
+   GLfloat *vertices = NULL;
+   GLuint *indices = NULL;
+   int numIndices;
+   GLboolean result;
+
+   numIndices = esGenSquareGrid ( size, &vertices, &indices );
+
+   result = CreateMesh ( esContext, mesh, size * size, vertices, positionLoc, NULL, -1, NULL, -1,
+                         indices, numIndices );
+
+   free ( vertices );
+   free ( indices );
+
+   return result;
+}
+
+//
+/// \brief Draws each sub-mesh of a mesh with its vertex array
+//
+void ESUTIL_API esMeshDraw ( ESContext *esContext, const ESMesh *mesh )
+{
+   int i;
+
+   for ( i = 0; i < mesh->numSubMeshes; i++ )
+   {
+      esBindVertexArray ( esContext, mesh->subMeshes[i].vertexArray );
+      glDrawElements ( mesh->mode, mesh->subMeshes[i].numIndices, mesh->indexType,
+                       ( const void * ) mesh->subMeshes[i].indexOffset );
+   }
+}
+
+//
+/// \brief Deletes the buffers and vertex arrays of a mesh
+//
+void ESUTIL_API esMeshDestroy ( ESContext *esContext, ESMesh *mesh )
+{
+   int i;
+
+   for ( i = 0; i < mesh->numSubMeshes; i++ )
+   {
+      if ( mesh->subMeshes[i].vertexArray != 0 )
+      {
+         esDeleteVertexArrays ( esContext, 1, &mesh->subMeshes[i].vertexArray );
+      }
+   }
+
+   free ( mesh->subMeshes );
+
+   if ( mesh->vertexBuffer != 0 )
+   {
+      esDeleteBuffers ( esContext, 1, &mesh->vertexBuffer );
+   }
+
+   if ( mesh->indexBuffer != 0 )
+   {
+      esDeleteBuffers ( esContext, 1, &mesh->indexBuffer );
+   }
+
+   memset ( mesh, 0, sizeof ( ESMesh ) );
+}
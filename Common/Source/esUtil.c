@@ -59,11 +59,52 @@ typedef FILE esFile;
 #include "FileWrapper.h"
 #endif
 
+#ifndef _WIN32
+#include <pthread.h>
+#endif
+
 ///
 //  Macros
 //
 #define INVERTED_BIT            (1 << 5)
 
+// Log messages are written by a drain thread where pthreads are available
+#ifdef _WIN32
+#define ES_LOG_SYNCHRONOUS
+#endif
+
+// Number of messages the log ring holds, a power of two
+#define ES_LOG_SLOTS            256
+
+// Longest log message including the terminator, longer ones are cut off
+#define ES_LOG_MESSAGE_SIZE     1024
+
+// Dirty rectangles passed to the swap, more are merged into their bounding box
+#define ES_MAX_DAMAGE_RECTS     16
+
+// Frames of damage kept for buffers older than the previous frame
+#define ES_DAMAGE_HISTORY       4
+
+// Texture units and vertex attributes the state cache tracks, higher ones pass through
+#define ES_STATE_TEXTURE_UNITS  16
+#define ES_STATE_VERTEX_ATTRIBS 16
+
+// Most frames an ESStreamBuffer can have in flight
+#define ES_MAX_STREAM_FRAMES    8
+
+// Nanoseconds an ES_STREAM_WAIT buffer waits on a fence between checks
+#define ES_STREAM_WAIT_TIMEOUT  1000000000ull
+
+// EGL_EXT_buffer_age is newer than the bundled eglext.h
+#ifndef EGL_BUFFER_AGE_EXT
+#define EGL_BUFFER_AGE_EXT      0x313D
+#endif
+
+// EGL_MESA_platform_surfaceless is newer than the bundled eglext.h
+#ifndef EGL_PLATFORM_SURFACELESS_MESA
+#define EGL_PLATFORM_SURFACELESS_MESA 0x31DD
+#endif
+
 ///
 //  Types
 //
@@ -96,6 +137,229 @@ __attribute__ ( ( packed ) )
 #pragma pack(pop,x1)
 #endif
 
+#ifndef ES_LOG_SYNCHRONOUS
+// One message in the log ring.  Producers and the drain thread take turns
+// on a slot through its sequence number (bounded queue after D. Vyukov):
+// sequence == pos means free for the producer claiming pos, pos + 1 means
+// published and waiting for the drain thread.
+typedef struct
+{
+   unsigned int   sequence;
+   int            level;
+   int            length;
+   char           text[ES_LOG_MESSAGE_SIZE];
+} ESLogSlot;
+
+// Multi-producer, single-consumer log ring
+typedef struct
+{
+   ESLogSlot      slots[ES_LOG_SLOTS];
+
+   // Next position claimed by a producer and read by the drain thread
+   unsigned int   enqueuePos;
+   unsigned int   dequeuePos;
+
+   // Messages dropped because the ring was full, and how many were reported
+   unsigned int   dropped;
+   unsigned int   reportedDropped;
+
+   // Set while the drain thread waits on 'wake'
+   int            sleeping;
+   int            running;
+   int            quit;
+
+   pthread_mutex_t mutex;
+   pthread_cond_t wake;
+   pthread_cond_t drained;
+   pthread_t      thread;
+} ESLog;
+
+static ESLog s_log;
+static pthread_once_t s_logOnce = PTHREAD_ONCE_INIT;
+#endif
+
+// Messages below this level are discarded
+static int s_logLevel = ES_LOG_INFO;
+
+#ifndef __APPLE__
+// EGL_KHR_swap_buffers_with_damage / EGL_EXT_swap_buffers_with_damage
+typedef EGLBoolean ( EGLAPIENTRYP ESSwapBuffersWithDamageProc ) ( EGLDisplay dpy, EGLSurface surface,
+                                                                  EGLint *rects, EGLint numRects );
+#endif
+
+// Damage tracking of a window, see esAddDamageRect
+struct ESDamage
+{
+#ifndef __APPLE__
+   // EGL_EXT_buffer_age is supported
+   GLboolean      bufferAge;
+
+   // NULL if the swap cannot take damage rectangles
+   ESSwapBuffersWithDamageProc swapBuffersWithDamage;
+#endif
+
+   // Rectangles (x, y, width, height) of the current frame and their bounding box
+   GLint          rects[ES_MAX_DAMAGE_RECTS * 4];
+   int            numRects;
+   GLint          bounds[4];
+
+   // Bounding boxes of the previous frames, most recent first
+   GLint          history[ES_DAMAGE_HISTORY][4];
+   int            historyCount;
+
+   // Age of the back buffer, -1 until queried this frame
+   int            age;
+};
+
+// Buffer targets the state cache tracks, GL_ELEMENT_ARRAY_BUFFER is
+// vertex array state and kept separately
+static const GLenum s_stateBufferTargets[] =
+{
+   GL_ARRAY_BUFFER, GL_UNIFORM_BUFFER, GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER,
+   GL_PIXEL_PACK_BUFFER, GL_PIXEL_UNPACK_BUFFER, GL_TRANSFORM_FEEDBACK_BUFFER
+};
+
+static const GLenum s_stateTextureTargets[] =
+{
+   GL_TEXTURE_2D, GL_TEXTURE_3D, GL_TEXTURE_CUBE_MAP, GL_TEXTURE_2D_ARRAY
+};
+
+static const GLenum s_stateCapabilities[] =
+{
+   GL_BLEND, GL_CULL_FACE, GL_DEPTH_TEST, GL_DITHER, GL_POLYGON_OFFSET_FILL,
+   GL_PRIMITIVE_RESTART_FIXED_INDEX, GL_RASTERIZER_DISCARD, GL_SAMPLE_ALPHA_TO_COVERAGE,
+   GL_SAMPLE_COVERAGE, GL_SCISSOR_TEST, GL_STENCIL_TEST
+};
+
+#define ES_STATE_COUNT(array) ( int ) ( sizeof ( array ) / sizeof ( array[0] ) )
+
+// GL state last set through the cache, see esUseProgram.  Every value is
+// 0xFFFFFFFF while unknown, which no call sets.
+struct ESStateCache
+{
+   struct
+   {
+      GLuint      program;
+      GLuint      vertexArray;
+      GLuint      buffers[ES_STATE_COUNT ( s_stateBufferTargets )];
+
+      // Element array buffer and enabled attributes of vertex array 0
+      GLuint      elementBuffer;
+      GLuint      attribArrays[ES_STATE_VERTEX_ATTRIBS];
+
+      GLuint      activeTexture;
+      GLuint      textures[ES_STATE_TEXTURE_UNITS][ES_STATE_COUNT ( s_stateTextureTargets )];
+      GLuint      samplers[ES_STATE_TEXTURE_UNITS];
+      GLuint      capabilities[ES_STATE_COUNT ( s_stateCapabilities )];
+      GLuint      blendFunc[2];
+      GLuint      colorMask[4];
+      GLuint      depthMask;
+      GLuint      viewport[4];
+   } gl;
+
+   // Calls made and filtered this frame and last frame
+   unsigned int   issued;
+   unsigned int   elided;
+   unsigned int   frameIssued;
+   unsigned int   frameElided;
+};
+
+// Largest number of passes of a render queue, the top bits of a sort key
+#define ES_RENDER_PASSES      16
+
+// Sort key of a packet and where the packet is stored
+typedef struct
+{
+   ESSortKey      key;
+   unsigned int   index;
+} ESSortEntry;
+
+// Draws recorded for one frame, see esRenderQueueAdd
+struct ESRenderQueue
+{
+   ESDrawPacket  *packets;
+   ESSortEntry   *entries;
+   ESSortEntry   *sorted;
+   int            numPackets;
+   int            maxPackets;
+
+   // Called when submission reaches a pass
+   void ( ESCALLBACK *beginFuncs[ES_RENDER_PASSES] ) ( ESContext *, void * );
+   void          *beginData[ES_RENDER_PASSES];
+};
+
+// A vertex array built for one layout, buffers and index buffer
+typedef struct
+{
+   ESVertexLayout layout;
+   GLuint         buffers[ES_MAX_VERTEX_BUFFERS];
+   GLuint         indexBuffer;
+   unsigned int   hash;
+   GLuint         vertexArray;
+} ESVertexArrayEntry;
+
+// Vertex arrays built so far, see esVertexArrayCacheGet
+struct ESVertexArrayCache
+{
+   ESVertexArrayEntry *entries;
+   int            numEntries;
+   int            maxEntries;
+};
+
+// Buffer dynamic data is streamed through, see esStreamBufferBeginFrame
+struct ESStreamBuffer
+{
+   ESContext     *esContext;
+   GLuint         buffer;
+   GLenum         target;
+   GLint          alignment;
+
+   // ES_STREAM_ORPHAN or ES_STREAM_WAIT when the next region is still in use
+   int            policy;
+
+   // Each frame writes its own region of the buffer
+   GLsizeiptr     frameSize;
+   int            numFrames;
+   int            frame;
+
+   // Signalled once the GPU is done with the draws of a region
+   GLsync         fences[ES_MAX_STREAM_FRAMES];
+
+   // Region of the current frame while it is mapped
+   unsigned char *mapped;
+   GLintptr       used;
+   GLboolean      overflowed;
+
+   // Frames that had to orphan the buffer instead of reusing a region
+   unsigned int   orphans;
+};
+
+// A vertex and an index buffer meshes are packed into
+typedef struct
+{
+   GLuint         vertexBuffer;
+   GLuint         indexBuffer;
+   GLsizeiptr     vertexSize;
+   GLsizeiptr     indexSize;
+   GLsizeiptr     vertexUsed;
+   GLsizeiptr     indexUsed;
+
+   // GL_UNSIGNED_SHORT blocks hold at most ES_MAX_SHORT_VERTICES vertices
+   GLenum         indexType;
+} ESArenaBlock;
+
+// Static meshes packed into a few large buffers, see esGeometryArenaAdd
+struct ESGeometryArena
+{
+   ESContext     *esContext;
+   GLsizei        vertexStride;
+   GLsizeiptr     vertexBlockSize;
+   GLsizeiptr     indexBlockSize;
+
+   ESArenaBlock  *blocks;
+   int            numBlocks;
+};
+
 #ifndef __APPLE__
 
 ///
@@ -119,8 +383,115 @@ EGLint GetContextRenderableType ( EGLDisplay eglDisplay )
    // extension is not supported
    return EGL_OPENGL_ES2_BIT;
 }
+
+///
+// GetOffscreenDisplay()
+//
+//    Get an EGL display that does not need a window system.  Prefers the
+//    EGL_MESA_platform_surfaceless platform (e.g. Mesa llvmpipe on a headless
+//    render node) and falls back to the default display.
+//
+static EGLDisplay GetOffscreenDisplay ( void )
+{
+#ifdef EGL_EXT_platform_base
+   const char *extensions = eglQueryString ( EGL_NO_DISPLAY, EGL_EXTENSIONS );
+
+   if ( extensions != NULL && strstr ( extensions, "EGL_MESA_platform_surfaceless" ) )
+   {
+      PFNEGLGETPLATFORMDISPLAYEXTPROC getPlatformDisplay =
+         ( PFNEGLGETPLATFORMDISPLAYEXTPROC ) eglGetProcAddress ( "eglGetPlatformDisplayEXT" );
+
+      if ( getPlatformDisplay != NULL )
+      {
+         EGLDisplay display = getPlatformDisplay ( EGL_PLATFORM_SURFACELESS_MESA, EGL_DEFAULT_DISPLAY, NULL );
+
+         if ( display != EGL_NO_DISPLAY )
+         {
+            return display;
+         }
+      }
+   }
+#endif
+   return eglGetDisplay ( EGL_DEFAULT_DISPLAY );
+}
 #endif
 
+#ifndef __APPLE__
+
+///
+// CreateDamage()
+//
+//    Look up the EGL extensions used for partial presentation
+//
+static ESDamage *CreateDamage ( ESContext *esContext )
+{
+   ESDamage *damage = calloc ( 1, sizeof ( ESDamage ) );
+   const char *extensions = eglQueryString ( esContext->eglDisplay, EGL_EXTENSIONS );
+
+   if ( damage == NULL )
+   {
+      return NULL;
+   }
+
+   damage->age = -1;
+
+   if ( extensions == NULL )
+   {
+      return damage;
+   }
+
+   damage->bufferAge = strstr ( extensions, "EGL_EXT_buffer_age" ) != NULL;
+
+   if ( strstr ( extensions, "EGL_KHR_swap_buffers_with_damage" ) != NULL )
+   {
+      damage->swapBuffersWithDamage =
+         ( ESSwapBuffersWithDamageProc ) eglGetProcAddress ( "eglSwapBuffersWithDamageKHR" );
+   }
+   else if ( strstr ( extensions, "EGL_EXT_swap_buffers_with_damage" ) != NULL )
+   {
+      damage->swapBuffersWithDamage =
+         ( ESSwapBuffersWithDamageProc ) eglGetProcAddress ( "eglSwapBuffersWithDamageEXT" );
+   }
+
+   return damage;
+}
+
+#endif // #ifndef __APPLE__
+
+///
+// UnionRect()
+//
+//    Grow rect (x, y, width, height) to also cover other
+//
+static void UnionRect ( GLint *rect, const GLint *other )
+{
+   GLint x1 = rect[0] + rect[2];
+   GLint y1 = rect[1] + rect[3];
+
+   if ( other[0] + other[2] > x1 )
+   {
+      x1 = other[0] + other[2];
+   }
+
+   if ( other[1] + other[3] > y1 )
+   {
+      y1 = other[1] + other[3];
+   }
+
+   if ( other[0] < rect[0] )
+   {
+      rect[0] = other[0];
+   }
+
+   if ( other[1] < rect[1] )
+   {
+      rect[1] = other[1];
+   }
+
+   rect[2] = x1 - rect[0];
+   rect[3] = y1 - rect[1];
+}
+
 //////////////////////////////////////////////////////////////////
 //
 //  Public Functions
@@ -138,6 +509,7 @@ EGLint GetContextRenderableType ( EGLDisplay eglDisplay )
 //          ES_WINDOW_DEPTH       - specifies that a depth buffer should be created
 //          ES_WINDOW_STENCIL     - specifies that a stencil buffer should be created
 //          ES_WINDOW_MULTISAMPLE - specifies that a multi-sample buffer should be created
+//          ES_WINDOW_OFFSCREEN   - specifies that rendering goes to a pbuffer, no native window is created
 //
 
 //任何使用EGL的应用程序必须执行的第一个操作就是创建和初始化与本地EGL显示的连接，对于iOS，该函数直接返回GL_TRUE，所以设置的width、height、title、flags无效,iOS可不调用此函数。
@@ -164,12 +536,26 @@ GLboolean ESUTIL_API esCreateWindow ( ESContext *esContext, const char *title, G
    esContext->height = height;
 #endif
 
-   if ( !WinCreate ( esContext, title ) )
+   // Flags requested on the command line apply to every window
+   flags |= esContext->options.windowFlags;
+   esContext->flags = flags;
+
+   if ( flags & ES_WINDOW_OFFSCREEN )
    {
-      return GL_FALSE;
+      // No native window, render into a pbuffer
+      esContext->eglNativeDisplay = EGL_DEFAULT_DISPLAY;
+      esContext->eglDisplay = GetOffscreenDisplay ( );
+   }
+   else
+   {
+      if ( !WinCreate ( esContext, title ) )
+      {
+         return GL_FALSE;
+      }
+      //1.打开与EGL显示服务器的连接
+      esContext->eglDisplay = eglGetDisplay( esContext->eglNativeDisplay );
    }
-    //1.打开与EGL显示服务器的连接
-   esContext->eglDisplay = eglGetDisplay( esContext->eglNativeDisplay );
+
    if ( esContext->eglDisplay == EGL_NO_DISPLAY )
    {
       return GL_FALSE;
@@ -195,6 +581,7 @@ GLboolean ESUTIL_API esCreateWindow ( ESContext *esContext, const char *title, G
          EGL_STENCIL_SIZE,   ( flags & ES_WINDOW_STENCIL ) ? 8 : EGL_DONT_CARE,
           //可用多重采样缓冲区位数
          EGL_SAMPLE_BUFFERS, ( flags & ES_WINDOW_MULTISAMPLE ) ? 1 : 0,
+         EGL_SURFACE_TYPE,   ( flags & ES_WINDOW_OFFSCREEN ) ? EGL_PBUFFER_BIT : EGL_WINDOW_BIT,
          // if EGL_KHR_create_context extension is supported, then we will use
          // EGL_OPENGL_ES3_BIT_KHR instead of EGL_OPENGL_ES2_BIT in the attribute list
          EGL_RENDERABLE_TYPE, GetContextRenderableType ( esContext->eglDisplay ),
@@ -212,6 +599,8 @@ GLboolean ESUTIL_API esCreateWindow ( ESContext *esContext, const char *title, G
       {
          return GL_FALSE;
       }
+
+      esContext->eglConfig = config;
    }
 
 
@@ -225,8 +614,22 @@ GLboolean ESUTIL_API esCreateWindow ( ESContext *esContext, const char *title, G
 #endif // ANDROID
 
    //4.创建屏幕上的渲染表面，最后的参数NULL表示使用默认值，对于OPENGL ES 3.0来说，只支持双缓冲区窗口，即创建的窗口渲染表面支持前台缓冲区和后台缓冲区。与该函数对应的是eglCreatePbufferSurface函数，用于创建屏幕外渲染区域（像素缓冲区），Pbuffer无法像窗口那样在完成渲染后交换缓冲区来显示在屏幕上，只能将数值复制到应用程序或将其绑定更改为纹理，通常用于生成纹理贴图。
-   esContext->eglSurface = eglCreateWindowSurface ( esContext->eglDisplay, config, 
-                                                    esContext->eglNativeWindow, NULL );
+   if ( flags & ES_WINDOW_OFFSCREEN )
+   {
+      EGLint pbufferAttribs[] =
+      {
+         EGL_WIDTH,  esContext->width,
+         EGL_HEIGHT, esContext->height,
+         EGL_NONE
+      };
+
+      esContext->eglSurface = eglCreatePbufferSurface ( esContext->eglDisplay, config, pbufferAttribs );
+   }
+   else
+   {
+      esContext->eglSurface = eglCreateWindowSurface ( esContext->eglDisplay, config,
+                                                       esContext->eglNativeWindow, NULL );
+   }
 
    if ( esContext->eglSurface == EGL_NO_SURFACE )
    {
@@ -248,108 +651,2365 @@ GLboolean ESUTIL_API esCreateWindow ( ESContext *esContext, const char *title, G
       return GL_FALSE;
    }
 
+   if ( esContext->options.overrideSwapInterval )
+   {
+      eglSwapInterval ( esContext->eglDisplay, esContext->options.swapInterval );
+   }
+
+   esContext->damage = CreateDamage ( esContext );
+
+   if ( esContext->options.programCacheDir != NULL )
+   {
+      esSetProgramCacheDir ( esContext->options.programCacheDir );
+   }
+
 #endif // #ifndef __APPLE__
 
    return GL_TRUE;
 }
 
 ///
-//  esRegisterDrawFunc()
+//  esDestroyContext()
 //
-void ESUTIL_API esRegisterDrawFunc ( ESContext *esContext, void ( ESCALLBACK *drawFunc ) ( ESContext * ) )
-{
-   esContext->drawFunc = drawFunc;
-}
-
-///
-//  esRegisterShutdownFunc()
+//      Release everything esCreateWindow and the application attached to a context
 //
-void ESUTIL_API esRegisterShutdownFunc ( ESContext *esContext, void ( ESCALLBACK *shutdownFunc ) ( ESContext * ) )
+void ESUTIL_API esDestroyContext ( ESContext *esContext )
 {
-   esContext->shutdownFunc = shutdownFunc;
-}
+   if ( esContext->shutdownFunc != NULL )
+   {
+      esContext->shutdownFunc ( esContext );
+      esContext->shutdownFunc = NULL;
+   }
 
-///
-//  esRegisterUpdateFunc()
-//
-void ESUTIL_API esRegisterUpdateFunc ( ESContext *esContext, void ( ESCALLBACK *updateFunc ) ( ESContext *, float ) )
-{
-   esContext->updateFunc = updateFunc;
-}
+   if ( esContext->userData != NULL )
+   {
+      free ( esContext->userData );
+      esContext->userData = NULL;
+   }
 
+   if ( esContext->snapshots[0] != NULL )
+   {
+      free ( esContext->snapshots[0] );
+      esContext->snapshots[0] = NULL;
+      esContext->snapshots[1] = NULL;
+   }
 
-///
-//  esRegisterKeyFunc()
-//
-void ESUTIL_API esRegisterKeyFunc ( ESContext *esContext,
-                                    void ( ESCALLBACK *keyFunc ) ( ESContext *, unsigned char, int, int ) )
-{
-   esContext->keyFunc = keyFunc;
-}
+   free ( esContext->damage );
+   esContext->damage = NULL;
 
+   free ( esContext->stateCache );
+   esContext->stateCache = NULL;
 
-///
-// esLogMessage()
-//
-//    Log an error message to the debug output for the platform
-//
-void ESUTIL_API esLogMessage ( const char *formatStr, ... )
-{
-   va_list params;
-   char buf[BUFSIZ];
+#ifndef __APPLE__
+   if ( esContext->eglDisplay != EGL_NO_DISPLAY )
+   {
+      eglMakeCurrent ( esContext->eglDisplay, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT );
 
-   va_start ( params, formatStr );
-   vsprintf ( buf, formatStr, params );
+      if ( esContext->eglContext != EGL_NO_CONTEXT )
+      {
+         eglDestroyContext ( esContext->eglDisplay, esContext->eglContext );
+      }
 
-#ifdef ANDROID
-   __android_log_print ( ANDROID_LOG_INFO, "esUtil" , "%s", buf );
-#else
-   printf ( "%s", buf );
-#endif
+      if ( esContext->eglSurface != EGL_NO_SURFACE )
+      {
+         eglDestroySurface ( esContext->eglDisplay, esContext->eglSurface );
+      }
 
-   va_end ( params );
+      // The offscreen display is shared by all contexts of the process, a
+      // window display belongs to the native display of this context alone
+      if ( ( esContext->flags & ES_WINDOW_OFFSCREEN ) == 0 )
+      {
+         eglTerminate ( esContext->eglDisplay );
+      }
+
+      eglReleaseThread ( );
+   }
+
+   esContext->eglDisplay = EGL_NO_DISPLAY;
+   esContext->eglContext = EGL_NO_CONTEXT;
+   esContext->eglSurface = EGL_NO_SURFACE;
+
+   if ( ( esContext->flags & ES_WINDOW_OFFSCREEN ) == 0 )
+   {
+      WinDestroy ( esContext );
+   }
+#endif // #ifndef __APPLE__
 }
 
 ///
-// esFileRead()
-//
-//    Wrapper for platform specific File open
+//  esAddDamageRect()
 //
-static esFile *esFileOpen ( void *ioContext, const char *fileName )
+void ESUTIL_API esAddDamageRect ( ESContext *esContext, GLint x, GLint y, GLint width, GLint height )
 {
-   esFile *pFile = NULL;
+   ESDamage *damage = esContext->damage;
+   GLint rect[4];
 
-#ifdef ANDROID
+   if ( damage == NULL )
+   {
+      return;
+   }
 
-   if ( ioContext != NULL )
+   // Clip to the window, EGL rejects rectangles outside the surface
+   if ( x < 0 )
    {
-      AAssetManager *assetManager = ( AAssetManager * ) ioContext;
-      pFile = AAssetManager_open ( assetManager, fileName, AASSET_MODE_BUFFER );
+      width += x;
+      x = 0;
    }
 
-#else
-#ifdef __APPLE__
-   // iOS: Remap the filename to a path that can be opened from the bundle.
-   fileName = GetBundleFileName ( fileName );
-#endif
+   if ( y < 0 )
+   {
+      height += y;
+      y = 0;
+   }
 
-   pFile = fopen ( fileName, "rb" );
-#endif
+   if ( x + width > esContext->width )
+   {
+      width = esContext->width - x;
+   }
 
-   return pFile;
-}
+   if ( y + height > esContext->height )
+   {
+      height = esContext->height - y;
+   }
 
-///
-// esFileRead()
-//
-//    Wrapper for platform specific File close
-//
-static void esFileClose ( esFile *pFile )
-{
-   if ( pFile != NULL )
+   if ( width <= 0 || height <= 0 )
    {
-#ifdef ANDROID
-      AAsset_close ( pFile );
+      return;
+   }
+
+   rect[0] = x;
+   rect[1] = y;
+   rect[2] = width;
+   rect[3] = height;
+
+   if ( damage->numRects == 0 )
+   {
+      memcpy ( damage->bounds, rect, sizeof ( rect ) );
+   }
+   else
+   {
+      UnionRect ( damage->bounds, rect );
+   }
+
+   // Too many rectangles, present their bounding box instead
+   if ( damage->numRects == ES_MAX_DAMAGE_RECTS )
+   {
+      memcpy ( damage->rects, damage->bounds, sizeof ( damage->bounds ) );
+      damage->numRects = 1;
+      return;
+   }
+
+   memcpy ( &damage->rects[damage->numRects * 4], rect, sizeof ( rect ) );
+   damage->numRects++;
+}
+
+///
+//  esGetBufferAge()
+//
+int ESUTIL_API esGetBufferAge ( ESContext *esContext )
+{
+   ESDamage *damage = esContext->damage;
+
+   if ( damage == NULL )
+   {
+      return 0;
+   }
+
+   if ( damage->age < 0 )
+   {
+      damage->age = 0;
+
+#ifndef __APPLE__
+      // A pbuffer is never swapped, it always holds the previous frame
+      if ( esContext->flags & ES_WINDOW_OFFSCREEN )
+      {
+         damage->age = 1;
+      }
+      else if ( damage->bufferAge )
+      {
+         EGLint age = 0;
+
+         if ( eglQuerySurface ( esContext->eglDisplay, esContext->eglSurface, EGL_BUFFER_AGE_EXT, &age ) )
+         {
+            damage->age = age;
+         }
+      }
+#endif
+   }
+
+   return damage->age;
+}
+
+///
+//  esGetRepaintRect()
+//
+//      The damage of this frame plus the damage of every frame the back
+//      buffer has missed since it was last drawn into
+//
+void ESUTIL_API esGetRepaintRect ( ESContext *esContext, GLint rect[4] )
+{
+   ESDamage *damage = esContext->damage;
+   int age = esGetBufferAge ( esContext );
+   int i;
+
+   rect[0] = 0;
+   rect[1] = 0;
+   rect[2] = esContext->width;
+   rect[3] = esContext->height;
+
+   if ( damage == NULL || damage->numRects == 0 || age == 0 || age - 1 > damage->historyCount )
+   {
+      return;
+   }
+
+   memcpy ( rect, damage->bounds, sizeof ( damage->bounds ) );
+
+   for ( i = 0; i < age - 1; i++ )
+   {
+      UnionRect ( rect, damage->history[i] );
+   }
+}
+
+///
+//  esSwapBuffers()
+//
+//      Present the frame with its damage, if any was reported, and start
+//      tracking the next one
+//
+void esSwapBuffers ( ESContext *esContext )
+{
+   ESDamage *damage = esContext->damage;
+
+   // The state cache counts per frame
+   if ( esContext->stateCache != NULL )
+   {
+      esContext->stateCache->frameIssued = esContext->stateCache->issued;
+      esContext->stateCache->frameElided = esContext->stateCache->elided;
+      esContext->stateCache->issued = 0;
+      esContext->stateCache->elided = 0;
+   }
+
+#ifndef __APPLE__
+   // A pbuffer has no back buffer to present, just submit the frame
+   if ( esContext->flags & ES_WINDOW_OFFSCREEN )
+   {
+      glFlush ();
+   }
+   else if ( damage != NULL && damage->numRects > 0 && damage->swapBuffersWithDamage != NULL )
+   {
+      damage->swapBuffersWithDamage ( esContext->eglDisplay, esContext->eglSurface,
+                                      ( EGLint * ) damage->rects, damage->numRects );
+   }
+   else
+   {
+      eglSwapBuffers ( esContext->eglDisplay, esContext->eglSurface );
+   }
+#endif
+
+   if ( damage == NULL )
+   {
+      return;
+   }
+
+   // Without reported damage the whole window changed
+   if ( damage->numRects == 0 )
+   {
+      damage->bounds[0] = 0;
+      damage->bounds[1] = 0;
+      damage->bounds[2] = esContext->width;
+      damage->bounds[3] = esContext->height;
+   }
+
+   memmove ( &damage->history[1], &damage->history[0], sizeof ( damage->history ) - sizeof ( damage->history[0] ) );
+   memcpy ( damage->history[0], damage->bounds, sizeof ( damage->bounds ) );
+
+   if ( damage->historyCount < ES_DAMAGE_HISTORY )
+   {
+      damage->historyCount++;
+   }
+
+   damage->numRects = 0;
+   damage->age = -1;
+}
+
+///
+//  esReadFramePixels()
+//
+//      Read the bottom-left width x height pixels of the frame that will be
+//      presented as bottom-up RGBA, into pixels or at that offset of the
+//      bound pixel pack buffer.  Draw callbacks may
+//      end with an offscreen framebuffer or another read buffer selected, so
+//      both are switched to the back buffer and restored afterwards.
+//
+void esReadFramePixels ( GLsizei width, GLsizei height, GLvoid *pixels )
+{
+   GLint readFramebuffer;
+   GLint readBuffer;
+   GLint packAlignment;
+
+   glGetIntegerv ( GL_READ_FRAMEBUFFER_BINDING, &readFramebuffer );
+   glBindFramebuffer ( GL_READ_FRAMEBUFFER, 0 );
+   glGetIntegerv ( GL_READ_BUFFER, &readBuffer );
+   glReadBuffer ( GL_BACK );
+   glGetIntegerv ( GL_PACK_ALIGNMENT, &packAlignment );
+   glPixelStorei ( GL_PACK_ALIGNMENT, 4 );
+
+   glReadPixels ( 0, 0, width, height, GL_RGBA, GL_UNSIGNED_BYTE, pixels );
+
+   glPixelStorei ( GL_PACK_ALIGNMENT, packAlignment );
+   glReadBuffer ( readBuffer );
+   glBindFramebuffer ( GL_READ_FRAMEBUFFER, readFramebuffer );
+}
+
+///
+//  esRegisterDrawFunc()
+//
+void ESUTIL_API esRegisterDrawFunc ( ESContext *esContext, void ( ESCALLBACK *drawFunc ) ( ESContext * ) )
+{
+   esContext->drawFunc = drawFunc;
+}
+
+///
+//  esRegisterShutdownFunc()
+//
+void ESUTIL_API esRegisterShutdownFunc ( ESContext *esContext, void ( ESCALLBACK *shutdownFunc ) ( ESContext * ) )
+{
+   esContext->shutdownFunc = shutdownFunc;
+}
+
+///
+//  esRegisterUpdateFunc()
+//
+void ESUTIL_API esRegisterUpdateFunc ( ESContext *esContext, void ( ESCALLBACK *updateFunc ) ( ESContext *, float ) )
+{
+   esContext->updateFunc = updateFunc;
+}
+
+
+///
+//  esRegisterKeyFunc()
+//
+void ESUTIL_API esRegisterKeyFunc ( ESContext *esContext,
+                                    void ( ESCALLBACK *keyFunc ) ( ESContext *, unsigned char, int, int ) )
+{
+   esContext->keyFunc = keyFunc;
+}
+
+///
+//  esEnablePipeline()
+//
+//    Both snapshots come from one allocation, released by the platform
+//    layer together with userData.
+//
+GLboolean ESUTIL_API esEnablePipeline ( ESContext *esContext, size_t snapshotSize )
+{
+   // Keep the second snapshot 16-byte aligned
+   size_t stride = ( snapshotSize + 15 ) & ~( size_t ) 15;
+   char *snapshots = calloc ( 2, stride );
+
+   if ( snapshots == NULL )
+   {
+      return GL_FALSE;
+   }
+
+   free ( esContext->snapshots[0] );
+   esContext->snapshots[0] = snapshots;
+   esContext->snapshots[1] = snapshots + stride;
+   esContext->updateSnapshot = 0;
+   esContext->drawSnapshot = 0;
+
+   return GL_TRUE;
+}
+
+///
+//  esGetUpdateSnapshot()
+//
+void *ESUTIL_API esGetUpdateSnapshot ( ESContext *esContext )
+{
+   return esContext->snapshots[esContext->updateSnapshot];
+}
+
+///
+//  esGetDrawSnapshot()
+//
+const void *ESUTIL_API esGetDrawSnapshot ( ESContext *esContext )
+{
+   return esContext->snapshots[esContext->drawSnapshot];
+}
+
+///
+//  esRequestRedraw()
+//
+void ESUTIL_API esRequestRedraw ( ESContext *esContext )
+{
+   esContext->redraw = GL_TRUE;
+}
+
+///
+//  esRequestExit()
+//
+void ESUTIL_API esRequestExit ( ESContext *esContext )
+{
+   esContext->exitRequested = GL_TRUE;
+}
+
+///
+//  esSeedRandom()
+//
+void ESUTIL_API esSeedRandom ( ESContext *esContext, unsigned int seed )
+{
+   esContext->randomState = seed + esContext->options.randomSeed;
+}
+
+///
+//  esRandom()
+//
+//    Counter based generator (Weyl sequence through an integer hash).  The
+//    state lives in the context, so results do not depend on the C library
+//    or on other contexts calling rand().
+//
+unsigned int ESUTIL_API esRandom ( ESContext *esContext )
+{
+   unsigned int x;
+
+   esContext->randomState += 0x9E3779B9u;
+   x = esContext->randomState;
+   x ^= x >> 16;
+   x *= 0x7FEB352Du;
+   x ^= x >> 15;
+   x *= 0x846CA68Bu;
+   x ^= x >> 16;
+
+   return x & ES_RANDOM_MAX;
+}
+
+///
+//  GetStateCache()
+//
+//    The cache is created the first time it is used, NULL if out of memory
+//
+static ESStateCache *GetStateCache ( ESContext *esContext )
+{
+   if ( esContext->stateCache == NULL )
+   {
+      esContext->stateCache = calloc ( 1, sizeof ( ESStateCache ) );
+
+      if ( esContext->stateCache != NULL )
+      {
+         memset ( &esContext->stateCache->gl, 0xFF, sizeof ( esContext->stateCache->gl ) );
+      }
+   }
+
+   return esContext->stateCache;
+}
+
+///
+//  StateChanged()
+//
+//    Store a new value for a piece of state and count the call.  Returns
+//    GL_FALSE if GL already has the value and the call can be skipped.
+//
+static GLboolean StateChanged ( ESStateCache *cache, GLuint *state, GLuint value )
+{
+   if ( cache == NULL )
+   {
+      return GL_TRUE;
+   }
+
+   if ( *state == value )
+   {
+      cache->elided++;
+      return GL_FALSE;
+   }
+
+   *state = value;
+   cache->issued++;
+
+   return GL_TRUE;
+}
+
+///
+//  StatesChanged()
+//
+//    StateChanged() for state set by one call with several values
+//
+static GLboolean StatesChanged ( ESStateCache *cache, GLuint *state, const GLuint *values, int count )
+{
+   if ( cache == NULL )
+   {
+      return GL_TRUE;
+   }
+
+   if ( memcmp ( state, values, count * sizeof ( GLuint ) ) == 0 )
+   {
+      cache->elided++;
+      return GL_FALSE;
+   }
+
+   memcpy ( state, values, count * sizeof ( GLuint ) );
+   cache->issued++;
+
+   return GL_TRUE;
+}
+
+///
+//  FindState()
+//
+//    Index of a GL enum in one of the tracked state tables, -1 if untracked
+//
+static int FindState ( const GLenum *table, int count, GLenum value )
+{
+   int i;
+
+   for ( i = 0; i < count; i++ )
+   {
+      if ( table[i] == value )
+      {
+         return i;
+      }
+   }
+
+   return -1;
+}
+
+///
+//  esUseProgram()
+//
+void ESUTIL_API esUseProgram ( ESContext *esContext, GLuint program )
+{
+   ESStateCache *cache = GetStateCache ( esContext );
+
+   if ( StateChanged ( cache, cache != NULL ? &cache->gl.program : NULL, program ) )
+   {
+      glUseProgram ( program );
+   }
+}
+
+///
+//  esBindVertexArray()
+//
+void ESUTIL_API esBindVertexArray ( ESContext *esContext, GLuint vertexArray )
+{
+   ESStateCache *cache = GetStateCache ( esContext );
+
+   if ( StateChanged ( cache, cache != NULL ? &cache->gl.vertexArray : NULL, vertexArray ) )
+   {
+      glBindVertexArray ( vertexArray );
+   }
+}
+
+///
+//  esBindBuffer()
+//
+void ESUTIL_API esBindBuffer ( ESContext *esContext, GLenum target, GLuint buffer )
+{
+   ESStateCache *cache = GetStateCache ( esContext );
+   GLuint *state = NULL;
+
+   if ( cache != NULL )
+   {
+      int index = FindState ( s_stateBufferTargets, ES_STATE_COUNT ( s_stateBufferTargets ), target );
+
+      if ( index >= 0 )
+      {
+         state = &cache->gl.buffers[index];
+      }
+      else if ( target == GL_ELEMENT_ARRAY_BUFFER && cache->gl.vertexArray == 0 )
+      {
+         state = &cache->gl.elementBuffer;
+      }
+   }
+
+   // Untracked targets and element buffers of other vertex arrays pass through
+   if ( state == NULL || StateChanged ( cache, state, buffer ) )
+   {
+      glBindBuffer ( target, buffer );
+   }
+}
+
+///
+//  BufferBound()
+//
+//    Record a generic buffer binding made by an indexed bind call
+//
+static void BufferBound ( ESStateCache *cache, GLenum target, GLuint buffer )
+{
+   int index = FindState ( s_stateBufferTargets, ES_STATE_COUNT ( s_stateBufferTargets ), target );
+
+   if ( cache != NULL && index >= 0 )
+   {
+      cache->gl.buffers[index] = buffer;
+      cache->issued++;
+   }
+}
+
+///
+//  esBindBufferRange()
+//
+void ESUTIL_API esBindBufferRange ( ESContext *esContext, GLenum target, GLuint index, GLuint buffer,
+                                    GLintptr offset, GLsizeiptr size )
+{
+   glBindBufferRange ( target, index, buffer, offset, size );
+   BufferBound ( GetStateCache ( esContext ), target, buffer );
+}
+
+///
+//  esBindBufferBase()
+//
+void ESUTIL_API esBindBufferBase ( ESContext *esContext, GLenum target, GLuint index, GLuint buffer )
+{
+   glBindBufferBase ( target, index, buffer );
+   BufferBound ( GetStateCache ( esContext ), target, buffer );
+}
+
+///
+//  esDeleteBuffers()
+//
+void ESUTIL_API esDeleteBuffers ( ESContext *esContext, GLsizei n, const GLuint *buffers )
+{
+   ESStateCache *cache = esContext->stateCache;
+   GLsizei i;
+   int j;
+
+   for ( i = 0; cache != NULL && i < n; i++ )
+   {
+      if ( buffers[i] == 0 )
+      {
+         continue;
+      }
+
+      for ( j = 0; j < ES_STATE_COUNT ( s_stateBufferTargets ); j++ )
+      {
+         if ( cache->gl.buffers[j] == buffers[i] )
+         {
+            cache->gl.buffers[j] = 0;
+         }
+      }
+
+      // Only the bound vertex array loses its element buffer, vertex array 0
+      // keeps a dangling one if another is bound
+      if ( cache->gl.elementBuffer == buffers[i] )
+      {
+         cache->gl.elementBuffer = cache->gl.vertexArray == 0 ? 0 : 0xFFFFFFFF;
+      }
+   }
+
+   glDeleteBuffers ( n, buffers );
+}
+
+///
+//  esDeleteVertexArrays()
+//
+void ESUTIL_API esDeleteVertexArrays ( ESContext *esContext, GLsizei n, const GLuint *vertexArrays )
+{
+   ESStateCache *cache = esContext->stateCache;
+   GLsizei i;
+
+   // Deleting the bound vertex array binds vertex array 0, whose element
+   // buffer and attribute arrays the cache still has
+   for ( i = 0; cache != NULL && i < n; i++ )
+   {
+      if ( vertexArrays[i] != 0 && cache->gl.vertexArray == vertexArrays[i] )
+      {
+         cache->gl.vertexArray = 0;
+      }
+   }
+
+   glDeleteVertexArrays ( n, vertexArrays );
+}
+
+///
+//  esDeleteTextures()
+//
+void ESUTIL_API esDeleteTextures ( ESContext *esContext, GLsizei n, const GLuint *textures )
+{
+   ESStateCache *cache = esContext->stateCache;
+   GLsizei i;
+   int unit;
+   int j;
+
+   for ( i = 0; cache != NULL && i < n; i++ )
+   {
+      if ( textures[i] == 0 )
+      {
+         continue;
+      }
+
+      for ( unit = 0; unit < ES_STATE_TEXTURE_UNITS; unit++ )
+      {
+         for ( j = 0; j < ES_STATE_COUNT ( s_stateTextureTargets ); j++ )
+         {
+            if ( cache->gl.textures[unit][j] == textures[i] )
+            {
+               cache->gl.textures[unit][j] = 0;
+            }
+         }
+      }
+   }
+
+   glDeleteTextures ( n, textures );
+}
+
+///
+//  esDeleteProgram()
+//
+void ESUTIL_API esDeleteProgram ( ESContext *esContext, GLuint program )
+{
+   ESStateCache *cache = esContext->stateCache;
+
+   // GL keeps a deleted program in use until another one is, so the name
+   // can not be recycled while cached.  Forget it anyway, plain GL calls
+   // made since the last esUseProgram are not visible here.
+   if ( cache != NULL && program != 0 && cache->gl.program == program )
+   {
+      cache->gl.program = 0xFFFFFFFF;
+   }
+
+   glDeleteProgram ( program );
+}
+
+///
+//  esBindTexture()
+//
+void ESUTIL_API esBindTexture ( ESContext *esContext, GLuint unit, GLenum target, GLuint texture )
+{
+   ESStateCache *cache = GetStateCache ( esContext );
+   int index = FindState ( s_stateTextureTargets, ES_STATE_COUNT ( s_stateTextureTargets ), target );
+
+   if ( cache == NULL || index < 0 || unit >= ES_STATE_TEXTURE_UNITS )
+   {
+      glActiveTexture ( GL_TEXTURE0 + unit );
+      glBindTexture ( target, texture );
+
+      if ( cache != NULL )
+      {
+         cache->gl.activeTexture = unit;
+      }
+
+      return;
+   }
+
+   // The unit switch is part of this one call and not counted on its own
+   if ( StateChanged ( cache, &cache->gl.textures[unit][index], texture ) )
+   {
+      if ( cache->gl.activeTexture != unit )
+      {
+         cache->gl.activeTexture = unit;
+         glActiveTexture ( GL_TEXTURE0 + unit );
+      }
+
+      glBindTexture ( target, texture );
+   }
+}
+
+///
+//  esBindSampler()
+//
+void ESUTIL_API esBindSampler ( ESContext *esContext, GLuint unit, GLuint sampler )
+{
+   ESStateCache *cache = GetStateCache ( esContext );
+
+   if ( cache == NULL || unit >= ES_STATE_TEXTURE_UNITS ||
+         StateChanged ( cache, &cache->gl.samplers[unit], sampler ) )
+   {
+      glBindSampler ( unit, sampler );
+   }
+}
+
+///
+//  esEnable()
+//
+void ESUTIL_API esEnable ( ESContext *esContext, GLenum capability )
+{
+   ESStateCache *cache = GetStateCache ( esContext );
+   int index = FindState ( s_stateCapabilities, ES_STATE_COUNT ( s_stateCapabilities ), capability );
+
+   if ( index < 0 || StateChanged ( cache, cache != NULL ? &cache->gl.capabilities[index] : NULL, GL_TRUE ) )
+   {
+      glEnable ( capability );
+   }
+}
+
+///
+//  esDisable()
+//
+void ESUTIL_API esDisable ( ESContext *esContext, GLenum capability )
+{
+   ESStateCache *cache = GetStateCache ( esContext );
+   int index = FindState ( s_stateCapabilities, ES_STATE_COUNT ( s_stateCapabilities ), capability );
+
+   if ( index < 0 || StateChanged ( cache, cache != NULL ? &cache->gl.capabilities[index] : NULL, GL_FALSE ) )
+   {
+      glDisable ( capability );
+   }
+}
+
+///
+//  esEnableVertexAttribArray()
+//
+void ESUTIL_API esEnableVertexAttribArray ( ESContext *esContext, GLuint index )
+{
+   ESStateCache *cache = GetStateCache ( esContext );
+
+   // Only vertex array 0 is tracked, other vertex arrays keep their own state
+   if ( cache == NULL || cache->gl.vertexArray != 0 || index >= ES_STATE_VERTEX_ATTRIBS ||
+         StateChanged ( cache, &cache->gl.attribArrays[index], GL_TRUE ) )
+   {
+      glEnableVertexAttribArray ( index );
+   }
+}
+
+///
+//  esDisableVertexAttribArray()
+//
+void ESUTIL_API esDisableVertexAttribArray ( ESContext *esContext, GLuint index )
+{
+   ESStateCache *cache = GetStateCache ( esContext );
+
+   if ( cache == NULL || cache->gl.vertexArray != 0 || index >= ES_STATE_VERTEX_ATTRIBS ||
+         StateChanged ( cache, &cache->gl.attribArrays[index], GL_FALSE ) )
+   {
+      glDisableVertexAttribArray ( index );
+   }
+}
+
+///
+//  esBlendFunc()
+//
+void ESUTIL_API esBlendFunc ( ESContext *esContext, GLenum sfactor, GLenum dfactor )
+{
+   ESStateCache *cache = GetStateCache ( esContext );
+   GLuint blendFunc[2];
+
+   blendFunc[0] = sfactor;
+   blendFunc[1] = dfactor;
+
+   if ( StatesChanged ( cache, cache != NULL ? cache->gl.blendFunc : NULL, blendFunc, 2 ) )
+   {
+      glBlendFunc ( sfactor, dfactor );
+   }
+}
+
+///
+//  esColorMask()
+//
+void ESUTIL_API esColorMask ( ESContext *esContext, GLboolean red, GLboolean green, GLboolean blue, GLboolean alpha )
+{
+   ESStateCache *cache = GetStateCache ( esContext );
+   GLuint mask[4];
+
+   mask[0] = red;
+   mask[1] = green;
+   mask[2] = blue;
+   mask[3] = alpha;
+
+   if ( StatesChanged ( cache, cache != NULL ? cache->gl.colorMask : NULL, mask, 4 ) )
+   {
+      glColorMask ( red, green, blue, alpha );
+   }
+}
+
+///
+//  esDepthMask()
+//
+void ESUTIL_API esDepthMask ( ESContext *esContext, GLboolean flag )
+{
+   ESStateCache *cache = GetStateCache ( esContext );
+
+   if ( StateChanged ( cache, cache != NULL ? &cache->gl.depthMask : NULL, flag ) )
+   {
+      glDepthMask ( flag );
+   }
+}
+
+///
+//  esViewport()
+//
+void ESUTIL_API esViewport ( ESContext *esContext, GLint x, GLint y, GLsizei width, GLsizei height )
+{
+   ESStateCache *cache = GetStateCache ( esContext );
+   GLuint viewport[4];
+
+   viewport[0] = ( GLuint ) x;
+   viewport[1] = ( GLuint ) y;
+   viewport[2] = ( GLuint ) width;
+   viewport[3] = ( GLuint ) height;
+
+   if ( StatesChanged ( cache, cache != NULL ? cache->gl.viewport : NULL, viewport, 4 ) )
+   {
+      glViewport ( x, y, width, height );
+   }
+}
+
+///
+//  esInvalidateState()
+//
+void ESUTIL_API esInvalidateState ( ESContext *esContext )
+{
+   if ( esContext->stateCache != NULL )
+   {
+      memset ( &esContext->stateCache->gl, 0xFF, sizeof ( esContext->stateCache->gl ) );
+   }
+}
+
+///
+//  esGetStateCounts()
+//
+void ESUTIL_API esGetStateCounts ( ESContext *esContext, unsigned int *issued, unsigned int *elided )
+{
+   ESStateCache *cache = esContext->stateCache;
+
+   *issued = cache != NULL ? cache->frameIssued : 0;
+   *elided = cache != NULL ? cache->frameElided : 0;
+}
+
+///
+//  esSortKey()
+//
+ESSortKey ESUTIL_API esSortKey ( unsigned int pass, GLuint program, GLuint texture, GLuint vertexArray, float depth )
+{
+   ESSortKey key;
+
+   // Depth is quantized to 24 bits, out of range values sort at the ends
+   if ( depth < 0.0f )
+   {
+      depth = 0.0f;
+   }
+   else if ( depth > 1.0f )
+   {
+      depth = 1.0f;
+   }
+
+   // Object names only group draws, so names above 12 bits may share a bucket
+   key  = ( ESSortKey ) ( pass & 0xF ) << 60;
+   key |= ( ESSortKey ) ( program & 0xFFF ) << 48;
+   key |= ( ESSortKey ) ( texture & 0xFFF ) << 36;
+   key |= ( ESSortKey ) ( vertexArray & 0xFFF ) << 24;
+   key |= ( ESSortKey ) ( depth * 0xFFFFFF );
+
+   return key;
+}
+
+///
+//  esRenderQueueCreate()
+//
+ESRenderQueue *ESUTIL_API esRenderQueueCreate ( void )
+{
+   return calloc ( 1, sizeof ( ESRenderQueue ) );
+}
+
+///
+//  esRenderQueueSetPass()
+//
+void ESUTIL_API esRenderQueueSetPass ( ESRenderQueue *queue, unsigned int pass,
+                                       void ( ESCALLBACK *beginFunc ) ( ESContext *, void * ), void *data )
+{
+   if ( pass >= ES_RENDER_PASSES )
+   {
+      esLogMessage ( "esRenderQueueSetPass: pass %u out of range\n", pass );
+      return;
+   }
+
+   queue->beginFuncs[pass] = beginFunc;
+   queue->beginData[pass] = data;
+}
+
+///
+//  esRenderQueueAdd()
+//
+ESDrawPacket *ESUTIL_API esRenderQueueAdd ( ESRenderQueue *queue, ESSortKey key )
+{
+   ESDrawPacket *packet;
+
+   if ( queue->numPackets == queue->maxPackets )
+   {
+      int maxPackets = queue->maxPackets > 0 ? queue->maxPackets * 2 : 64;
+      ESDrawPacket *packets = realloc ( queue->packets, maxPackets * sizeof ( ESDrawPacket ) );
+      ESSortEntry *entries = realloc ( queue->entries, maxPackets * sizeof ( ESSortEntry ) );
+      ESSortEntry *sorted = realloc ( queue->sorted, maxPackets * sizeof ( ESSortEntry ) );
+
+      if ( packets != NULL )
+      {
+         queue->packets = packets;
+      }
+
+      if ( entries != NULL )
+      {
+         queue->entries = entries;
+      }
+
+      if ( sorted != NULL )
+      {
+         queue->sorted = sorted;
+      }
+
+      if ( packets == NULL || entries == NULL || sorted == NULL )
+      {
+         esLogMessage ( "esRenderQueueAdd: out of memory for %d packets\n", maxPackets );
+         return NULL;
+      }
+
+      queue->maxPackets = maxPackets;
+   }
+
+   queue->entries[queue->numPackets].key = key;
+   queue->entries[queue->numPackets].index = queue->numPackets;
+
+   packet = &queue->packets[queue->numPackets++];
+   memset ( packet, 0, sizeof ( ESDrawPacket ) );
+
+   return packet;
+}
+
+///
+//  SortEntries()
+//
+//    Least significant digit radix sort of the recorded sort keys, one byte
+//    per pass.  Bytes every key shares are skipped, which for most frames is
+//    all but a few.  Returns the sorted array, entries or the scratch array.
+//
+static ESSortEntry *SortEntries ( ESSortEntry *entries, ESSortEntry *scratch, int count )
+{
+   int shift;
+
+   for ( shift = 0; shift < 64; shift += 8 )
+   {
+      int histogram[256];
+      int i;
+
+      memset ( histogram, 0, sizeof ( histogram ) );
+
+      for ( i = 0; i < count; i++ )
+      {
+         histogram[( entries[i].key >> shift ) & 0xFF]++;
+      }
+
+      if ( histogram[( entries[0].key >> shift ) & 0xFF] == count )
+      {
+         continue;
+      }
+
+      // Turn the counts into the first slot of each digit
+      {
+         int total = 0;
+
+         for ( i = 0; i < 256; i++ )
+         {
+            int digitCount = histogram[i];
+
+            histogram[i] = total;
+            total += digitCount;
+         }
+      }
+
+      // Scatter in order, keeping the sort stable
+      for ( i = 0; i < count; i++ )
+      {
+         scratch[histogram[( entries[i].key >> shift ) & 0xFF]++] = entries[i];
+      }
+
+      {
+         ESSortEntry *swap = entries;
+
+         entries = scratch;
+         scratch = swap;
+      }
+   }
+
+   return entries;
+}
+
+///
+//  BeginPasses()
+//
+//    Call the begin functions of the passes after pass first up to last
+//
+static void BeginPasses ( ESContext *esContext, ESRenderQueue *queue, int first, int last )
+{
+   int pass;
+
+   for ( pass = first + 1; pass <= last; pass++ )
+   {
+      if ( queue->beginFuncs[pass] != NULL )
+      {
+         queue->beginFuncs[pass] ( esContext, queue->beginData[pass] );
+      }
+   }
+}
+
+///
+//  esRenderQueueSubmit()
+//
+void ESUTIL_API esRenderQueueSubmit ( ESContext *esContext, ESRenderQueue *queue )
+{
+   ESSortEntry *sorted = NULL;
+   int currentPass = -1;
+   int i;
+
+   if ( queue->numPackets > 0 )
+   {
+      sorted = SortEntries ( queue->entries, queue->sorted, queue->numPackets );
+   }
+
+   for ( i = 0; i < queue->numPackets; i++ )
+   {
+      const ESDrawPacket *packet = &queue->packets[sorted[i].index];
+      int pass = ( int ) ( sorted[i].key >> 60 );
+
+      if ( pass != currentPass )
+      {
+         BeginPasses ( esContext, queue, currentPass, pass );
+         currentPass = pass;
+      }
+
+      esUseProgram ( esContext, packet->program );
+      esBindVertexArray ( esContext, packet->vertexArray );
+
+      if ( packet->textureTarget != 0 )
+      {
+         esBindTexture ( esContext, 0, packet->textureTarget, packet->texture );
+         esBindSampler ( esContext, 0, packet->sampler );
+      }
+
+      if ( packet->setupFunc != NULL )
+      {
+         packet->setupFunc ( esContext, packet->data );
+      }
+
+      if ( packet->indexType != 0 )
+      {
+         if ( packet->instanceCount > 0 )
+         {
+            glDrawElementsInstanced ( packet->mode, packet->count, packet->indexType,
+                                      packet->indices, packet->instanceCount );
+         }
+         else
+         {
+            glDrawElements ( packet->mode, packet->count, packet->indexType, packet->indices );
+         }
+      }
+      else
+      {
+         if ( packet->instanceCount > 0 )
+         {
+            glDrawArraysInstanced ( packet->mode, packet->first, packet->count, packet->instanceCount );
+         }
+         else
+         {
+            glDrawArrays ( packet->mode, packet->first, packet->count );
+         }
+      }
+   }
+
+   // Passes without draws still run, they may clear or resolve
+   BeginPasses ( esContext, queue, currentPass, ES_RENDER_PASSES - 1 );
+
+   queue->numPackets = 0;
+}
+
+///
+//  esRenderQueueDestroy()
+//
+void ESUTIL_API esRenderQueueDestroy ( ESRenderQueue *queue )
+{
+   if ( queue == NULL )
+   {
+      return;
+   }
+
+   free ( queue->packets );
+   free ( queue->entries );
+   free ( queue->sorted );
+   free ( queue );
+}
+
+///
+//  LayoutBufferCount()
+//
+//    Number of buffer slots a vertex layout reads from
+//
+static int LayoutBufferCount ( const ESVertexLayout *layout )
+{
+   int count = 0;
+   int i;
+
+   for ( i = 0; i < layout->numAttribs; i++ )
+   {
+      if ( ( int ) layout->attribs[i].buffer >= count )
+      {
+         count = layout->attribs[i].buffer + 1;
+      }
+   }
+
+   return count;
+}
+
+///
+//  HashVertexKey()
+//
+//    FNV-1a hash of the fields of a layout and the buffers it is bound to.
+//    Fields are hashed one by one so padding in the structures is ignored.
+//
+static unsigned int HashVertexKey ( const ESVertexLayout *layout, const GLuint *buffers, int numBuffers,
+                                    GLuint indexBuffer )
+{
+   unsigned int hash = 2166136261u;
+   unsigned int values[8];
+   int i, j;
+
+   for ( i = 0; i < layout->numAttribs; i++ )
+   {
+      const ESVertexAttrib *attrib = &layout->attribs[i];
+
+      values[0] = attrib->location;
+      values[1] = ( unsigned int ) attrib->size;
+      values[2] = attrib->type;
+      values[3] = attrib->normalized;
+      values[4] = attrib->buffer;
+      values[5] = ( unsigned int ) attrib->stride;
+      values[6] = attrib->offset;
+      values[7] = attrib->divisor;
+
+      for ( j = 0; j < 8; j++ )
+      {
+         hash = ( hash ^ values[j] ) * 16777619u;
+      }
+   }
+
+   for ( i = 0; i < numBuffers; i++ )
+   {
+      hash = ( hash ^ buffers[i] ) * 16777619u;
+   }
+
+   return ( hash ^ indexBuffer ) * 16777619u;
+}
+
+///
+//  VertexKeyEqual()
+//
+static GLboolean VertexKeyEqual ( const ESVertexArrayEntry *entry, const ESVertexLayout *layout,
+                                  const GLuint *buffers, int numBuffers, GLuint indexBuffer )
+{
+   int i;
+
+   if ( entry->layout.numAttribs != layout->numAttribs || entry->indexBuffer != indexBuffer )
+   {
+      return GL_FALSE;
+   }
+
+   for ( i = 0; i < layout->numAttribs; i++ )
+   {
+      const ESVertexAttrib *a = &entry->layout.attribs[i];
+      const ESVertexAttrib *b = &layout->attribs[i];
+
+      if ( a->location != b->location || a->size != b->size || a->type != b->type ||
+            a->normalized != b->normalized || a->buffer != b->buffer || a->stride != b->stride ||
+            a->offset != b->offset || a->divisor != b->divisor )
+      {
+         return GL_FALSE;
+      }
+   }
+
+   for ( i = 0; i < numBuffers; i++ )
+   {
+      if ( entry->buffers[i] != buffers[i] )
+      {
+         return GL_FALSE;
+      }
+   }
+
+   return GL_TRUE;
+}
+
+///
+//  esVertexArrayCacheCreate()
+//
+ESVertexArrayCache *ESUTIL_API esVertexArrayCacheCreate ( void )
+{
+   return calloc ( 1, sizeof ( ESVertexArrayCache ) );
+}
+
+///
+//  esVertexArrayCacheGet()
+//
+GLuint ESUTIL_API esVertexArrayCacheGet ( ESContext *esContext, ESVertexArrayCache *cache,
+                                          const ESVertexLayout *layout, const GLuint *buffers, GLuint indexBuffer )
+{
+   int numBuffers = LayoutBufferCount ( layout );
+   unsigned int hash;
+   ESVertexArrayEntry *entry;
+   int i;
+
+   if ( layout->numAttribs > ES_MAX_VERTEX_ATTRIBS || numBuffers > ES_MAX_VERTEX_BUFFERS )
+   {
+      esLogMessage ( "esVertexArrayCacheGet: layout has too many attributes or buffers\n" );
+      return 0;
+   }
+
+   hash = HashVertexKey ( layout, buffers, numBuffers, indexBuffer );
+
+   for ( i = 0; i < cache->numEntries; i++ )
+   {
+      entry = &cache->entries[i];
+
+      if ( entry->hash == hash && VertexKeyEqual ( entry, layout, buffers, numBuffers, indexBuffer ) )
+      {
+         return entry->vertexArray;
+      }
+   }
+
+   if ( cache->numEntries == cache->maxEntries )
+   {
+      int maxEntries = cache->maxEntries > 0 ? cache->maxEntries * 2 : 8;
+      ESVertexArrayEntry *entries = realloc ( cache->entries, maxEntries * sizeof ( ESVertexArrayEntry ) );
+
+      if ( entries == NULL )
+      {
+         esLogMessage ( "esVertexArrayCacheGet: out of memory for %d vertex arrays\n", maxEntries );
+         return 0;
+      }
+
+      cache->entries = entries;
+      cache->maxEntries = maxEntries;
+   }
+
+   entry = &cache->entries[cache->numEntries++];
+   memset ( entry, 0, sizeof ( ESVertexArrayEntry ) );
+   entry->layout = *layout;
+   memcpy ( entry->buffers, buffers, numBuffers * sizeof ( GLuint ) );
+   entry->indexBuffer = indexBuffer;
+   entry->hash = hash;
+
+   // Record the layout in a new vertex array, which stays bound
+   glGenVertexArrays ( 1, &entry->vertexArray );
+   esBindVertexArray ( esContext, entry->vertexArray );
+
+   for ( i = 0; i < layout->numAttribs; i++ )
+   {
+      const ESVertexAttrib *attrib = &layout->attribs[i];
+
+      esBindBuffer ( esContext, GL_ARRAY_BUFFER, buffers[attrib->buffer] );
+      glVertexAttribPointer ( attrib->location, attrib->size, attrib->type, attrib->normalized,
+                              attrib->stride, ( const void * ) ( size_t ) attrib->offset );
+      glEnableVertexAttribArray ( attrib->location );
+      glVertexAttribDivisor ( attrib->location, attrib->divisor );
+   }
+
+   if ( indexBuffer != 0 )
+   {
+      esBindBuffer ( esContext, GL_ELEMENT_ARRAY_BUFFER, indexBuffer );
+   }
+
+   return entry->vertexArray;
+}
+
+///
+//  esVertexArrayCacheEvict()
+//
+void ESUTIL_API esVertexArrayCacheEvict ( ESContext *esContext, ESVertexArrayCache *cache, GLuint buffer )
+{
+   int i = 0;
+
+   while ( i < cache->numEntries )
+   {
+      ESVertexArrayEntry *entry = &cache->entries[i];
+      int numBuffers = LayoutBufferCount ( &entry->layout );
+      GLboolean uses = entry->indexBuffer == buffer;
+      int j;
+
+      for ( j = 0; j < numBuffers; j++ )
+      {
+         uses |= entry->buffers[j] == buffer;
+      }
+
+      if ( uses )
+      {
+         esDeleteVertexArrays ( esContext, 1, &entry->vertexArray );
+         *entry = cache->entries[--cache->numEntries];
+      }
+      else
+      {
+         i++;
+      }
+   }
+}
+
+///
+//  esVertexArrayCacheDestroy()
+//
+void ESUTIL_API esVertexArrayCacheDestroy ( ESContext *esContext, ESVertexArrayCache *cache )
+{
+   int i;
+
+   if ( cache == NULL )
+   {
+      return;
+   }
+
+   for ( i = 0; i < cache->numEntries; i++ )
+   {
+      esDeleteVertexArrays ( esContext, 1, &cache->entries[i].vertexArray );
+   }
+
+   free ( cache->entries );
+   free ( cache );
+}
+
+///
+//  esStreamBufferCreate()
+//
+ESStreamBuffer *ESUTIL_API esStreamBufferCreate ( ESContext *esContext, GLenum target, GLsizeiptr frameSize,
+                                                  int numFrames, GLint alignment, int policy )
+{
+   ESStreamBuffer *stream = calloc ( 1, sizeof ( ESStreamBuffer ) );
+
+   if ( stream == NULL )
+   {
+      return NULL;
+   }
+
+   stream->esContext = esContext;
+   stream->target = target;
+   stream->alignment = alignment < 1 ? 1 : alignment;
+   stream->policy = policy;
+
+   // Every region has to start at an aligned offset
+   stream->frameSize = ( frameSize + stream->alignment - 1 ) / stream->alignment * stream->alignment;
+   stream->numFrames = numFrames < 1 ? 1 : numFrames > ES_MAX_STREAM_FRAMES ? ES_MAX_STREAM_FRAMES : numFrames;
+   stream->frame = -1;
+
+   glGenBuffers ( 1, &stream->buffer );
+   esBindBuffer ( esContext, target, stream->buffer );
+   glBufferData ( target, stream->frameSize * stream->numFrames, NULL, GL_STREAM_DRAW );
+
+   return stream;
+}
+
+///
+//  OrphanStreamBuffer()
+//
+//    Give the buffer new storage.  The GPU keeps reading the old storage, so
+//    no region is in use afterwards and the fences can go.
+//
+static void OrphanStreamBuffer ( ESStreamBuffer *stream )
+{
+   int i;
+
+   glBufferData ( stream->target, stream->frameSize * stream->numFrames, NULL, GL_STREAM_DRAW );
+
+   for ( i = 0; i < stream->numFrames; i++ )
+   {
+      if ( stream->fences[i] != 0 )
+      {
+         glDeleteSync ( stream->fences[i] );
+         stream->fences[i] = 0;
+      }
+   }
+
+   stream->orphans++;
+}
+
+///
+//  esStreamBufferBeginFrame()
+//
+GLboolean ESUTIL_API esStreamBufferBeginFrame ( ESStreamBuffer *stream )
+{
+   GLsync fence;
+
+   esStreamBufferUpload ( stream );
+
+   // Everything drawn so far used the previous region
+   if ( stream->frame >= 0 )
+   {
+      stream->fences[stream->frame] = glFenceSync ( GL_SYNC_GPU_COMMANDS_COMPLETE, 0 );
+   }
+
+   stream->frame = ( stream->frame + 1 ) % stream->numFrames;
+   stream->used = 0;
+
+   esBindBuffer ( stream->esContext, stream->target, stream->buffer );
+
+   // Reuse the region once the GPU is done with it, or orphan rather than wait
+   fence = stream->fences[stream->frame];
+
+   if ( fence != 0 )
+   {
+      GLenum result;
+
+      if ( stream->policy == ES_STREAM_WAIT )
+      {
+         do
+         {
+            result = glClientWaitSync ( fence, GL_SYNC_FLUSH_COMMANDS_BIT, ES_STREAM_WAIT_TIMEOUT );
+         }
+         while ( result == GL_TIMEOUT_EXPIRED );
+      }
+      else
+      {
+         result = glClientWaitSync ( fence, 0, 0 );
+      }
+
+      // A failed wait orphans as well
+      if ( result == GL_ALREADY_SIGNALED || result == GL_CONDITION_SATISFIED )
+      {
+         glDeleteSync ( fence );
+         stream->fences[stream->frame] = 0;
+      }
+      else
+      {
+         OrphanStreamBuffer ( stream );
+      }
+   }
+
+   // The fence already protects the region, so the driver does not need to sync
+   stream->mapped = glMapBufferRange ( stream->target, stream->frame * stream->frameSize, stream->frameSize,
+                                       GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_RANGE_BIT |
+                                       GL_MAP_UNSYNCHRONIZED_BIT | GL_MAP_FLUSH_EXPLICIT_BIT );
+
+   return stream->mapped != NULL;
+}
+
+///
+//  esStreamBufferAlloc()
+//
+void *ESUTIL_API esStreamBufferAlloc ( ESStreamBuffer *stream, GLsizeiptr size, GLintptr *offset )
+{
+   GLintptr start = ( stream->used + stream->alignment - 1 ) / stream->alignment * stream->alignment;
+
+   if ( stream->mapped == NULL )
+   {
+      return NULL;
+   }
+
+   if ( start + size > stream->frameSize )
+   {
+      if ( !stream->overflowed )
+      {
+         esLog ( ES_LOG_WARNING, "Stream buffer frame of %ld bytes is full\n", ( long ) stream->frameSize );
+         stream->overflowed = GL_TRUE;
+      }
+
+      return NULL;
+   }
+
+   stream->used = start + size;
+   *offset = stream->frame * stream->frameSize + start;
+
+   return stream->mapped + start;
+}
+
+///
+//  esStreamBufferUpload()
+//
+void ESUTIL_API esStreamBufferUpload ( ESStreamBuffer *stream )
+{
+   if ( stream->mapped == NULL )
+   {
+      return;
+   }
+
+   esBindBuffer ( stream->esContext, stream->target, stream->buffer );
+
+   if ( stream->used > 0 )
+   {
+      glFlushMappedBufferRange ( stream->target, 0, stream->used );
+   }
+
+   if ( !glUnmapBuffer ( stream->target ) )
+   {
+      esLog ( ES_LOG_WARNING, "Stream buffer contents were lost, the frame may draw wrong data\n" );
+   }
+
+   stream->mapped = NULL;
+}
+
+///
+//  esStreamBufferGetBuffer()
+//
+GLuint ESUTIL_API esStreamBufferGetBuffer ( ESStreamBuffer *stream )
+{
+   return stream->buffer;
+}
+
+///
+//  esStreamBufferGetOrphans()
+//
+unsigned int ESUTIL_API esStreamBufferGetOrphans ( ESStreamBuffer *stream )
+{
+   return stream->orphans;
+}
+
+///
+//  esStreamBufferDestroy()
+//
+void ESUTIL_API esStreamBufferDestroy ( ESStreamBuffer *stream )
+{
+   int i;
+
+   if ( stream == NULL )
+   {
+      return;
+   }
+
+   esStreamBufferUpload ( stream );
+
+   for ( i = 0; i < stream->numFrames; i++ )
+   {
+      if ( stream->fences[i] != 0 )
+      {
+         glDeleteSync ( stream->fences[i] );
+      }
+   }
+
+   esDeleteBuffers ( stream->esContext, 1, &stream->buffer );
+   free ( stream );
+}
+
+///
+//  esGeometryArenaCreate()
+//
+ESGeometryArena *ESUTIL_API esGeometryArenaCreate ( ESContext *esContext, GLsizei vertexStride,
+                                                    GLsizeiptr vertexBlockSize, GLsizeiptr indexBlockSize )
+{
+   ESGeometryArena *arena = calloc ( 1, sizeof ( ESGeometryArena ) );
+
+   if ( arena == NULL )
+   {
+      return NULL;
+   }
+
+   arena->esContext = esContext;
+   arena->vertexStride = vertexStride;
+   arena->vertexBlockSize = vertexBlockSize;
+   arena->indexBlockSize = indexBlockSize;
+
+   return arena;
+}
+
+///
+//  AddArenaBlock()
+//
+//    Allocate the buffers of a new block, large enough for at least the
+//    given sizes
+//
+static ESArenaBlock *AddArenaBlock ( ESGeometryArena *arena, GLsizeiptr vertexSize, GLsizeiptr indexSize,
+                                     GLenum indexType )
+{
+   ESArenaBlock *blocks = realloc ( arena->blocks, ( arena->numBlocks + 1 ) * sizeof ( ESArenaBlock ) );
+   ESArenaBlock *block;
+
+   if ( blocks == NULL )
+   {
+      return NULL;
+   }
+
+   arena->blocks = blocks;
+   block = &blocks[arena->numBlocks++];
+   memset ( block, 0, sizeof ( ESArenaBlock ) );
+
+   block->vertexSize = vertexSize > arena->vertexBlockSize ? vertexSize : arena->vertexBlockSize;
+   block->indexSize = indexSize > arena->indexBlockSize ? indexSize : arena->indexBlockSize;
+   block->indexType = indexType;
+
+   // Vertices past the last one a GLushort can address would be wasted
+   if ( indexType == GL_UNSIGNED_SHORT &&
+         block->vertexSize > ( GLsizeiptr ) ES_MAX_SHORT_VERTICES * arena->vertexStride )
+   {
+      block->vertexSize = ( GLsizeiptr ) ES_MAX_SHORT_VERTICES * arena->vertexStride;
+   }
+
+   // Storage is filled with glBufferSubData through the copy target, which
+   // leaves the vertex array and index bindings alone
+   glGenBuffers ( 1, &block->vertexBuffer );
+   esBindBuffer ( arena->esContext, GL_COPY_WRITE_BUFFER, block->vertexBuffer );
+   glBufferData ( GL_COPY_WRITE_BUFFER, block->vertexSize, NULL, GL_STATIC_DRAW );
+
+   if ( block->indexSize > 0 )
+   {
+      glGenBuffers ( 1, &block->indexBuffer );
+      esBindBuffer ( arena->esContext, GL_COPY_WRITE_BUFFER, block->indexBuffer );
+      glBufferData ( GL_COPY_WRITE_BUFFER, block->indexSize, NULL, GL_STATIC_DRAW );
+   }
+
+   return block;
+}
+
+///
+//  esGeometryArenaAdd()
+//
+GLboolean ESUTIL_API esGeometryArenaAdd ( ESGeometryArena *arena, const void *vertices, int numVertices,
+                                          const GLuint *indices, int numIndices, ESArenaMesh *mesh )
+{
+   GLenum indexType = arena->esContext->indexPolicy == ES_INDEX_AUTO && numVertices <= ES_MAX_SHORT_VERTICES ?
+                      GL_UNSIGNED_SHORT : GL_UNSIGNED_INT;
+   GLsizeiptr indexTypeSize = indexType == GL_UNSIGNED_SHORT ? sizeof ( GLushort ) : sizeof ( GLuint );
+   GLsizeiptr vertexSize = ( GLsizeiptr ) numVertices * arena->vertexStride;
+   GLsizeiptr indexSize = ( GLsizeiptr ) numIndices * indexTypeSize;
+   ESArenaBlock *block = arena->numBlocks > 0 ? &arena->blocks[arena->numBlocks - 1] : NULL;
+
+   // Meshes go to the newest block, earlier blocks are left with their gaps.
+   // A mesh too large for GLushort indices gets a GLuint block of its own.
+   if ( block == NULL || block->vertexUsed + vertexSize > block->vertexSize ||
+         block->indexUsed + indexSize > block->indexSize ||
+         ( indices != NULL && block->indexType != indexType ) )
+   {
+      block = AddArenaBlock ( arena, vertexSize, indexSize, indexType );
+
+      if ( block == NULL )
+      {
+         esLogMessage ( "esGeometryArenaAdd: out of memory for a block\n" );
+         return GL_FALSE;
+      }
+   }
+
+   memset ( mesh, 0, sizeof ( ESArenaMesh ) );
+   mesh->vertexBuffer = block->vertexBuffer;
+   mesh->indexBuffer = block->indexBuffer;
+   mesh->firstVertex = ( GLint ) ( block->vertexUsed / arena->vertexStride );
+   mesh->numVertices = numVertices;
+   mesh->indexOffset = block->indexUsed;
+   mesh->numIndices = indices != NULL ? numIndices : 0;
+   mesh->indexType = block->indexType;
+
+   esBindBuffer ( arena->esContext, GL_COPY_WRITE_BUFFER, block->vertexBuffer );
+   glBufferSubData ( GL_COPY_WRITE_BUFFER, block->vertexUsed, vertexSize, vertices );
+   block->vertexUsed += vertexSize;
+
+   if ( indices == NULL || numIndices == 0 )
+   {
+      return GL_TRUE;
+   }
+
+   // ES 3.0 has no base vertex draws, so indices are rebased to where the
+   // vertices landed and every mesh of a block can share one vertex array
+   esBindBuffer ( arena->esContext, GL_COPY_WRITE_BUFFER, block->indexBuffer );
+
+   if ( block->indexType == GL_UNSIGNED_INT && mesh->firstVertex == 0 )
+   {
+      glBufferSubData ( GL_COPY_WRITE_BUFFER, block->indexUsed, indexSize, indices );
+   }
+   else
+   {
+      void *rebased = malloc ( indexSize );
+      int i;
+
+      if ( rebased == NULL )
+      {
+         esLogMessage ( "esGeometryArenaAdd: out of memory for %d indices\n", numIndices );
+         return GL_FALSE;
+      }
+
+      for ( i = 0; i < numIndices; i++ )
+      {
+         if ( block->indexType == GL_UNSIGNED_SHORT )
+         {
+            ( ( GLushort * ) rebased ) [i] = ( GLushort ) ( indices[i] + mesh->firstVertex );
+         }
+         else
+         {
+            ( ( GLuint * ) rebased ) [i] = indices[i] + mesh->firstVertex;
+         }
+      }
+
+      glBufferSubData ( GL_COPY_WRITE_BUFFER, block->indexUsed, indexSize, rebased );
+      free ( rebased );
+   }
+
+   block->indexUsed += indexSize;
+
+   return GL_TRUE;
+}
+
+///
+//  esGeometryArenaDestroy()
+//
+void ESUTIL_API esGeometryArenaDestroy ( ESGeometryArena *arena )
+{
+   int i;
+
+   if ( arena == NULL )
+   {
+      return;
+   }
+
+   for ( i = 0; i < arena->numBlocks; i++ )
+   {
+      esDeleteBuffers ( arena->esContext, 1, &arena->blocks[i].vertexBuffer );
+
+      if ( arena->blocks[i].indexBuffer != 0 )
+      {
+         esDeleteBuffers ( arena->esContext, 1, &arena->blocks[i].indexBuffer );
+      }
+   }
+
+   free ( arena->blocks );
+   free ( arena );
+}
+
+///
+//  esSetIndexPolicy()
+//
+void ESUTIL_API esSetIndexPolicy ( ESContext *esContext, int policy )
+{
+   esContext->indexPolicy = policy;
+}
+
+///
+//  esGetIndexPolicy()
+//
+int ESUTIL_API esGetIndexPolicy ( ESContext *esContext )
+{
+   return esContext->indexPolicy;
+}
+
+
+///
+// LogOutput()
+//
+//    Write one formatted message to the debug output for the platform
+//
+static void LogOutput ( int level, const char *text, int length )
+{
+#ifdef ANDROID
+   static const int priority[] = { ANDROID_LOG_DEBUG, ANDROID_LOG_INFO, ANDROID_LOG_WARN, ANDROID_LOG_ERROR };
+
+   // Callers pass the level of esLog unchecked
+   level = level < ES_LOG_DEBUG ? ES_LOG_DEBUG : level > ES_LOG_ERROR ? ES_LOG_ERROR : level;
+
+   ( void ) length;
+   __android_log_print ( priority[level], "esUtil", "%s", text );
+#else
+   ( void ) level;
+   fwrite ( text, 1, length, stdout );
+#endif
+}
+
+///
+// LogFormat()
+//
+//    Format a message into buf and return its length.  Messages that do not
+//    fit are cut off and end in "...\n" instead of overflowing the buffer.
+//
+static int LogFormat ( char *buf, int size, const char *formatStr, va_list params )
+{
+   static const char marker[] = "...\n";
+   int length = vsnprintf ( buf, size, formatStr, params );
+
+   if ( length < 0 )
+   {
+      buf[0] = '\0';
+      return 0;
+   }
+
+   if ( length >= size )
+   {
+      length = size - 1;
+      memcpy ( buf + length - ( sizeof ( marker ) - 1 ), marker, sizeof ( marker ) );
+   }
+
+   return length;
+}
+
+#ifndef ES_LOG_SYNCHRONOUS
+
+///
+// LogPending()
+//
+//    Whether the slot at the read position holds a published message
+//
+static int LogPending ( void )
+{
+   ESLogSlot *slot = &s_log.slots[s_log.dequeuePos & ( ES_LOG_SLOTS - 1 )];
+
+   return __atomic_load_n ( &slot->sequence, __ATOMIC_SEQ_CST ) == s_log.dequeuePos + 1;
+}
+
+///
+// LogDrain()
+//
+//    Write out every published message, drain thread only
+//
+static void LogDrain ( void )
+{
+   unsigned int dropped;
+   int count = 0;
+
+   while ( LogPending () )
+   {
+      ESLogSlot *slot = &s_log.slots[s_log.dequeuePos & ( ES_LOG_SLOTS - 1 )];
+
+      LogOutput ( slot->level, slot->text, slot->length );
+
+      // Hand the slot back to the producers one lap later
+      __atomic_store_n ( &slot->sequence, s_log.dequeuePos + ES_LOG_SLOTS, __ATOMIC_RELEASE );
+      __atomic_store_n ( &s_log.dequeuePos, s_log.dequeuePos + 1, __ATOMIC_RELEASE );
+      count++;
+   }
+
+   dropped = __atomic_load_n ( &s_log.dropped, __ATOMIC_RELAXED );
+
+   if ( dropped != s_log.reportedDropped )
+   {
+      char buf[64];
+      int length = snprintf ( buf, sizeof ( buf ), "esLog: %u messages dropped\n", dropped - s_log.reportedDropped );
+
+      LogOutput ( ES_LOG_WARNING, buf, length );
+      s_log.reportedDropped = dropped;
+      count++;
+   }
+
+   if ( count > 0 )
+   {
+      fflush ( stdout );
+   }
+}
+
+///
+// LogThread()
+//
+//    Drain thread, sleeps while the ring is empty
+//
+static void *LogThread ( void *arg )
+{
+   ( void ) arg;
+
+   pthread_mutex_lock ( &s_log.mutex );
+
+   for ( ;; )
+   {
+      pthread_mutex_unlock ( &s_log.mutex );
+      LogDrain ();
+      pthread_mutex_lock ( &s_log.mutex );
+
+      pthread_cond_broadcast ( &s_log.drained );
+
+      if ( s_log.quit )
+      {
+         break;
+      }
+
+      // Producers only take the mutex to wake us after they saw this flag,
+      // so the check below and the wait cannot miss a message
+      __atomic_store_n ( &s_log.sleeping, 1, __ATOMIC_SEQ_CST );
+
+      if ( !LogPending () )
+      {
+         pthread_cond_wait ( &s_log.wake, &s_log.mutex );
+      }
+
+      __atomic_store_n ( &s_log.sleeping, 0, __ATOMIC_SEQ_CST );
+   }
+
+   pthread_mutex_unlock ( &s_log.mutex );
+   return NULL;
+}
+
+///
+// LogShutdown()
+//
+//    Write out the remaining messages at exit
+//
+static void LogShutdown ( void )
+{
+   __atomic_store_n ( &s_log.running, 0, __ATOMIC_SEQ_CST );
+
+   pthread_mutex_lock ( &s_log.mutex );
+   s_log.quit = 1;
+   pthread_cond_signal ( &s_log.wake );
+   pthread_mutex_unlock ( &s_log.mutex );
+
+   pthread_join ( s_log.thread, NULL );
+}
+
+///
+// LogInit()
+//
+//    Start the drain thread on first use
+//
+static void LogInit ( void )
+{
+   unsigned int i;
+
+   for ( i = 0; i < ES_LOG_SLOTS; i++ )
+   {
+      s_log.slots[i].sequence = i;
+   }
+
+   pthread_mutex_init ( &s_log.mutex, NULL );
+   pthread_cond_init ( &s_log.wake, NULL );
+   pthread_cond_init ( &s_log.drained, NULL );
+
+   // Without the thread every message is written synchronously
+   if ( pthread_create ( &s_log.thread, NULL, LogThread, NULL ) != 0 )
+   {
+      return;
+   }
+
+   __atomic_store_n ( &s_log.running, 1, __ATOMIC_SEQ_CST );
+   atexit ( LogShutdown );
+}
+
+///
+// LogEnqueue()
+//
+//    Format a message straight into a free slot of the ring.  Returns
+//    GL_FALSE if the drain thread is not running.
+//
+static GLboolean LogEnqueue ( int level, const char *formatStr, va_list params )
+{
+   unsigned int pos;
+
+   pthread_once ( &s_logOnce, LogInit );
+
+   if ( !__atomic_load_n ( &s_log.running, __ATOMIC_ACQUIRE ) )
+   {
+      return GL_FALSE;
+   }
+
+   pos = __atomic_load_n ( &s_log.enqueuePos, __ATOMIC_RELAXED );
+
+   for ( ;; )
+   {
+      ESLogSlot *slot = &s_log.slots[pos & ( ES_LOG_SLOTS - 1 )];
+      int diff = ( int ) ( __atomic_load_n ( &slot->sequence, __ATOMIC_ACQUIRE ) - pos );
+
+      if ( diff == 0 )
+      {
+         // The slot is free, claim it (a failed exchange reloads pos)
+         if ( __atomic_compare_exchange_n ( &s_log.enqueuePos, &pos, pos + 1, 1,
+                                            __ATOMIC_RELAXED, __ATOMIC_RELAXED ) )
+         {
+            slot->level = level;
+            slot->length = LogFormat ( slot->text, ES_LOG_MESSAGE_SIZE, formatStr, params );
+            __atomic_store_n ( &slot->sequence, pos + 1, __ATOMIC_SEQ_CST );
+            break;
+         }
+      }
+      else if ( diff < 0 )
+      {
+         // The ring is full, drop the message rather than block the caller
+         __atomic_fetch_add ( &s_log.dropped, 1, __ATOMIC_RELAXED );
+         return GL_TRUE;
+      }
+      else
+      {
+         pos = __atomic_load_n ( &s_log.enqueuePos, __ATOMIC_RELAXED );
+      }
+   }
+
+   if ( __atomic_load_n ( &s_log.sleeping, __ATOMIC_SEQ_CST ) )
+   {
+      pthread_mutex_lock ( &s_log.mutex );
+      pthread_cond_signal ( &s_log.wake );
+      pthread_mutex_unlock ( &s_log.mutex );
+   }
+
+   return GL_TRUE;
+}
+
+#endif // #ifndef ES_LOG_SYNCHRONOUS
+
+///
+// LogMessageV()
+//
+static void LogMessageV ( int level, const char *formatStr, va_list params )
+{
+   char buf[ES_LOG_MESSAGE_SIZE];
+   int length;
+
+   if ( level < s_logLevel )
+   {
+      return;
+   }
+
+#ifndef ES_LOG_SYNCHRONOUS
+   if ( LogEnqueue ( level, formatStr, params ) )
+   {
+      return;
+   }
+#endif
+
+   length = LogFormat ( buf, sizeof ( buf ), formatStr, params );
+   LogOutput ( level, buf, length );
+}
+
+///
+// esLog()
+//
+//    Queue a message for the drain thread.  Formatting is the only work done
+//    on the calling thread; the write to the debug output happens later.
+//
+void ESUTIL_API esLog ( int level, const char *formatStr, ... )
+{
+   va_list params;
+
+   va_start ( params, formatStr );
+   LogMessageV ( level, formatStr, params );
+   va_end ( params );
+}
+
+///
+// esLogMessage()
+//
+//    Log an error message to the debug output for the platform
+//
+void ESUTIL_API esLogMessage ( const char *formatStr, ... )
+{
+   va_list params;
+
+   va_start ( params, formatStr );
+   LogMessageV ( ES_LOG_INFO, formatStr, params );
+   va_end ( params );
+}
+
+///
+// esSetLogLevel()
+//
+void ESUTIL_API esSetLogLevel ( int level )
+{
+   s_logLevel = level;
+}
+
+///
+// esLogDroppedCount()
+//
+unsigned int ESUTIL_API esLogDroppedCount ( void )
+{
+#ifndef ES_LOG_SYNCHRONOUS
+   return __atomic_load_n ( &s_log.dropped, __ATOMIC_RELAXED );
+#else
+   return 0;
+#endif
+}
+
+///
+// esLogFlush()
+//
+//    Wait until everything logged so far has been written
+//
+void ESUTIL_API esLogFlush ( void )
+{
+#ifndef ES_LOG_SYNCHRONOUS
+   unsigned int target;
+
+   if ( !__atomic_load_n ( &s_log.running, __ATOMIC_ACQUIRE ) )
+   {
+      return;
+   }
+
+   target = __atomic_load_n ( &s_log.enqueuePos, __ATOMIC_SEQ_CST );
+
+   pthread_mutex_lock ( &s_log.mutex );
+   pthread_cond_signal ( &s_log.wake );
+
+   while ( ( int ) ( __atomic_load_n ( &s_log.dequeuePos, __ATOMIC_ACQUIRE ) - target ) < 0 && !s_log.quit )
+   {
+      pthread_cond_wait ( &s_log.drained, &s_log.mutex );
+   }
+
+   pthread_mutex_unlock ( &s_log.mutex );
+#else
+   fflush ( stdout );
+#endif
+}
+
+///
+// esParseOptions()
+//
+//    Fill in the run options from the command line.  Recognized arguments:
+//       -offscreen   render to a pbuffer, no native window is created
+//       -frames N    exit the main loop after N frames (after warm-up)
+//       -warmup N    render N frames before counting -frames
+//       -benchmark   report frame-time statistics of the counted frames as JSON
+//       -report FILE write the benchmark report to FILE instead of stdout
+//       -fixeddt S   pass a fixed delta time of S seconds to the update callback
+//       -replay FILE pass the delta times recorded in FILE to the update callback
+//       -record FILE record the delta times passed to the update callback to FILE
+//                    (only the first of several -contexts records)
+//       -seed N      added to the seed of every esSeedRandom call
+//       -nopipeline  run the update callback on the GL thread
+//       -contexts N  run N copies of the application concurrently, one thread each
+//       -ondemand    only draw when the application requests a redraw
+//       -idletimeout S  call the update callback at least every S seconds in -ondemand mode
+//       -framesinflight N  let the driver queue at most N frames ahead of the GPU
+//       -swapinterval N  set the EGL swap interval, 0 disables vsync
+//       -capture FILE  stream every frame to FILE (.ppm, .y4m or raw RGBA)
+//
+GLboolean esParseOptions ( ESOptions *options, int argc, char *argv[] )
+{
+   GLboolean warmupSet = GL_FALSE;
+   int i;
+
+   if ( argc > 0 )
+   {
+      const char *slash = strrchr ( argv[0], '/' );
+      const char *backslash = strrchr ( argv[0], '\\' );
+
+      options->name = argv[0];
+
+      if ( slash != NULL && slash + 1 > options->name )
+      {
+         options->name = slash + 1;
+      }
+
+      if ( backslash != NULL && backslash + 1 > options->name )
+      {
+         options->name = backslash + 1;
+      }
+   }
+
+   for ( i = 1; i < argc; i++ )
+   {
+      if ( strcmp ( argv[i], "-offscreen" ) == 0 )
+      {
+         options->windowFlags |= ES_WINDOW_OFFSCREEN;
+      }
+      else if ( strcmp ( argv[i], "-frames" ) == 0 && i + 1 < argc )
+      {
+         options->numFrames = atoi ( argv[++i] );
+      }
+      else if ( strcmp ( argv[i], "-warmup" ) == 0 && i + 1 < argc )
+      {
+         options->numWarmupFrames = atoi ( argv[++i] );
+         warmupSet = GL_TRUE;
+      }
+      else if ( strcmp ( argv[i], "-benchmark" ) == 0 )
+      {
+         options->benchmark = GL_TRUE;
+      }
+      else if ( strcmp ( argv[i], "-report" ) == 0 && i + 1 < argc )
+      {
+         options->benchmarkFile = argv[++i];
+      }
+      else if ( strcmp ( argv[i], "-fixeddt" ) == 0 && i + 1 < argc )
+      {
+         options->fixedDeltaTime = ( float ) atof ( argv[++i] );
+      }
+      else if ( strcmp ( argv[i], "-replay" ) == 0 && i + 1 < argc )
+      {
+         options->replayFile = argv[++i];
+      }
+      else if ( strcmp ( argv[i], "-record" ) == 0 && i + 1 < argc )
+      {
+         options->recordFile = argv[++i];
+      }
+      else if ( strcmp ( argv[i], "-seed" ) == 0 && i + 1 < argc )
+      {
+         options->randomSeed = ( unsigned int ) strtoul ( argv[++i], NULL, 10 );
+      }
+      else if ( strcmp ( argv[i], "-nopipeline" ) == 0 )
+      {
+         options->noPipeline = GL_TRUE;
+      }
+      else if ( strcmp ( argv[i], "-contexts" ) == 0 && i + 1 < argc )
+      {
+         options->numContexts = atoi ( argv[++i] );
+      }
+      else if ( strcmp ( argv[i], "-ondemand" ) == 0 )
+      {
+         options->onDemand = GL_TRUE;
+      }
+      else if ( strcmp ( argv[i], "-idletimeout" ) == 0 && i + 1 < argc )
+      {
+         options->idleTimeout = ( float ) atof ( argv[++i] );
+      }
+      else if ( strcmp ( argv[i], "-framesinflight" ) == 0 && i + 1 < argc )
+      {
+         options->maxFramesInFlight = atoi ( argv[++i] );
+      }
+      else if ( strcmp ( argv[i], "-swapinterval" ) == 0 && i + 1 < argc )
+      {
+         options->overrideSwapInterval = GL_TRUE;
+         options->swapInterval = atoi ( argv[++i] );
+      }
+      else if ( strcmp ( argv[i], "-capture" ) == 0 && i + 1 < argc )
+      {
+         options->captureFile = argv[++i];
+      }
+      else if ( strcmp ( argv[i], "-programcache" ) == 0 && i + 1 < argc )
+      {
+         options->programCacheDir = argv[++i];
+      }
+      else
+      {
+         esLogMessage ( "Unknown option: %s\n", argv[i] );
+         esLogMessage ( "Usage: %s [-offscreen] [-frames N] [-warmup N] [-benchmark] [-report FILE]\n"
+                        "       [-fixeddt S] [-replay FILE] [-record FILE] [-seed N]\n"
+                        "       [-nopipeline] [-contexts N] [-ondemand] [-idletimeout S]\n"
+                        "       [-framesinflight N] [-swapinterval N] [-capture FILE]\n"
+                        "       [-programcache DIR]\n", argv[0] );
+         return GL_FALSE;
+      }
+   }
+
+   // Every context appends its own line to a shared report
+   if ( options->numContexts > 1 && options->benchmarkFile != NULL )
+   {
+      FILE *fp = fopen ( options->benchmarkFile, "w" );
+
+      if ( fp != NULL )
+      {
+         fclose ( fp );
+      }
+   }
+
+   // A benchmark always runs for a fixed number of frames
+   if ( options->benchmark )
+   {
+      if ( options->numFrames <= 0 )
+      {
+         options->numFrames = 300;
+      }
+
+      if ( !warmupSet )
+      {
+         options->numWarmupFrames = 60;
+      }
+   }
+
+   return GL_TRUE;
+}
+
+///
+// esFileRead()
+//
+//    Wrapper for platform specific File open
+//
+static esFile *esFileOpen ( void *ioContext, const char *fileName )
+{
+   esFile *pFile = NULL;
+
+#ifdef ANDROID
+
+   if ( ioContext != NULL )
+   {
+      AAssetManager *assetManager = ( AAssetManager * ) ioContext;
+      pFile = AAssetManager_open ( assetManager, fileName, AASSET_MODE_BUFFER );
+   }
+
+#else
+#ifdef __APPLE__
+   // iOS: Remap the filename to a path that can be opened from the bundle.
+   fileName = GetBundleFileName ( fileName );
+#endif
+
+   pFile = fopen ( fileName, "rb" );
+#endif
+
+   return pFile;
+}
+
+///
+// esFileRead()
+//
+//    Wrapper for platform specific File close
+//
+static void esFileClose ( esFile *pFile )
+{
+   if ( pFile != NULL )
+   {
+#ifdef ANDROID
+      AAsset_close ( pFile );
 #else
       fclose ( pFile );
       pFile = NULL;
@@ -380,6 +3040,26 @@ static int esFileRead ( esFile *pFile, int bytesToRead, void *buffer )
    return bytesRead;
 }
 
+///
+// esFileLength()
+//
+//    Wrapper for platform specific File size
+//
+static long esFileLength ( esFile *pFile )
+{
+   long length;
+
+#ifdef ANDROID
+   length = ( long ) AAsset_getLength ( pFile );
+#else
+   fseek ( pFile, 0, SEEK_END );
+   length = ftell ( pFile );
+   fseek ( pFile, 0, SEEK_SET );
+#endif
+
+   return length;
+}
+
 ///
 // esLoadTGA()
 //
@@ -398,7 +3078,7 @@ char *ESUTIL_API esLoadTGA ( void *ioContext, const char *fileName, int *width,
    if ( fp == NULL )
    {
       // Log error as 'error in opening the input file from apk'
-      esLogMessage ( "esLoadTGA FAILED to load : { %s }\n", fileName );
+      esLog ( ES_LOG_ERROR, "esLoadTGA FAILED to load : { %s }\n", fileName );
       return NULL;
    }
 
@@ -426,3 +3106,52 @@ char *ESUTIL_API esLoadTGA ( void *ioContext, const char *fileName, int *width,
 
    return ( NULL );
 }
+
+///
+// esLoadFile()
+//
+//    Loads a whole file, e.g. shader source, terminated with a '\0'
+//
+char *ESUTIL_API esLoadFile ( void *ioContext, const char *fileName, int *size )
+{
+   char     *buffer = NULL;
+   esFile   *fp;
+   long     length;
+
+   fp = esFileOpen ( ioContext, fileName );
+
+   if ( fp == NULL )
+   {
+      esLog ( ES_LOG_ERROR, "esLoadFile FAILED to load : { %s }\n", fileName );
+      return NULL;
+   }
+
+   length = esFileLength ( fp );
+
+   if ( length >= 0 )
+   {
+      buffer = ( char * ) malloc ( length + 1 );
+   }
+
+   if ( buffer != NULL )
+   {
+      if ( length > 0 && esFileRead ( fp, length, buffer ) <= 0 )
+      {
+         free ( buffer );
+         buffer = NULL;
+      }
+      else
+      {
+         buffer[length] = '\0';
+
+         if ( size != NULL )
+         {
+            *size = ( int ) length;
+         }
+      }
+   }
+
+   esFileClose ( fp );
+
+   return buffer;
+}
@@ -129,6 +129,12 @@ extern void esMain( ESContext *esContext );
     {
         _esContext.updateFunc( &_esContext, self.timeSinceLastUpdate );
     }
+
+    // iOS apps do not quit themselves, stop rendering instead
+    if ( _esContext.exitRequested )
+    {
+        self.paused = YES;
+    }
 }
 
 - (void)glkView:(GLKView *)view drawInRect:(CGRect)rect
@@ -0,0 +1,125 @@
+# Run one sample offscreen and compare its benchmark report with a baseline.
+#
+#   cmake -DSAMPLE=<executable> -DWORKING_DIR=<dir> -DREPORT=<json> -DBASELINE=<json>
+#         -DNEW_BASELINE=<json> -DFRAMES=<n> -DWARMUP=<n> -DHASH_TOLERANCE=<bits>
+#         [-DPERF_BASELINE_DIR=<dir> -DPERF_TOLERANCE=<percent>] [-DUPDATE=ON]
+#         -P RunSample.cmake
+#
+# BASELINE only holds what every machine renders the same: the frame count
+# and the hash.  UPDATE writes that to NEW_BASELINE, never to BASELINE.
+# Frame times are compared with PERF_BASELINE_DIR/<report name> when a
+# directory is given, the first run records them.
+
+cmake_minimum_required( VERSION 3.19 )
+
+# Number of set bits in the XOR of two 16 digit hex hashes
+function( hash_distance result a b )
+    set( distance 0 )
+    foreach( offset 0 8 )
+        string( SUBSTRING "${a}" ${offset} 8 part_a )
+        string( SUBSTRING "${b}" ${offset} 8 part_b )
+        math( EXPR diff "0x${part_a} ^ 0x${part_b}" )
+        while( diff GREATER 0 )
+            math( EXPR distance "${distance} + (${diff} & 1)" )
+            math( EXPR diff "${diff} >> 1" )
+        endwhile()
+    endforeach()
+    set( ${result} ${distance} PARENT_SCOPE )
+endfunction()
+
+# Milliseconds from the report in 0.1 us units, CMake has no floating point
+function( report_time result ms )
+    if( NOT ms MATCHES "^([0-9]+)\\.?([0-9]*)" )
+        message( FATAL_ERROR "Unexpected time '${ms}' in report" )
+    endif()
+    set( whole ${CMAKE_MATCH_1} )
+    string( SUBSTRING "${CMAKE_MATCH_2}0000" 0 4 fraction )
+    math( EXPR value "${whole} * 10000 + 1${fraction} - 10000" )
+    set( ${result} ${value} PARENT_SCOPE )
+endfunction()
+
+file( REMOVE ${REPORT} )
+
+execute_process( COMMAND ${SAMPLE} -offscreen -benchmark -frames ${FRAMES} -warmup ${WARMUP}
+                                   -fixeddt 0.0166667 -seed 1 -report ${REPORT}
+                 WORKING_DIRECTORY ${WORKING_DIR}
+                 RESULT_VARIABLE exit_code
+                 OUTPUT_VARIABLE output
+                 ERROR_VARIABLE output )
+
+if( NOT exit_code EQUAL 0 OR NOT EXISTS ${REPORT} )
+    message( FATAL_ERROR "${SAMPLE} failed (${exit_code}):\n${output}" )
+endif()
+
+file( READ ${REPORT} report )
+string( JSON frames GET "${report}" frames )
+string( JSON hash GET "${report}" hash )
+string( JSON median GET "${report}" frame median )
+string( JSON fps GET "${report}" fps )
+
+if( NOT frames EQUAL FRAMES )
+    message( FATAL_ERROR "Measured ${frames} of ${FRAMES} frames" )
+endif()
+
+if( PERF_BASELINE_DIR )
+    get_filename_component( report_name ${REPORT} NAME )
+    set( perf_baseline ${PERF_BASELINE_DIR}/${report_name} )
+endif()
+
+if( UPDATE )
+    string( JSON name GET "${report}" name )
+    file( WRITE ${NEW_BASELINE} "{\"name\":\"${name}\",\"frames\":${frames},\"hash\":\"${hash}\"}\n" )
+    message( STATUS "Baseline written to ${NEW_BASELINE}: hash ${hash}" )
+
+    if( perf_baseline )
+        configure_file( ${REPORT} ${perf_baseline} COPYONLY )
+        message( STATUS "Frame time baseline updated: ${fps} fps, median ${median} ms" )
+    endif()
+    return()
+endif()
+
+if( NOT EXISTS ${BASELINE} )
+    message( FATAL_ERROR "No baseline ${BASELINE}, configure with -DES_UPDATE_BASELINES=ON to write one "
+                         "to the build directory" )
+endif()
+
+file( READ ${BASELINE} baseline )
+string( JSON baseline_frames GET "${baseline}" frames )
+string( JSON baseline_hash GET "${baseline}" hash )
+
+hash_distance( distance ${hash} ${baseline_hash} )
+
+message( STATUS "${fps} fps, median ${median} ms, hash ${hash} (baseline ${baseline_hash}, ${distance} bits apart)" )
+
+# The hash of another frame count is of another frame
+if( NOT baseline_frames EQUAL frames )
+    message( FATAL_ERROR "Baseline ${BASELINE} is of ${baseline_frames} frames, not ${frames}" )
+endif()
+
+if( distance GREATER HASH_TOLERANCE )
+    message( FATAL_ERROR "Final frame differs from the baseline in ${distance} hash bits" )
+endif()
+
+if( NOT perf_baseline )
+    return()
+endif()
+
+if( NOT EXISTS ${perf_baseline} )
+    configure_file( ${REPORT} ${perf_baseline} COPYONLY )
+    message( STATUS "Frame time baseline recorded in ${perf_baseline}" )
+    return()
+endif()
+
+file( READ ${perf_baseline} perf )
+string( JSON baseline_median GET "${perf}" frame median )
+
+report_time( time ${median} )
+report_time( baseline_time ${baseline_median} )
+math( EXPR time_limit "${baseline_time} * (100 + ${PERF_TOLERANCE}) / 100" )
+
+message( STATUS "Median ${median} ms, baseline ${baseline_median} ms" )
+
+if( time GREATER time_limit )
+    message( FATAL_ERROR "Median frame time ${median} ms exceeds the baseline ${baseline_median} ms "
+                         "by more than ${PERF_TOLERANCE}%" )
+endif()